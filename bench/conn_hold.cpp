@@ -0,0 +1,203 @@
+// 空闲长连接容量测试：建立大量长连接并周期性发送keep-alive请求保持连接，
+// 统计存活的连接数，并读取服务器进程的内存占用，计算每个连接的平均内存开销
+//
+// 用法：conn_hold [-h ip] [-p port] [-n 连接数] [-s 源地址个数] [-i 心跳间隔秒] [-d 持续秒] [-P 服务器pid]
+// 单个源地址最多约28000个连接（受本地端口范围限制），更多连接时用-s使用127.0.0.2起的多个回环地址
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char REQUEST[] = "GET /hello HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+
+long now_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 读取/proc/pid/status中的某一项，单位kB
+long read_status_kb(int pid, const char *key)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+    char line[256];
+    long value = -1;
+    std::size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, key, key_len) == 0)
+        {
+            value = atol(line + key_len);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+int connect_one(const sockaddr_in &server, int src_index)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (src_index > 0)
+    {
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(0x7f000001 + src_index);   // 127.0.0.1 + src_index
+        local.sin_port = 0;
+        if (bind(fd, (sockaddr *)&local, sizeof(local)) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    if (connect(fd, (const sockaddr *)&server, sizeof(server)) == -1 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string host = "127.0.0.1";
+    int port = 80, conn_num = 10000, src_num = 1, interval = 2, duration = 30, server_pid = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:n:s:i:d:P:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'n': conn_num = atoi(optarg); break;
+        case 's': src_num = atoi(optarg); break;
+        case 'i': interval = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'P': server_pid = atoi(optarg); break;
+        default: break;
+        }
+    }
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &server.sin_addr);
+
+    long base_rss = server_pid > 0 ? read_status_kb(server_pid, "VmRSS:") : -1;
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<int> fds;
+    fds.reserve(conn_num);
+    long start = now_ms();
+    for (int i = 0; i < conn_num; ++i)
+    {
+        int fd = connect_one(server, src_num > 1 ? i % src_num : 0);
+        if (fd < 0)
+        {
+            fprintf(stderr, "connect #%d failed: %s\n", i, strerror(errno));
+            break;
+        }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        fds.push_back(fd);
+        // 立即发送第一个请求，新连接在服务器上的初始超时时间很短
+        send(fd, REQUEST, sizeof(REQUEST) - 1, MSG_NOSIGNAL);
+    }
+    printf("opened %zu connections in %ld ms\n", fds.size(), now_ms() - start);
+
+    // 周期性地在所有连接上发送请求，并读掉响应，被服务器关闭的连接不再重连
+    std::vector<char> alive(fds.size(), 1);
+    std::vector<int> index_of;      // 文件描述符到fds下标的映射
+    for (std::size_t i = 0; i < fds.size(); ++i)
+    {
+        if (fds[i] >= static_cast<int>(index_of.size()))
+            index_of.resize(fds[i] + 1, -1);
+        index_of[fds[i]] = static_cast<int>(i);
+    }
+    std::vector<epoll_event> events(4096);
+    char buf[4096];
+    long end = now_ms() + duration * 1000L;
+    long next_beat = now_ms() + interval * 1000L;
+    while (now_ms() < end)
+    {
+        if (now_ms() >= next_beat)
+        {
+            std::size_t live = 0;
+            for (std::size_t i = 0; i < fds.size(); ++i)
+            {
+                if (!alive[i])
+                    continue;
+                if (send(fds[i], REQUEST, sizeof(REQUEST) - 1, MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+                {
+                    alive[i] = 0;
+                    close(fds[i]);
+                    continue;
+                }
+                ++live;
+            }
+            long rss = server_pid > 0 ? read_status_kb(server_pid, "VmRSS:") : -1;
+            if (rss >= 0 && base_rss >= 0 && live > 0)
+                printf("alive %zu  server VmRSS %ld kB  (%.2f kB per connection)\n",
+                       live, rss, static_cast<double>(rss - base_rss) / live);
+            else
+                printf("alive %zu\n", live);
+            fflush(stdout);
+            next_beat = now_ms() + interval * 1000L;
+        }
+
+        int num = epoll_wait(epfd, events.data(), static_cast<int>(events.size()), 100);
+        for (int i = 0; i < num; ++i)
+        {
+            int fd = events[i].data.fd;
+            int len;
+            while ((len = recv(fd, buf, sizeof(buf), 0)) > 0) {}
+            if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                int idx = index_of[fd];
+                if (idx >= 0 && alive[idx])
+                {
+                    alive[idx] = 0;
+                    close(fd);   // 关闭时自动从epoll中删除
+                }
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < fds.size(); ++i)
+        if (alive[i])
+            close(fds[i]);
+    close(epfd);
+    return 0;
+}
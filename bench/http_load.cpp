@@ -0,0 +1,734 @@
+// HTTP压力测试工具，代替webbench：每个线程一个epoll，各自管理一部分连接，结束后合并统计
+// 闭环模式（默认）：每个连接保持-P个请求在途，收到一个响应后立即发出下一个请求
+// 开环模式（-R）：按固定的总速率安排请求，交给有空位的连接发出，
+//     延迟从请求按计划应该发出的时间算起（修正协调遗漏）：服务器变慢时请求在客户端排队，排队的时间也计入延迟，
+//     同时输出从实际发出算起的延迟作对比，两者差距大说明服务器跟不上这个速率
+// 短连接（默认）每个请求一个连接，延迟包括建立连接；-k使用长连接，可以加上-P流水线
+// 延迟直方图每个2的幂区间分成128格，百分位数的相对误差小于1%
+//
+// 用法：http_load [-c 连接数] [-t 线程数] [-d 测试秒数] [-w 预热秒数] [-R 每秒请求数] [-k] [-P 流水线深度]
+//                [-b POST实体主体字节数] [-j] http://ip:port/path
+// -j 以JSON输出结果，便于脚本比较
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/prctl.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <strings.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 80;
+    std::string path = "/";
+    int connections = 50;
+    int threads = 1;
+    double duration = 10;
+    double warmup = 0;
+    double rate = 0;            // 每秒请求数，为0时是闭环模式
+    bool keep_alive = false;
+    int pipeline = 1;
+    long body_bytes = -1;       // 小于0时发送GET
+    bool json = false;
+};
+
+int64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 对数线性分桶的延迟直方图（纳秒），和Metrics的分桶方式相同，只是每个区间分得更细
+class Histogram
+{
+public:
+    static const int SUB_BITS = 7;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_SHIFT = 40;
+    static const int BUCKETS = SUB_BUCKETS + (MAX_SHIFT + 1) * SUB_BUCKETS;
+
+    Histogram(): counts_(BUCKETS, 0), count_(0), sum_(0), max_(0) {}
+    void record(int64_t ns)
+    {
+        if (ns < 0)
+            ns = 0;
+        uint64_t v = static_cast<uint64_t>(ns);
+        ++counts_[bucketOf(v)];
+        ++count_;
+        sum_ += v;
+        if (v > max_)
+            max_ = v;
+    }
+    void merge(const Histogram &other)
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.max_ > max_)
+            max_ = other.max_;
+    }
+    uint64_t count() const {return count_;}
+    double mean() const {return count_ ? static_cast<double>(sum_) / count_ : 0;}
+    uint64_t max() const {return max_;}
+    // 取所在桶的上界，不超过最大值
+    uint64_t percentile(double q) const
+    {
+        if (count_ == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(q * count_);
+        if (rank >= count_)
+            rank = count_ - 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; ++b)
+        {
+            seen += counts_[b];
+            if (seen > rank)
+                return std::min(bucketUpper(b) - 1, max_);
+        }
+        return max_;
+    }
+
+private:
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < static_cast<uint64_t>(SUB_BUCKETS))
+            return static_cast<int>(ns);
+        int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+        if (shift > MAX_SHIFT)
+            return BUCKETS - 1;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + static_cast<int>((ns >> shift) - SUB_BUCKETS);
+    }
+    static uint64_t bucketUpper(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket + 1;
+        int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+        int sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+        return static_cast<uint64_t>(SUB_BUCKETS + sub + 1) << shift;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+// 一个在途的请求
+struct Pending
+{
+    int64_t intended;   // 按计划应该发出的时间，闭环模式下等于sent
+    int64_t sent;       // 实际放入发送缓冲的时间
+};
+
+struct Conn
+{
+    int fd = -1;
+    uint32_t gen = 0;           // 连接重建后递增，过滤同一轮epoll_wait中已关闭连接的事件
+    bool connected = false;
+    std::string out;            // 还没发送的请求
+    std::size_t out_off = 0;
+    std::string in;             // 还没解析完的响应
+    std::size_t in_off = 0;
+    std::deque<Pending> inflight;
+};
+
+struct Stats
+{
+    uint64_t requests = 0;      // 测量期间完成的请求
+    uint64_t non2xx = 0;
+    uint64_t connect_errors = 0;
+    uint64_t io_errors = 0;     // 读写失败或者对端在响应完成前关闭，在途的请求都算失败
+    uint64_t bytes = 0;         // 测量期间收到的响应字节数
+    Histogram latency;          // 开环模式下从计划时间算起
+    Histogram service;          // 从实际发出算起
+};
+
+const uint64_t TIMER_INDEX = ~0ULL;    // 定时器在epoll中的标记，连接的标记高32位是代数
+
+const int RESPONSE_AGAIN = 0;
+const int RESPONSE_ERROR = -1;
+
+/*
+    解析缓冲区开头的一个响应，完整时返回长度并给出状态码
+    服务器的响应都带Content-Length，没有时按非持续连接读到对端关闭为止，这里当作不完整
+    带Connection: close时（例如服务器平滑升级时的旧进程）closing为true，这个连接不能再发请求
+*/
+int parse_response(const char *p, std::size_t len, int *status, bool *closing)
+{
+    const char *end = static_cast<const char *>(memmem(p, len, "\r\n\r\n", 4));
+    if (!end)
+        return RESPONSE_AGAIN;
+    if (len < 12 || memcmp(p, "HTTP/1.", 7) != 0)
+        return RESPONSE_ERROR;
+    *status = atoi(p + 9);
+    std::size_t head_len = end - p + 4;
+    long body = -1;
+    *closing = false;
+    const char *line = static_cast<const char *>(memchr(p, '\n', head_len)) + 1;
+    while (line < end)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            body = atol(line + 15);
+        else if (strncasecmp(line, "Connection: close", 17) == 0)
+            *closing = true;
+        const char *next = static_cast<const char *>(memchr(line, '\n', end + 2 - line));
+        if (!next)
+            break;
+        line = next + 1;
+    }
+    if (body < 0)
+        return RESPONSE_AGAIN;
+    if (len < head_len + body)
+        return RESPONSE_AGAIN;
+    return static_cast<int>(head_len + body);
+}
+
+class Worker
+{
+public:
+    Worker(const Options &opt, const sockaddr_in &server, const std::string &request, int conn_num, double rate):
+        opt_(opt), server_(server), request_(request), conns_(conn_num), rate_(rate), epfd_(-1), timerfd_(-1),
+        start_(0), measure_start_(0), end_(0), issued_(0), interval_(rate > 0 ? 1e9 / rate : 0) {}
+    void run(int64_t start);
+    const Stats &stats() const {return stats_;}
+
+private:
+    void openConn(Conn &c, uint32_t index);
+    void closeConn(Conn &c, bool failed);
+    void send(Conn &c, uint32_t index, int64_t intended, int64_t now);
+    void flush(Conn &c, uint32_t index);
+    void onReadable(Conn &c, uint32_t index);
+    void onResponse(Conn &c, uint32_t index, int status, bool closing, std::size_t len, int64_t now);
+    void refill(Conn &c, uint32_t index, int64_t now);
+    void issueDue(int64_t now);
+    bool hasRoom(const Conn &c) const
+    {
+        return static_cast<int>(c.inflight.size()) < (opt_.keep_alive ? opt_.pipeline : 1);
+    }
+    int64_t intendedTime(uint64_t k) const {return start_ + static_cast<int64_t>(k * interval_);}
+
+    const Options &opt_;
+    const sockaddr_in server_;
+    const std::string &request_;
+    std::vector<Conn> conns_;
+    double rate_;
+    int epfd_;
+    int timerfd_;               // 开环模式下在下一个请求的计划时间唤醒，epoll_wait的超时只有毫秒精度
+    int64_t start_;
+    int64_t measure_start_;
+    int64_t end_;
+    uint64_t issued_;           // 开环模式下已经发出的请求数，第k个请求的计划时间是start_ + k * interval_
+    double interval_;
+    Stats stats_;
+};
+
+void Worker::openConn(Conn &c, uint32_t index)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ++c.gen;
+    c.connected = false;
+    if (c.fd < 0)
+    {
+        ++stats_.connect_errors;
+        return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c.fd, reinterpret_cast<const sockaddr *>(&server_), sizeof(server_)) == -1 && errno != EINPROGRESS)
+    {
+        ++stats_.connect_errors;
+        close(c.fd);
+        c.fd = -1;
+        return;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = (static_cast<uint64_t>(c.gen) << 32) | index;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+// failed为true时在途的请求都算失败
+void Worker::closeConn(Conn &c, bool failed)
+{
+    if (c.fd >= 0)
+        close(c.fd);
+    c.fd = -1;
+    c.connected = false;
+    if (failed)
+        stats_.io_errors += c.inflight.size();
+    c.inflight.clear();
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+    c.in_off = 0;
+}
+
+void Worker::send(Conn &c, uint32_t index, int64_t intended, int64_t now)
+{
+    if (c.fd < 0)
+    {
+        openConn(c, index);
+        if (c.fd < 0)
+            return;
+    }
+    c.out += request_;
+    c.inflight.push_back(Pending{intended, now});
+}
+
+void Worker::flush(Conn &c, uint32_t index)
+{
+    if (!c.connected || c.fd < 0)
+        return;
+    while (c.out_off < c.out.size())
+    {
+        ssize_t n = ::send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR)
+                continue;
+            closeConn(c, true);
+            refill(c, index, now_ns());
+            return;
+        }
+        c.out_off += n;
+    }
+    c.out.clear();
+    c.out_off = 0;
+}
+
+void Worker::onReadable(Conn &c, uint32_t index)
+{
+    char buf[1 << 16];
+    bool eof = false;
+    while (c.fd >= 0)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0)
+            eof = true;
+        else if (errno == EINTR)
+            continue;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            eof = true;
+        break;
+    }
+
+    uint32_t gen = c.gen;
+    int64_t now = now_ns();
+    while (c.fd >= 0 && c.gen == gen && !c.inflight.empty())
+    {
+        int status = 0;
+        bool closing = false;
+        int len = parse_response(c.in.data() + c.in_off, c.in.size() - c.in_off, &status, &closing);
+        if (len == RESPONSE_AGAIN)
+            break;
+        if (len == RESPONSE_ERROR)
+        {
+            closeConn(c, true);
+            refill(c, index, now);
+            return;
+        }
+        onResponse(c, index, status, closing, len, now);
+    }
+    if (c.fd >= 0 && c.gen == gen)
+    {
+        if (c.in_off == c.in.size())
+        {
+            c.in.clear();
+            c.in_off = 0;
+        }
+        else if (c.in_off > (1 << 16))
+        {
+            c.in.erase(0, c.in_off);
+            c.in_off = 0;
+        }
+        if (eof)
+        {
+            // 长连接被服务器关闭（例如超时），在途的请求失败，重新建立连接
+            closeConn(c, !c.inflight.empty());
+            refill(c, index, now);
+        }
+    }
+}
+
+void Worker::onResponse(Conn &c, uint32_t index, int status, bool closing, std::size_t len, int64_t now)
+{
+    Pending req = c.inflight.front();
+    c.inflight.pop_front();
+    c.in_off += len;
+    if (now >= measure_start_)
+    {
+        ++stats_.requests;
+        stats_.bytes += len;
+        if (status < 200 || status >= 300)
+            ++stats_.non2xx;
+        stats_.latency.record(now - req.intended);
+        stats_.service.record(now - req.sent);
+    }
+    // 短连接由服务器在响应后关闭，不等对端的FIN；长连接收到Connection: close时同样处理，
+    // 流水线中已经发出的后续请求算失败
+    if (!opt_.keep_alive || closing)
+        closeConn(c, !c.inflight.empty());
+    refill(c, index, now);
+}
+
+// 连接有空位时：闭环模式立即补上请求，开环模式发出已经到期的请求
+void Worker::refill(Conn &c, uint32_t index, int64_t now)
+{
+    if (now >= end_)
+        return;
+    if (rate_ > 0)
+    {
+        issueDue(now);
+        return;
+    }
+    while (hasRoom(c))
+    {
+        std::size_t before = c.inflight.size();
+        send(c, index, now, now);
+        if (c.inflight.size() == before)
+            return;     // 连接失败
+    }
+    flush(c, index);
+}
+
+// 开环模式：把到期的请求依次交给有空位的连接，没有空位时留到有连接空出来再发，计划时间不变
+void Worker::issueDue(int64_t now)
+{
+    for (uint32_t i = 0; i < conns_.size() && intendedTime(issued_) <= now; ++i)
+    {
+        Conn &c = conns_[i];
+        bool queued = false;
+        while (hasRoom(c) && intendedTime(issued_) <= now)
+        {
+            std::size_t before = c.inflight.size();
+            send(c, i, intendedTime(issued_), now);
+            if (c.inflight.size() == before)
+                break;
+            ++issued_;
+            queued = true;
+        }
+        if (queued)
+            flush(c, i);
+    }
+}
+
+void Worker::run(int64_t start)
+{
+    start_ = start;
+    measure_start_ = start + static_cast<int64_t>(opt_.warmup * 1e9);
+    end_ = measure_start_ + static_cast<int64_t>(opt_.duration * 1e9);
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<epoll_event> events(conns_.size() + 1);
+    if (rate_ > 0)
+    {
+        // 默认的定时器松弛是50微秒，会直接加到修正后的延迟上
+        prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+        timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = TIMER_INDEX;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, timerfd_, &ev);
+    }
+
+    if (rate_ <= 0)
+    {
+        for (uint32_t i = 0; i < conns_.size(); ++i)
+            refill(conns_[i], i, start);
+    }
+    else if (opt_.keep_alive)
+    {
+        for (uint32_t i = 0; i < conns_.size(); ++i)
+            openConn(conns_[i], i);
+    }
+
+    int64_t now = now_ns();
+    int64_t armed = 0;
+    while (now < end_)
+    {
+        if (rate_ > 0)
+        {
+            issueDue(now);
+            // 下一个请求已经到期说明所有连接都没有空位，等连接空出来时再发，不设置定时器
+            int64_t next = intendedTime(issued_);
+            if (next > now && next != armed)
+            {
+                itimerspec its;
+                memset(&its, 0, sizeof(its));
+                its.it_value.tv_sec = next / 1000000000;
+                its.it_value.tv_nsec = next % 1000000000;
+                timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &its, NULL);
+                armed = next;
+            }
+        }
+        int n = epoll_wait(epfd_, events.data(), static_cast<int>(events.size()), 100);
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.u64 == TIMER_INDEX)
+            {
+                uint64_t expirations;
+                ssize_t ret = read(timerfd_, &expirations, sizeof(expirations));
+                (void)ret;      // 只是清除可读状态，到期的请求在下一轮发出
+                continue;
+            }
+            uint32_t index = static_cast<uint32_t>(events[i].data.u64);
+            uint32_t gen = static_cast<uint32_t>(events[i].data.u64 >> 32);
+            Conn &c = conns_[index];
+            if (c.fd < 0 || c.gen != gen)
+                continue;
+            if (!c.connected && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0)
+                {
+                    ++stats_.connect_errors;
+                    c.inflight.clear();
+                    closeConn(c, false);
+                    refill(c, index, now_ns());
+                    continue;
+                }
+                c.connected = true;
+            }
+            if (events[i].events & EPOLLOUT)
+                flush(c, index);
+            if (c.fd >= 0 && c.gen == gen && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                onReadable(c, index);
+        }
+        now = now_ns();
+    }
+    for (Conn &c : conns_)
+        closeConn(c, false);
+    if (timerfd_ >= 0)
+        close(timerfd_);
+    close(epfd_);
+}
+
+struct ThreadArg
+{
+    Worker *worker;
+    int64_t start;
+};
+
+void *thread_func(void *arg)
+{
+    ThreadArg *ta = static_cast<ThreadArg *>(arg);
+    ta->worker->run(ta->start);
+    return NULL;
+}
+
+// 只支持http://host[:port][/path]
+bool parse_url(const char *url, Options &opt)
+{
+    const char *p = url;
+    if (strncmp(p, "http://", 7) == 0)
+        p += 7;
+    const char *slash = strchr(p, '/');
+    std::string authority = slash ? std::string(p, slash) : std::string(p);
+    opt.path = slash ? slash : "/";
+    std::size_t colon = authority.rfind(':');
+    if (colon != std::string::npos)
+    {
+        opt.port = atoi(authority.c_str() + colon + 1);
+        authority.resize(colon);
+    }
+    opt.host = authority;
+    return !opt.host.empty() && opt.port > 0 && opt.port < 65536;
+}
+
+bool resolve(const Options &opt, sockaddr_in &addr)
+{
+    addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opt.host.c_str(), NULL, &hints, &res) != 0 || !res)
+        return false;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    addr.sin_port = htons(opt.port);
+    freeaddrinfo(res);
+    return true;
+}
+
+std::string build_request(const Options &opt)
+{
+    std::string req = (opt.body_bytes >= 0 ? "POST " : "GET ") + opt.path + " HTTP/1.1\r\n";
+    req += "Host: " + opt.host + "\r\n";
+    req += opt.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if (opt.body_bytes >= 0)
+    {
+        req += "Content-Type: text/plain\r\n";
+        req += "Content-Length: " + std::to_string(opt.body_bytes) + "\r\n\r\n";
+        for (long i = 0; i < opt.body_bytes; ++i)
+            req += static_cast<char>('a' + i % 26);
+    }
+    else
+        req += "\r\n";
+    return req;
+}
+
+void print_text(const Options &opt, const Stats &st)
+{
+    const char *mode = opt.rate > 0 ? "open" : "closed";
+    printf("%s loop, %d threads, %d connections, %s", mode, opt.threads, opt.connections,
+           opt.keep_alive ? "keep-alive" : "short connections");
+    if (opt.keep_alive && opt.pipeline > 1)
+        printf(", pipeline %d", opt.pipeline);
+    if (opt.rate > 0)
+        printf(", target %.0f req/s", opt.rate);
+    printf("\n");
+    printf("requests %llu in %.2fs, %.1f req/s, %.2f MB/s\n", static_cast<unsigned long long>(st.requests),
+           opt.duration, st.requests / opt.duration, st.bytes / opt.duration / (1 << 20));
+    printf("errors: connect %llu, io %llu, non-2xx %llu\n", static_cast<unsigned long long>(st.connect_errors),
+           static_cast<unsigned long long>(st.io_errors), static_cast<unsigned long long>(st.non2xx));
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "latency(us)", "mean", "p50", "p90", "p99", "p99.9", "max");
+    const Histogram *hists[] = {&st.latency, &st.service};
+    const char *names[] = {opt.rate > 0 ? "corrected" : "all", "uncorrected"};
+    for (int i = 0; i < (opt.rate > 0 ? 2 : 1); ++i)
+    {
+        const Histogram &h = *hists[i];
+        printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[i], h.mean() / 1e3,
+               h.percentile(0.5) / 1e3, h.percentile(0.9) / 1e3, h.percentile(0.99) / 1e3,
+               h.percentile(0.999) / 1e3, h.max() / 1e3);
+    }
+}
+
+void print_latency_json(const char *name, const Histogram &h)
+{
+    printf("\"%s\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+           name, h.mean() / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.9) / 1e3, h.percentile(0.99) / 1e3,
+           h.percentile(0.999) / 1e3, h.max() / 1e3);
+}
+
+void print_json(const Options &opt, const Stats &st)
+{
+    printf("{\"mode\": \"%s\", \"threads\": %d, \"connections\": %d, \"keep_alive\": %s, \"pipeline\": %d, ",
+           opt.rate > 0 ? "open" : "closed", opt.threads, opt.connections, opt.keep_alive ? "true" : "false",
+           opt.keep_alive ? opt.pipeline : 1);
+    printf("\"method\": \"%s\", \"path\": \"%s\", \"target_rate\": %.1f, \"duration\": %.2f, ",
+           opt.body_bytes >= 0 ? "POST" : "GET", opt.path.c_str(), opt.rate, opt.duration);
+    printf("\"requests\": %llu, \"rate\": %.1f, \"bytes\": %llu, ", static_cast<unsigned long long>(st.requests),
+           st.requests / opt.duration, static_cast<unsigned long long>(st.bytes));
+    printf("\"errors\": {\"connect\": %llu, \"io\": %llu, \"non2xx\": %llu}, ",
+           static_cast<unsigned long long>(st.connect_errors), static_cast<unsigned long long>(st.io_errors),
+           static_cast<unsigned long long>(st.non2xx));
+    // 单位是微秒，闭环模式下两者相同
+    print_latency_json("latency_us", st.latency);
+    printf(", ");
+    print_latency_json("uncorrected_latency_us", st.service);
+    printf("}\n");
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-c connections] [-t threads] [-d seconds] [-w warmup_seconds] [-R rate] [-k] "
+                    "[-P pipeline] [-b post_body_bytes] [-j] http://ip:port/path\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    int opt_char;
+    while ((opt_char = getopt(argc, argv, "c:t:d:w:R:kP:b:j")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'c': opt.connections = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atof(optarg); break;
+        case 'w': opt.warmup = atof(optarg); break;
+        case 'R': opt.rate = atof(optarg); break;
+        case 'k': opt.keep_alive = true; break;
+        case 'P': opt.pipeline = atoi(optarg); break;
+        case 'b': opt.body_bytes = atol(optarg); break;
+        case 'j': opt.json = true; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc || !parse_url(argv[optind], opt) || opt.connections <= 0 || opt.threads <= 0 ||
+        opt.duration <= 0 || opt.pipeline <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.threads > opt.connections)
+        opt.threads = opt.connections;
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    if (!resolve(opt, server))
+    {
+        fprintf(stderr, "cannot resolve %s\n", opt.host.c_str());
+        return 1;
+    }
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    // 连接和速率平均分给各个线程
+    std::string request = build_request(opt);
+    std::vector<Worker *> workers;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        int conn_num = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+        workers.push_back(new Worker(opt, server, request, conn_num, opt.rate / opt.threads));
+    }
+    std::vector<pthread_t> tids(opt.threads);
+    std::vector<ThreadArg> args(opt.threads);
+    int64_t start = now_ns();
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        args[i].worker = workers[i];
+        args[i].start = start;
+        pthread_create(&tids[i], NULL, thread_func, &args[i]);
+    }
+    Stats total;
+    for (int i = 0; i < opt.threads; ++i)
+    {
+        pthread_join(tids[i], NULL);
+        const Stats &st = workers[i]->stats();
+        total.requests += st.requests;
+        total.non2xx += st.non2xx;
+        total.connect_errors += st.connect_errors;
+        total.io_errors += st.io_errors;
+        total.bytes += st.bytes;
+        total.latency.merge(st.latency);
+        total.service.merge(st.service);
+        delete workers[i];
+    }
+
+    if (opt.json)
+        print_json(opt, total);
+    else
+        print_text(opt, total);
+    return 0;
+}
@@ -0,0 +1,313 @@
+// 异步日志前端的基准测试：多个线程同时写日志，比较每个线程一个环形缓冲区的前端和原来全局加锁的前端
+// 输出不同线程数下每秒调用前端的次数（从第一条开始到所有线程写完），其中没有因为缓冲区满被丢弃的条数
+// -f 改为比较完整的LOG_INFO调用（格式化加写入前端）在文本模式和二进制模式下的吞吐量和每条消耗写日志线程的CPU时间
+//
+// -l 环形缓冲区的前端使用无损模式（环满时等待后端而不是丢弃），同时输出等待的次数
+//
+// 用法：log_bench [-n 每个线程的条数] [-t 最多的线程数] [-f] [-l]
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AsyncLogging.h"
+#include "Logging.h"
+#include "Sync.h"
+
+namespace {
+
+const char LINE[] = "20230706 21:05:57.229383 12345 INFO Receive GET request successful, socket = 123 - /src/HttpTask.cpp:195\n";
+
+double now_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// 原来的前端：所有线程共用两个4MB缓冲区，每条日志都要加全局锁
+class LegacyAsyncLogging
+{
+    using Buffer = FixedBuffer<LargeBufferSize>;
+    using BufferPtr = std::unique_ptr<Buffer>;
+public:
+    explicit LegacyAsyncLogging(const std::string &filename):
+        file_(fopen(filename.c_str(), "w")), running_(true), cond_(locker_),
+        currentBuffer_(new Buffer), nextBuffer_(new Buffer), dropped_(0)
+    {
+        pthread_create(&tid_, NULL, threadFunction, this);
+    }
+    ~LegacyAsyncLogging() {fclose(file_);}
+    void stop()
+    {
+        locker_.lock();
+        running_ = false;
+        cond_.signal();
+        locker_.unlock();
+        pthread_join(tid_, NULL);
+    }
+    void append(const char *logline, int len, int64_t)
+    {
+        locker_.lock();
+        if (currentBuffer_->avail() <= static_cast<std::size_t>(len))
+        {
+            buffers_.push_back(std::move(currentBuffer_));
+            if (nextBuffer_)
+                currentBuffer_ = std::move(nextBuffer_);
+            else
+                currentBuffer_.reset(new Buffer);
+            cond_.signal();
+        }
+        currentBuffer_->append(logline, len);
+        locker_.unlock();
+    }
+    unsigned long dropped() const {return dropped_;}
+
+private:
+    static void *threadFunction(void *arg)
+    {
+        static_cast<LegacyAsyncLogging *>(arg)->threadFunc();
+        return NULL;
+    }
+    void threadFunc()
+    {
+        std::vector<BufferPtr> toWrite;
+        bool stopping = false;
+        while (!stopping)
+        {
+            locker_.lock();
+            if (buffers_.empty() && running_)
+                cond_.waitForSeconds(3);
+            stopping = !running_;
+            buffers_.push_back(std::move(currentBuffer_));
+            currentBuffer_.reset(new Buffer);
+            toWrite.swap(buffers_);
+            if (!nextBuffer_)
+                nextBuffer_.reset(new Buffer);
+            locker_.unlock();
+            // 和原来一样，积压超过25个缓冲区时丢弃
+            if (toWrite.size() > 25)
+            {
+                for (std::size_t i = 2; i < toWrite.size(); ++i)
+                    dropped_ += toWrite[i]->size() / (sizeof(LINE) - 1);
+                toWrite.resize(2);
+            }
+            for (auto &bp : toWrite)
+                fwrite(bp->getData(), 1, bp->size(), file_);
+            toWrite.clear();
+            fflush(file_);
+        }
+    }
+
+    FILE *file_;
+    bool running_;
+    pthread_t tid_;
+    Locker locker_;
+    Conditon cond_;
+    BufferPtr currentBuffer_;
+    BufferPtr nextBuffer_;
+    std::vector<BufferPtr> buffers_;
+    std::atomic<unsigned long> dropped_;
+};
+
+template <typename Logger>
+struct Job
+{
+    Logger *logger;
+    long lines;
+    std::atomic<int> *ready;
+    int threads;
+};
+
+template <typename Logger>
+void *producer(void *arg)
+{
+    Job<Logger> *job = static_cast<Job<Logger> *>(arg);
+    // 所有线程都启动后一起开始
+    job->ready->fetch_add(1);
+    while (job->ready->load() < job->threads)
+        sched_yield();
+    for (long i = 0; i < job->lines; ++i)
+        job->logger->append(LINE, sizeof(LINE) - 1, now_us());
+    return NULL;
+}
+
+// 返回用时（秒）
+template <typename Logger>
+double run(Logger *logger, int threads, long lines)
+{
+    std::vector<pthread_t> tids(threads);
+    std::atomic<int> ready(0);
+    Job<Logger> job = {logger, lines, &ready, threads};
+    double start = now_sec();
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, producer<Logger>, &job);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    return now_sec() - start;
+}
+
+void report(const char *name, int threads, long lines, double elapsed, unsigned long dropped, unsigned long stalls = 0)
+{
+    double total = static_cast<double>(threads) * lines;
+    printf("%-8s threads=%-3d %12.0f lines/s  kept %12.0f lines/s  dropped=%lu  stalls=%lu\n",
+           name, threads, total / elapsed, (total - dropped) / elapsed, dropped, stalls);
+}
+
+// 和服务器中常见的日志一样，几个字符串和整数
+struct LoggerJob
+{
+    long lines;
+    std::atomic<int> *ready;
+    int threads;
+    std::atomic<long> cpu_ns;   // 所有写日志线程自己的CPU时间，不包括后端
+};
+
+void *logger_producer(void *arg)
+{
+    LoggerJob *job = static_cast<LoggerJob *>(arg);
+    const std::string method = "GET";
+    job->ready->fetch_add(1);
+    while (job->ready->load() < job->threads)
+        sched_yield();
+    timespec begin, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+    for (long i = 0; i < job->lines; ++i)
+        LOG_INFO << "Receive " << method << " request successful, socket = " << static_cast<int>(i & 0xffff)
+                 << ", bytes = " << i;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    job->cpu_ns += (end.tv_sec - begin.tv_sec) * 1000000000L + (end.tv_nsec - begin.tv_nsec);
+    return NULL;
+}
+
+// 日志文件名由Logging决定，模式也只能在第一条日志之前设置，所以每种模式在一个子进程的临时目录中运行
+void run_logger(bool binary, int max_threads, long lines)
+{
+    char dir[] = "/tmp/log_bench.XXXXXX";
+    if (!mkdtemp(dir))
+        return;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (chdir(dir) != 0)
+            _exit(1);
+        AsyncLogging::Options options;
+        options.binary = binary;
+        Logger::setOptions(options);
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            std::vector<pthread_t> tids(threads);
+            std::atomic<int> ready(0);
+            LoggerJob job;
+            job.lines = lines;
+            job.ready = &ready;
+            job.threads = threads;
+            job.cpu_ns = 0;
+            double start = now_sec();
+            for (int i = 0; i < threads; ++i)
+                pthread_create(&tids[i], NULL, logger_producer, &job);
+            for (int i = 0; i < threads; ++i)
+                pthread_join(tids[i], NULL);
+            double elapsed = now_sec() - start;
+            double total = static_cast<double>(threads) * lines;
+            printf("%-8s threads=%-3d %12.0f lines/s  front end %8.1f ns/line\n",
+                   binary ? "binary" : "text", threads, total / elapsed, job.cpu_ns / total);
+            fflush(stdout);
+        }
+        exit(0);    // 析构异步日志，等后端写完
+    }
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+    if (DIR *d = opendir(dir))
+    {
+        while (dirent *entry = readdir(d))
+        {
+            if (entry->d_name[0] != '.')
+                unlink((std::string(dir) + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    long lines = 1000000;
+    int max_threads = 8;
+    bool front_end = false;
+    bool lossless = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:fl")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            lines = atol(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'f':
+            front_end = true;
+            break;
+        case 'l':
+            lossless = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (front_end)
+    {
+        run_logger(false, max_threads, lines);
+        run_logger(true, max_threads, lines);
+        return 0;
+    }
+
+    char filename[64];
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        snprintf(filename, sizeof(filename), "log_bench.%d.legacy.log", getpid());
+        {
+            LegacyAsyncLogging logger(filename);
+            double elapsed = run(&logger, threads, lines);
+            logger.stop();
+            report("legacy", threads, lines, elapsed, logger.dropped());
+        }
+        unlink(filename);
+
+        snprintf(filename, sizeof(filename), "log_bench.%d.ring.", getpid());
+        {
+            AsyncLogging::Options options;
+            options.roll_bytes = 0;
+            options.roll_interval = 0;
+            options.lossless = lossless;
+            AsyncLogging logger(filename, 3, options);
+            logger.start();
+            double elapsed = run(&logger, threads, lines);
+            logger.stop();
+            report("ring", threads, lines, elapsed, logger.dropped(), logger.stalls());
+            unlink(logger.filename().c_str());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+// 热点组件的微基准测试，不需要网络，每项在1到-t个线程下分别运行，输出总吞吐量和每个线程平均每次操作的时间
+//     parser   HttpParser解析几种抓取到的真实请求（浏览器、curl、条件请求、Range、POST），每个线程一个解析器
+//     timer    长连接的定时器刷新（每个请求delTimer加addTimer，超时时间随机），每个线程一个时间轮（多Reactor）
+//              和所有线程共用一个时间轮（单Reactor加线程池），以及定时器到期时handleExpired()的开销
+//     pool     多个线程向ThreadPool添加任务，-w个工作线程执行，比较互斥锁队列和无锁队列，从添加第一个到全部执行完
+//     log      多个线程调用AsyncLogging::append()写同样长度的日志行
+// 日志文件写在临时目录中，结束后删除
+//
+// 用法：micro_bench [-t 最多的线程数] [-n 每个线程的操作数] [-w 线程池的工作线程数] [parser] [timer] [pool] [log]
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "AsyncLogging.h"
+#include "HttpParser.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+namespace {
+
+// 抓取到的请求，覆盖服务器常见的几种情况
+const char *const REQUESTS[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n",
+
+    "GET /image/favicon.ico HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"116\", \"Not)A;Brand\";v=\"24\", \"Google Chrome\";v=\"116\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/116.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://127.0.0.1:8080/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1690000000; session=5f2b8c1e9a7d4e3f\r\n"
+    "\r\n",
+
+    "GET /hello HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/7.81.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "If-Modified-Since: Thu, 06 Jul 2023 13:05:57 GMT\r\n"
+    "If-None-Match: \"1a2b3c-5e6f-64a6bc45\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n",
+
+    "GET /video.mp4 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: video/webm,video/ogg,video/*;q=0.9,application/ogg;q=0.7,audio/*;q=0.6,*/*;q=0.5\r\n"
+    "Range: bytes=1048576-\r\n"
+    "If-Range: \"1a2b3c-5e6f-64a6bc45\"\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "POST /hello HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/7.81.0\r\n"
+    "Accept: */*\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 27\r\n"
+    "\r\n"
+    "name=huanggomery&lang=zh_CN",
+};
+const int REQUEST_NUM = sizeof(REQUESTS) / sizeof(REQUESTS[0]);
+
+const char LOG_LINE[] = "20230706 21:05:57.229383 12345 INFO Receive GET request successful, socket = 123 - /src/HttpTask.cpp:195\n";
+
+double now_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// 启动threads个线程运行body(线程序号)，所有线程就绪后由主线程记下开始时间再放行，返回从开始到全部结束的时间（秒）
+double run_threads(int threads, const std::function<void(int)> &body)
+{
+    struct Arg
+    {
+        const std::function<void(int)> *body;
+        int index;
+        std::atomic<int> *ready;
+        std::atomic<bool> *go;
+    };
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<Arg> args(threads);
+    std::vector<pthread_t> tids(threads);
+    for (int i = 0; i < threads; ++i)
+    {
+        args[i] = Arg{&body, i, &ready, &go};
+        pthread_create(&tids[i], NULL, [](void *p) -> void * {
+            Arg *arg = static_cast<Arg *>(p);
+            arg->ready->fetch_add(1);
+            while (!arg->go->load())
+                sched_yield();
+            (*arg->body)(arg->index);
+            return NULL;
+        }, &args[i]);
+    }
+    while (ready.load() < threads)
+        sched_yield();
+    // 先取开始时间再放行，否则主线程被调度回来之前跑完的部分不会计入
+    double start = now_sec();
+    go.store(true);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    return now_sec() - start;
+}
+
+void report(const char *name, const char *variant, int threads, double ops, double elapsed, const std::string &extra = std::string())
+{
+    printf("%-7s %-10s threads=%-3d %14.0f ops/s %10.1f ns/op%s\n", name, variant, threads, ops / elapsed,
+           elapsed * 1e9 * threads / ops, extra.c_str());
+    fflush(stdout);
+}
+
+/* ****************parser********************* */
+void bench_parser(int max_threads, long ops)
+{
+    std::size_t lens[REQUEST_NUM];
+    for (int i = 0; i < REQUEST_NUM; ++i)
+        lens[i] = strlen(REQUESTS[i]);
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        std::atomic<long> failed(0);
+        double elapsed = run_threads(threads, [&](int) {
+            HttpParser parser;
+            long bad = 0;
+            for (long i = 0; i < ops; ++i)
+            {
+                int k = i % REQUEST_NUM;
+                parser.reset();
+                if (parser.parse(REQUESTS[k], lens[k]) != HttpParser::PARSE_FINISH)
+                    ++bad;
+            }
+            failed += bad;
+        });
+        report("parser", "complete", threads, static_cast<double>(ops) * threads, elapsed,
+               failed ? "  (parse failures: " + std::to_string(failed.load()) + ")" : std::string());
+    }
+}
+
+/* ****************timer********************* */
+class BenchConn: public std::enable_shared_from_this<BenchConn>
+{
+public:
+    BenchConn(): timer_(this) {}
+    TimerNode<BenchConn> &timerNode() {return timer_;}
+    int getsock() const {return -1;}
+    sockaddr_in getaddr() const
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        return addr;
+    }
+private:
+    TimerNode<BenchConn> timer_;
+};
+
+class BenchOwner: public TimerOwner<BenchConn>
+{
+public:
+    BenchOwner(): closed(0) {}
+    void wakeup() override {}
+    void closeConnection(int) override {++closed;}
+    std::atomic<long> closed;
+};
+
+const int TIMER_CONNS = 10000;      // 每个线程的长连接数
+
+// 每次操作是一个请求对定时器做的事情：处理前delTimer()，处理后用随机的超时时间addTimer()
+void timer_churn(TimerManager<BenchConn> &tm, std::vector<shared_ptr<BenchConn>> &conns, long ops, unsigned seed)
+{
+    std::minstd_rand rng(seed);
+    for (long i = 0; i < ops; ++i)
+    {
+        BenchConn *conn = conns[rng() % conns.size()].get();
+        tm.delTimer(conn);
+        tm.addTimer(conn, 1000 + rng() % 15000);
+    }
+    for (auto &conn : conns)
+        tm.delTimer(conn.get());
+}
+
+std::vector<shared_ptr<BenchConn>> make_conns(int n)
+{
+    std::vector<shared_ptr<BenchConn>> conns;
+    for (int i = 0; i < n; ++i)
+        conns.push_back(std::make_shared<BenchConn>());
+    return conns;
+}
+
+void bench_timer(int max_threads, long ops)
+{
+    BenchOwner owner;
+    // 连接和时间轮在计时之前创建好
+    for (int shared = 0; shared <= 1; ++shared)
+    {
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            std::vector<shared_ptr<TimerManager<BenchConn>>> tms;
+            std::vector<std::vector<shared_ptr<BenchConn>>> conns;
+            for (int i = 0; i < threads; ++i)
+            {
+                if (i == 0 || !shared)
+                    tms.push_back(TimerManager<BenchConn>::CreateTimerManager(&owner));
+                conns.push_back(make_conns(TIMER_CONNS));
+            }
+            double elapsed = run_threads(threads, [&](int index) {
+                timer_churn(*tms[shared ? 0 : index], conns[index], ops, index + 1);
+            });
+            report("timer", shared ? "shared" : "per-loop", threads, static_cast<double>(ops) * threads, elapsed);
+        }
+    }
+
+    // 到期：一批定时器在几格之内到期，只计算handleExpired()的时间，包括每个到期连接的一条日志
+    auto tm = TimerManager<BenchConn>::CreateTimerManager(&owner);
+    auto conns = make_conns(static_cast<int>(std::min<long>(ops, 100000)));
+    std::minstd_rand rng(1);
+    for (auto &conn : conns)
+        tm->addTimer(conn.get(), rng() % (4 * TIMER_TICK_MS));
+    long before = owner.closed;
+    double spent = 0;
+    while (tm->size() > 0)
+    {
+        double start = now_sec();
+        tm->handleExpired();
+        spent += now_sec() - start;
+        usleep(TIMER_TICK_MS * 1000 / 5);
+    }
+    report("timer", "expire", 1, static_cast<double>(owner.closed - before), spent);
+}
+
+/* ****************pool********************* */
+class BenchTask
+{
+public:
+    explicit BenchTask(std::atomic<long> *done): done_(done), queued_at_(0) {}
+    void process() {done_->fetch_add(1, std::memory_order_relaxed);}
+    void markQueued(int64_t now) {queued_at_ = now;}
+    int64_t queuedAt() const {return queued_at_;}
+private:
+    std::atomic<long> *done_;
+    int64_t queued_at_;
+};
+
+void bench_pool(int max_threads, long ops, int workers)
+{
+    const int MAX_QUEUE = 10000;    // 和服务器默认的工作队列长度相同
+    for (int lockfree = 0; lockfree <= 1; ++lockfree)
+    {
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            auto pool = ThreadPool<BenchTask>::CreateThreadPool(workers, MAX_QUEUE, lockfree);
+            if (!pool)
+                return;
+            std::atomic<long> done(0);
+            std::atomic<long> full(0);
+            long total = ops * threads;
+            double elapsed = run_threads(threads, [&](int) {
+                // 同一个任务对象反复提交，和连接上的多个请求一样，只有引用计数的开销
+                auto task = std::make_shared<BenchTask>(&done);
+                long retries = 0;
+                for (long i = 0; i < ops; ++i)
+                {
+                    while (!pool->addTask(task))
+                    {
+                        ++retries;
+                        sched_yield();
+                    }
+                }
+                full += retries;
+                while (done.load() < total)
+                    sched_yield();
+            });
+            pool->shutdown();
+            pool.reset();
+            report("pool", lockfree ? "lockfree" : "mutex", threads, static_cast<double>(total), elapsed,
+                   "  queue full " + std::to_string(full.load()) + " times");
+        }
+    }
+}
+
+/* ****************log********************* */
+void bench_log(int max_threads, long ops)
+{
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        AsyncLogging::Options options;
+        options.roll_bytes = 0;
+        options.roll_interval = 0;
+        AsyncLogging logger("micro_bench.", 3, options);
+        logger.start();
+        double elapsed = run_threads(threads, [&](int) {
+            for (long i = 0; i < ops; ++i)
+                logger.append(LOG_LINE, sizeof(LOG_LINE) - 1, now_us());
+        });
+        logger.stop();
+        report("log", "append", threads, static_cast<double>(ops) * threads, elapsed,
+               "  dropped " + std::to_string(logger.dropped()));
+        unlink(logger.filename().c_str());
+    }
+}
+
+void remove_dir(const char *dir)
+{
+    if (DIR *d = opendir(dir))
+    {
+        while (dirent *entry = readdir(d))
+        {
+            if (entry->d_name[0] != '.')
+                unlink((std::string(dir) + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int max_threads = 8;
+    long ops = 1000000;
+    int workers = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            ops = atol(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t max_threads] [-n ops_per_thread] [-w pool_workers] [parser] [timer] [pool] [log]\n", argv[0]);
+            return 1;
+        }
+    }
+    auto selected = [&](const char *name) {
+        if (optind >= argc)
+            return true;
+        for (int i = optind; i < argc; ++i)
+        {
+            if (strcmp(argv[i], name) == 0)
+                return true;
+        }
+        return false;
+    };
+
+    // 到期的定时器会写日志，日志文件放在临时目录中
+    char dir[] = "/tmp/micro_bench.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (selected("parser"))
+        bench_parser(max_threads, ops);
+    if (selected("timer"))
+        bench_timer(max_threads, ops);
+    if (selected("pool"))
+        bench_pool(max_threads, ops, workers);
+    if (selected("log"))
+        bench_log(max_threads, ops);
+    // Logger的后端在进程退出时才关闭，它打开的文件删除后仍然可以写
+    remove_dir(dir);
+    return 0;
+}
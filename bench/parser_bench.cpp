@@ -0,0 +1,218 @@
+// HTTP请求解析器的微基准测试：单线程反复解析同一个请求，比较逐字节解析器和原来基于substr的解析方式
+// 每种方式分别测试一次收到完整请求，以及请求被切成小段、每收到一段就解析一次的情况
+//
+// 用法：parser_bench [-n 每项的请求数] [-f 分段大小]
+#include <getopt.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include "HttpParser.h"
+
+namespace {
+
+const char REQUEST[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+double now_sec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 原来HttpTask中的解析方式：每次从缓存开头查找，用substr取出每一行，首部存入unordered_map
+class LegacyParser
+{
+public:
+    void reset() {inBuf_.clear(); headers_.clear(); state_ = 0;}
+    void append(const char *data, std::size_t len) {inBuf_.append(data, len);}
+    // 返回0表示完成，-1表示数据不完整，-2表示错误
+    int parse()
+    {
+        if (state_ == 0)
+        {
+            int ret = parseRequestLine();
+            if (ret != 0)
+                return ret;
+            state_ = 1;
+        }
+        return parseHeaders();
+    }
+    bool keepAlive() {return headers_["Connection"] == "keep-alive";}
+
+private:
+    int parseRequestLine()
+    {
+        std::size_t end_pos = inBuf_.find("\r\n");
+        if (end_pos == std::string::npos)
+            return -1;
+        std::string request = inBuf_.substr(0, end_pos);
+        if (inBuf_.size() > end_pos+2)
+            inBuf_ = inBuf_.substr(end_pos+2);
+        else
+            inBuf_.clear();
+        if (request.find("GET") == 0 && request[3] == ' ')
+            request = request.substr(4);
+        else if (request.find("POST") == 0 && request[4] == ' ')
+            request = request.substr(5);
+        else
+            return -2;
+        if (request[0] != '/')
+            return -2;
+        std::size_t pos = request.find(" ");
+        if (pos == std::string::npos)
+            return -2;
+        if (pos - 1 > 0)
+            file_name_ = request.substr(1, pos-1);
+        else
+            file_name_ = "index.html";
+        request = request.substr(pos+1);
+        if (request.find("HTTP/1.0") == std::string::npos && request.find("HTTP/1.1") == std::string::npos)
+            return -2;
+        return 0;
+    }
+
+    int parseHeaders()
+    {
+        std::size_t end_pos;
+        while ((end_pos = inBuf_.find("\r\n")) != 0)
+        {
+            if (end_pos == std::string::npos)
+                return -1;
+            std::size_t pos = inBuf_.find(":");
+            if (pos == std::string::npos || pos == 0)
+                return -2;
+            std::string key = inBuf_.substr(0,pos);
+            if (inBuf_[++pos] != ' ')
+                return -2;
+            if (inBuf_[++pos] == ' ')
+                return -2;
+            std::string value = inBuf_.substr(pos,end_pos-pos);
+            headers_[key] = value;
+            if (inBuf_.size() > end_pos+2)
+                inBuf_ = inBuf_.substr(end_pos+2);
+            else
+                inBuf_.clear();
+        }
+        if (inBuf_.size() > 2)
+            inBuf_ = inBuf_.substr(2);
+        else
+            inBuf_.clear();
+        return 0;
+    }
+
+    std::string inBuf_;
+    std::string file_name_;
+    std::unordered_map<std::string, std::string> headers_;
+    int state_ = 0;
+};
+
+// 每次收到frag个字节后解析一次，frag为0表示一次收到整个请求
+double bench_legacy(long n, std::size_t frag)
+{
+    const std::size_t len = sizeof(REQUEST) - 1;
+    LegacyParser parser;
+    long ok = 0;
+    double start = now_sec();
+    for (long i = 0; i < n; ++i)
+    {
+        parser.reset();
+        std::size_t step = frag ? frag : len;
+        int ret = -1;
+        for (std::size_t got = 0; got < len && ret == -1; )
+        {
+            std::size_t chunk = std::min(step, len - got);
+            parser.append(REQUEST + got, chunk);
+            got += chunk;
+            ret = parser.parse();
+        }
+        if (ret == 0 && parser.keepAlive())
+            ++ok;
+    }
+    double elapsed = now_sec() - start;
+    if (ok != n)
+        fprintf(stderr, "legacy parser failed %ld times\n", n - ok);
+    return n / elapsed;
+}
+
+double bench_incremental(long n, std::size_t frag)
+{
+    const std::size_t len = sizeof(REQUEST) - 1;
+    HttpParser parser;
+    long ok = 0;
+    double start = now_sec();
+    for (long i = 0; i < n; ++i)
+    {
+        parser.reset();
+        std::size_t step = frag ? frag : len;
+        int ret = HttpParser::PARSE_AGAIN;
+        for (std::size_t got = 0; got < len && ret == HttpParser::PARSE_AGAIN; )
+        {
+            got += std::min(step, len - got);
+            ret = parser.parse(REQUEST, got);
+        }
+        if (ret == HttpParser::PARSE_FINISH && parser.connection() == HttpParser::CONNECTION_KEEP_ALIVE &&
+            !parser.uri(REQUEST).empty())
+            ++ok;
+    }
+    double elapsed = now_sec() - start;
+    if (ok != n)
+        fprintf(stderr, "incremental parser failed %ld times\n", n - ok);
+    return n / elapsed;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    long n = 1000000;
+    std::size_t frag = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'f':
+            frag = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n requests] [-f fragment_bytes]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n <= 0 || frag == 0)
+    {
+        fprintf(stderr, "requests and fragment size must be positive\n");
+        return 1;
+    }
+
+    printf("request: %zu bytes, %ld requests per case, single thread\n", sizeof(REQUEST) - 1, n);
+    printf("%-14s %-16s %14s\n", "parser", "input", "requests/sec");
+    double legacy_whole = bench_legacy(n, 0);
+    double inc_whole = bench_incremental(n, 0);
+    double legacy_frag = bench_legacy(n, frag);
+    double inc_frag = bench_incremental(n, frag);
+    char frag_desc[48];
+    snprintf(frag_desc, sizeof(frag_desc), "%zu-byte pieces", frag);
+    printf("%-14s %-16s %14.0f\n", "legacy", "whole", legacy_whole);
+    printf("%-14s %-16s %14.0f\n", "incremental", "whole", inc_whole);
+    printf("%-14s %-16s %14.0f\n", "legacy", frag_desc, legacy_frag);
+    printf("%-14s %-16s %14.0f\n", "incremental", frag_desc, inc_frag);
+    printf("speedup: %.2fx whole, %.2fx fragmented\n", inc_whole / legacy_whole, inc_frag / legacy_frag);
+    return 0;
+}
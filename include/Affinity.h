@@ -0,0 +1,45 @@
+// CPU亲和性和NUMA节点：把事件循环、工作线程和日志线程绑定到指定的CPU，内存优先从CPU所在的节点分配
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "noncopyable.h"
+
+/*
+    拓扑从/sys/devices/system读取，只考虑本进程允许使用的CPU（sched_getaffinity，受cpuset限制）
+    CPU列表有两种写法：
+        1. "0-3,8,10-11"：按给出的顺序使用这些CPU
+        2. "cores"：每个物理核心取一个逻辑CPU（不使用超线程的兄弟），按节点排列，线程少时先占满一个节点
+    绑定的线程同时把内存策略设为优先使用CPU所在的节点（MPOL_PREFERRED），
+    线程自己分配的内存（内存池、连接的缓冲区、glibc的线程arena）都在本地节点，节点内存不够时仍然可以用其他节点
+    只有一个节点时不设置内存策略
+*/
+class Affinity: public noncopyable
+{
+public:
+    struct NumaStats
+    {
+        uint64_t local_node = 0;    // 运行在本节点的进程从本节点分配的页
+        uint64_t other_node = 0;    // 运行在其他节点的进程从本节点分配的页，即跨节点分配
+        uint64_t miss = 0;          // 想从本节点分配但分配到了其他节点
+    };
+
+    // 把CPU列表解析成CPU编号，格式错误、为空或者包含不允许使用的CPU时返回false
+    static bool ParseCpuList(const std::string &spec, std::vector<int> &cpus);
+    static std::vector<int> allowedCpus();
+    static std::vector<int> physicalCores();   // 每个物理核心一个CPU，按节点排列
+    static int nodeOf(int cpu);                // 不知道时返回0
+    static int nodeCount();
+
+    // 把调用线程绑定到cpu并设置内存策略，cpu < 0时什么都不做
+    static bool pinCurrentThread(int cpu);
+    // 和pthread_create一样，cpu >= 0时新线程在运行fn之前先绑定，栈也由它自己第一次写入，分配在本地节点
+    static int createThread(pthread_t *tid, int cpu, void *(*fn)(void *), void *arg);
+
+    // 所有节点的/sys/devices/system/node/node*/numastat之和（全系统的计数，单位是页）
+    static NumaStats numaStats();
+};
+
+#endif
@@ -4,40 +4,115 @@
 #define _ASYNCLOGGING_H
 #include <cstddef>
 #include <cstring>
+#include <stdint.h>
 #include <stdio.h>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <time.h>
 #include <vector>
 #include <pthread.h>
 #include "Sync.h"
 #include "noncopyable.h"
 #include "LogStream.h"
 
+struct LogOptions
+{
+    bool binary = false;
+    std::size_t roll_bytes = 1024 << 20;    // 为0时不按大小滚动
+    int roll_interval = 86400;              // 秒，为0时不按时间滚动
+    bool gzip = false;                      // 需要zlib，文件可以直接用zcat查看
+    bool lossless = false;                  // 环满时阻塞写日志的线程，不丢弃
+    int cpu = -1;                           // 后端线程绑定的CPU，为-1时不绑定
+};
+
+/*
+    前端：每个线程第一次写日志时登记一个自己的环形缓冲区（单生产者单消费者），之后写日志只操作自己的环，不加锁
+        环超过一半时唤醒后端（每轮只有第一个线程加锁通知），环满时让出CPU等后端几次，还是满的就丢弃这一条并计数
+        无损模式下环满时一直等到后端腾出空间，写日志的线程会被阻塞
+    后端：被唤醒或者每flushInterval秒，取出所有环中已经写完的记录，按时间戳合并后写入文件
+        同一个线程的记录本来就是有序的，多个线程之间在同一批内按时间排序
+        合并后的记录先放在4MB的块中（开启压缩时每块压缩成一个gzip成员），每轮用writev一次写出所有的块
+        文件超过roll_bytes或者打开超过roll_interval秒后换一个新文件
+    二进制模式下每条记录前加上帧首部（长度和时间戳），文件格式见BinaryLog.h
+*/
 class AsyncLogging: public noncopyable
 {
     using Buffer = FixedBuffer<LargeBufferSize>;
     using BufferPtr = std::unique_ptr<Buffer>;
-    using BufferVector = std::vector<BufferPtr>;
 public:
-    AsyncLogging(const std::string &filename, int flushIntervel = 3);
+    static const std::size_t RING_SIZE = 1 << 22;   // 每个线程的环形缓冲区大小，必须是2的幂
+
+    using Options = LogOptions;
+    // 解析"roll=MB,interval=秒,gzip,lossless,cpu=N"，格式错误、没有zlib时使用gzip或者CPU不允许使用时返回false
+    static bool ParseOptions(const std::string &spec, Options &options);
+
+    // 文件名是basename加上打开时的时间，例如WebServer20230706210557.log，同一秒内滚动时加上序号
+    AsyncLogging(const std::string &basename, int flushIntervel = 3, const Options &options = Options());
     ~AsyncLogging();
-    void append(const char *logline, int len);   // 前端函数
+    // 前端函数，timestamp是日志记录中的时间（微秒），后端按它合并各个线程的记录
+    void append(const char *logline, int len, int64_t timestamp);
+    // 除了和append()一样写入，还会写在之后每个滚动文件的开头，用于二进制日志调用点的定义
+    void appendHeader(const char *record, int len, int64_t timestamp);
     void start();
     void stop();
     void threadFunc();  // 后端线程的函数
+    unsigned long dropped() const {return dropped_total_;}   // 累计因为环满丢弃的记录数
+    unsigned long stalls() const {return stalls_;}           // 无损模式下因为环满等待的次数
+    unsigned long rolls() const {return rolls_;}             // 滚动的次数
+    std::string filename();                                  // 当前写入的文件
 
 private:
+    class ThreadRing;
+    using RingPtr = std::shared_ptr<ThreadRing>;
+    struct Cursor;
+    class Compressor;
+    struct Header
+    {
+        int64_t timestamp;
+        std::string record;
+    };
+
+    ThreadRing *threadRing();     // 本线程的环，第一次调用时登记
+    void wakeup();
+    std::size_t drainRings(std::vector<RingPtr> &rings);   // 合并写出所有环中的记录，返回写出的记录数
+    void output(const char *data, std::size_t len);
+    void outputRecord(const char *data, std::size_t len, int64_t timestamp);
+    void sealBuffer();            // 当前块写满或者一轮结束，放入待写的队列
+    void writeBlocks();           // 用writev写出所有待写的块
+    void openFile();              // 打开新文件并写入文件头
+    void rollIfNeeded();
+
     static std::vector<std::string> fileOpened_;  // 记录目前已经打开的文件
+    static std::atomic<uint64_t> nextId_;
 
-    FILE *file_;
-    const std::string filename_;
+    int fd_;
+    const std::string basename_;
+    std::string filename_;
     const int flushInterval_;
-    bool running_;
+    const Options options_;
+    const uint64_t id_;           // 线程用它找到自己在这个日志对象中的环
+    std::atomic<bool> running_;
     pthread_t tid_;
-    Locker locker_;
+    Locker locker_;               // 保护rings_、headers_、filename_和条件变量，前端只在登记、唤醒和写调用点定义时使用
     Conditon cond_;
-    BufferPtr currentBuffer_;
-    BufferPtr nextBuffer_;
-    BufferVector buffer_;
+    std::vector<RingPtr> rings_;
+    std::vector<Header> headers_;
+    std::atomic<bool> wakeup_pending_;
+    std::atomic<unsigned long> dropped_total_;
+    std::atomic<unsigned long> stalls_;
+    std::atomic<unsigned long> rolls_;
+
+    // 以下只由后端使用
+    BufferPtr outputBuffer_;      // 正在填写的块
+    std::vector<BufferPtr> full_;     // 不压缩时待写的块
+    std::vector<BufferPtr> spare_;    // 写完可以重用的块
+    std::vector<std::string> compressed_;   // 压缩时待写的块
+    std::unique_ptr<Compressor> compressor_;   // 不压缩时为空
+    std::size_t fileBytes_;       // 当前文件已经写入的字节数
+    time_t openTime_;
+    unsigned fileSeq_;            // 同一秒内打开的第几个文件
+    time_t lastOpenSecond_;
 };
 
-#endif
\ No newline at end of file
+#endif
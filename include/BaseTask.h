@@ -3,11 +3,13 @@
 #define _BASETASK_H
 #include <unistd.h>
 #include <memory>
+#include <atomic>
 #include "Epoll.h"
 #include "Timer.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "noncopyable.h"
+#include "Metrics.h"
 using std::shared_ptr;
 // #define TaskType std::remove_reference<decltype(*this)>::type;
 
@@ -15,11 +17,21 @@ using std::shared_ptr;
     任务类编写说明：
     首先一定要继承基类BaseTask
 
-    一个任务类对象的智能指针存在于定时器和Epoll的fd2task中。
+    一个任务类对象的智能指针只存在于Epoll的fd2task中（处理时工作线程中还有一个），
+    定时器只持有嵌入在任务中的节点和节点中的weak_ptr，不拥有任务。
+    任务对象由接受它的Epoll创建，创建后立即调用Init()告诉它所属的Epoll和TimerManager，
+    多Reactor模式下一个连接始终由同一个Epoll处理
     Epoll处理时不会改动定时器和fd2task中的任务指针
         任务类需要自己管理定时器和epoll监测事件
-        所以如果任务处理时希望更新该任务的定时器，需要与定时器双向解耦，然后重新添加
-        如果希望与客户端断开连接，需要和定时器双向解耦并手动调用epoll_del，对象才能被析构
+        定时器节点嵌入在任务对象中，任务处理时先调用timer_manager_->delTimer(this)，
+        处理完后用timer_manager_->addTimer(this, timeout)重新设置，不需要分配内存
+        如果希望与客户端断开连接，需要删除定时器并手动调用epoll_del，对象才能被析构
+        析构函数中必须调用delTimer(this)
+
+    使用io_uring后端（Uring）时任务工作在完成模式，process()不会被调用：
+        Uring负责接收、发送和定时器，把收到的数据交给任务的onReceive()，
+        再通过prepareSend()/prepareSendFile()取得待发送的数据，发送完成后调用onSent()/onFileSent()，
+        hasOutput()、shouldClose()、idleTimeout()告诉Uring接下来要做什么，Init()的SP_Epoll参数为空
 
     任务类中应该包含的变量和函数参照BaseTask类中的说明
 */
@@ -30,34 +42,45 @@ class BaseTask
     /*
         应该包含如下类型名声明：
         using SP_TimerManager = shared_ptr<TimerManager<TaskType>>;
-        using SP_Timer = shared_ptr<TimerNode<TaskType>>;
         using SP_Epoll = shared_ptr<Epoll<TaskType>>;
     */
 public:
     BaseTask() = delete;
-    BaseTask(int sock, sockaddr_in addr): sock_(sock), addr_(addr){}
-    ~BaseTask() {close(sock_);}
+    BaseTask(int sock, sockaddr_in addr): sock_(sock), addr_(addr), queued_at_(0) {Metrics::connectionOpened();}
+    ~BaseTask() {close(sock_); Metrics::connectionClosed();}
     virtual void process() = 0;
     int getsock() const {return sock_;}
     sockaddr_in getaddr() const {return addr_;}
+    // 线程池记录任务进入工作队列的时间，工作线程取出时统计排队时间
+    void markQueued(int64_t now) {queued_at_ = now;}
+    int64_t queuedAt() const {return queued_at_;}
+    // 平滑升级时旧进程进入排空状态，任务处理完当前的请求后关闭连接，不再保持连接
+    static void setDraining() {drainingFlag().store(true, std::memory_order_relaxed);}
+    static bool draining() {return drainingFlag().load(std::memory_order_relaxed);}
     /*
         在其派生类中应该定义以下成员函数：
         TaskType(int sock, sockaddr_in addr);   构造函数
-        void linkTimer(SP_Timer timer);
-        void separateTimer();   // 与定时器单向解耦，即定时器删除时会连带删除任务，任务类中通常不调用这个函数
-        void bilateralSeparateTimer(); // 与定时器双向解耦，即定时器删除时不会删除任务
-        static void Init(SP_TimerManager, SP_Epoll);
+        TimerNode<TaskType> &timerNode();   // 返回嵌入的定时器节点，由TimerManager使用
+        void Init(SP_TimerManager, SP_Epoll);   // 绑定所属的Epoll和定时器管理者
         void process() override;  业务函数，必须重新的纯虚函数
     */
 
+private:
+    static std::atomic<bool> &drainingFlag()
+    {
+        static std::atomic<bool> flag(false);
+        return flag;
+    }
+
 protected:
     int sock_;
     sockaddr_in addr_;
+    int64_t queued_at_;
     /*
         在其派生类中应该定义以下成员：
-        SP_Timer timer_;
-        static SP_TimerManager timer_manager_;  // 业务处理时需要添加计时器
-        static SP_Epoll epoll_;   // 业务处理时需要修改监听的类别
+        TimerNode<TaskType> timer_;      // 在构造函数中用this初始化
+        SP_TimerManager timer_manager_;  // 业务处理时需要添加计时器
+        SP_Epoll epoll_;   // 业务处理时需要修改监听的类别
     */
 };
 
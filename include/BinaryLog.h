@@ -0,0 +1,46 @@
+// 二进制日志的文件格式，日志前端、后端和离线解码工具log_decode共用
+#ifndef _BINARYLOG_H
+#define _BINARYLOG_H
+#include <stdint.h>
+
+/*
+    文件开头是8字节的BINLOG_MAGIC，之后是一帧一帧的记录：
+        帧首部BinLogFrame（负载长度、时间戳），然后是负载，负载的第一个字节是记录类型
+    RECORD_SITE  调用点的定义：uint32编号、uint32行号、uint8级别，剩下的是文件名
+    RECORD_LINE  一条日志：uint32调用点编号、uint32线程号，剩下的是参数，每个参数是一字节类型加原始字节
+    RECORD_TEXT  后端自己写的文本，例如丢弃了多少条日志
+    调用点的定义在它第一次使用时写入，但多个线程的记录按时间戳合并，定义不一定在使用之前，所以解码时先读一遍定义
+    数值按本机字节序保存，要在同一种机器上解码
+*/
+const char BINLOG_MAGIC[8] = {'H', 'G', 'B', 'L', 'O', 'G', '1', '\n'};
+
+struct BinLogFrame
+{
+    uint32_t len;
+    uint32_t unused;
+    int64_t timestamp;      // 微秒
+};
+
+enum BinLogRecord
+{
+    RECORD_SITE = 1,
+    RECORD_LINE,
+    RECORD_TEXT,
+};
+
+enum BinLogArg
+{
+    ARG_BOOL = 1,
+    ARG_CHAR,
+    ARG_INT32,
+    ARG_UINT32,
+    ARG_INT64,
+    ARG_UINT64,
+    ARG_DOUBLE,
+    ARG_STRING,     // uint16长度加内容
+};
+
+const int BINLOG_SITE_HEAD = 1 + 4 + 4 + 1;   // RECORD_SITE在文件名之前的字节数
+const int BINLOG_LINE_HEAD = 1 + 4 + 4;       // RECORD_LINE在参数之前的字节数
+
+#endif
@@ -0,0 +1,68 @@
+// 连接的输入输出缓冲区
+#ifndef _BUFFER_H
+#define _BUFFER_H
+#include <sys/types.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+    连续内存的缓冲区，用读写下标代替拷贝：
+        +-------------------+------------------+------------------+
+        |   已经读取的字节   |   可读的数据      |    可写的空间     |
+        +-------------------+------------------+------------------+
+        0            readerIndex_       writerIndex_          size()
+    取出数据只移动readerIndex_，读空时两个下标都回到开头
+    空间不够时先把可读的数据挪到开头，还不够再扩容（至少翻倍）
+    刚创建时不分配内存，空闲时容量超过MAX_IDLE_SIZE就释放，空闲连接不占用缓冲区
+*/
+class Buffer
+{
+public:
+    static const std::size_t INITIAL_SIZE = 1024;
+    static const std::size_t MAX_IDLE_SIZE = 64 * 1024;
+
+    Buffer(): buffer_(), readerIndex_(0), writerIndex_(0) {}
+
+    std::size_t readableBytes() const {return writerIndex_ - readerIndex_;}
+    std::size_t writableBytes() const {return buffer_.size() - writerIndex_;}
+    std::size_t capacity() const {return buffer_.capacity();}
+
+    const char *peek() const {return begin() + readerIndex_;}
+    char *beginRead() {return begin() + readerIndex_;}
+    const char *beginWrite() const {return begin() + writerIndex_;}
+    char *beginWrite() {return begin() + writerIndex_;}
+    void hasWritten(std::size_t len) {writerIndex_ += len;}
+
+    // 在可读数据中查找"\r\n"，找不到返回nullptr
+    const char *findCRLF() const {return findCRLF(peek());}
+    const char *findCRLF(const char *start) const;
+
+    void retrieve(std::size_t len);
+    void retrieveUntil(const char *end) {retrieve(end - peek());}
+    void retrieveAll() {readerIndex_ = writerIndex_ = 0;}
+    std::string retrieveAsString(std::size_t len);
+
+    void append(const char *data, std::size_t len);
+    void append(const std::string &str) {append(str.data(), str.size());}
+    void ensureWritableBytes(std::size_t len);
+
+    // 没有可读数据且容量超过MAX_IDLE_SIZE时释放内存
+    void shrinkIfIdle();
+
+    // 用readv读取套接字，先填满可写空间，剩下的读到栈上再追加，一次系统调用就能读完
+    ssize_t readFd(int fd, int *savedErrno);
+    // 发送可读的数据，并取出已发送的部分
+    ssize_t writeFd(int fd, int *savedErrno);
+
+private:
+    char *begin() {return buffer_.empty() ? nullptr : &*buffer_.begin();}
+    const char *begin() const {return buffer_.empty() ? nullptr : &*buffer_.begin();}
+    void makeSpace(std::size_t len);
+
+    std::vector<char> buffer_;
+    std::size_t readerIndex_;
+    std::size_t writerIndex_;
+};
+
+#endif
@@ -0,0 +1,36 @@
+// 服务器的可配置参数
+#ifndef _CONFIG_H
+#define _CONFIG_H
+#include <cstddef>
+#include <string>
+
+struct ServerConfig
+{
+    int port = 80;              // 端口号
+    int timeout = 500;          // 新连接的初始超时时间（毫秒）
+    int thread_num = 4;         // 线程池的线程数，单Reactor模式下使用
+    int max_queue = 10000;      // 工作队列最大长度
+    bool lockfree_queue = false;   // 线程池使用无锁环形队列代替互斥锁保护的std::list
+    int reactor_num = 0;        // 从Reactor的数量，为0时使用单Reactor+线程池模式
+    bool reuseport = false;     // 多Reactor模式下，每个从Reactor用SO_REUSEPORT各自监听端口
+    bool cpu_steering = false;  // reuseport时挂载CBPF程序，连接交给处理SYN的CPU对应的Reactor
+    int max_conn = 0;           // 文件描述符上限（即最大连接数），为0时使用RLIMIT_NOFILE的硬限制
+    int epoll_batch = 1024;     // epoll_wait一次最多返回的事件数
+    bool io_uring = false;      // 使用io_uring的完成模式代替epoll，内核不支持时自动退回epoll
+    std::size_t cache_bytes = 64 << 20;       // 静态文件缓存的总大小，为0时不缓存
+    std::size_t cache_file_max = 1 << 20;     // 超过这个大小的文件不缓存，用sendfile发送，也不压缩
+    std::size_t encoding_cache_bytes = 16 << 20;   // 压缩版本缓存的总大小，为0时不压缩
+    bool binary_log = false;    // 二进制日志（.blog），只记录调用点编号和参数的原始字节，用log_decode转换成文本
+    // 日志文件按大小（MB）和时间（秒）滚动，可以加上gzip（压缩）和lossless（环满时阻塞而不是丢弃），见AsyncLogging::ParseOptions()
+    std::string log_options = "roll=1024,interval=86400";
+    bool stats = true;          // 在GET /__stats输出Prometheus文本格式的统计信息，关闭时也不再读时钟统计延迟
+    // 按MIME类型前缀的Cache-Control max-age（秒），0表示no-cache，每次都用ETag重新验证，见HttpHeaders::InitCachePolicy()
+    std::string cache_control = "text/html=0,text/css=3600,application/javascript=3600,image/=86400";
+    // 平滑升级用的Unix套接字路径，为空时不支持。启动时有旧进程在监听这个路径就从它接管监听套接字，见WebServer.h
+    std::string upgrade_path;
+    int drain_timeout = 30;
+    // 事件循环和工作线程绑定的CPU，"0-3,8"或者"cores"（每个物理核心一个），为空时不绑定，见WebServer.h
+    std::string cpu_affinity;
+};
+
+#endif
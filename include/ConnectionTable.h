@@ -0,0 +1,109 @@
+// 文件描述符到任务的映射表，所有Reactor共用
+#ifndef _CONNECTIONTABLE_H
+#define _CONNECTIONTABLE_H
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include "noncopyable.h"
+using std::shared_ptr;
+
+/*
+    按文件描述符分页，每页PAGE_SIZE个槽位，第一次用到某一页时才分配
+    内核总是分配最小的可用文件描述符，所以已分配的页数和同时存在的连接数成正比
+    文件描述符在整个进程内唯一，所以多个Reactor可以共用一张表，每个槽位只由拥有该连接的Reactor访问
+    页的分配用CAS完成，不需要加锁
+*/
+template <typename T>
+class ConnectionTable: public noncopyable
+{
+    using SP_Task = shared_ptr<T>;
+public:
+    explicit ConnectionTable(int capacity);
+    ~ConnectionTable();
+    int capacity() const {return capacity_;}
+    bool set(int fd, SP_Task task);    // fd超出容量或内存不足时返回false
+    void reset(int fd);
+    SP_Task get(int fd) const;
+    std::size_t pages() const {return pages_allocated_;}         // 已分配的页数
+    std::size_t memoryUsage() const {return pages_allocated_ * PAGE_SIZE * sizeof(SP_Task);}
+
+private:
+    static const int PAGE_BITS = 12;
+    static const int PAGE_SIZE = 1 << PAGE_BITS;
+    int capacity_;
+    int page_num_;
+    std::atomic<SP_Task *> *pages_;
+    std::atomic<std::size_t> pages_allocated_;
+    SP_Task *getPage(int fd, bool create);
+};
+
+template <typename T>
+ConnectionTable<T>::ConnectionTable(int capacity):
+    capacity_(capacity), page_num_((capacity + PAGE_SIZE - 1) / PAGE_SIZE),
+    pages_(new std::atomic<SP_Task *>[page_num_]), pages_allocated_(0)
+{
+    for (int i = 0; i < page_num_; ++i)
+        pages_[i].store(nullptr);
+}
+
+template <typename T>
+ConnectionTable<T>::~ConnectionTable()
+{
+    for (int i = 0; i < page_num_; ++i)
+        delete [] pages_[i].load();
+    delete [] pages_;
+}
+
+template <typename T>
+shared_ptr<T> *ConnectionTable<T>::getPage(int fd, bool create)
+{
+    if (fd < 0 || fd >= capacity_)
+        return nullptr;
+    std::atomic<SP_Task *> &slot = pages_[fd >> PAGE_BITS];
+    SP_Task *page = slot.load(std::memory_order_acquire);
+    if (page || !create)
+        return page;
+
+    SP_Task *new_page = new (std::nothrow) SP_Task[PAGE_SIZE];
+    if (!new_page)
+        return nullptr;
+    // 其他Reactor可能同时分配了这一页，失败的一方释放自己的页
+    if (slot.compare_exchange_strong(page, new_page, std::memory_order_acq_rel))
+    {
+        ++pages_allocated_;
+        return new_page;
+    }
+    delete [] new_page;
+    return page;
+}
+
+template <typename T>
+bool ConnectionTable<T>::set(int fd, SP_Task task)
+{
+    SP_Task *page = getPage(fd, true);
+    if (!page)
+        return false;
+    page[fd & (PAGE_SIZE - 1)] = task;
+    return true;
+}
+
+template <typename T>
+void ConnectionTable<T>::reset(int fd)
+{
+    SP_Task *page = getPage(fd, false);
+    if (page)
+        page[fd & (PAGE_SIZE - 1)].reset();
+}
+
+template <typename T>
+shared_ptr<T> ConnectionTable<T>::get(int fd) const
+{
+    if (fd < 0 || fd >= capacity_)
+        return nullptr;
+    SP_Task *page = pages_[fd >> PAGE_BITS].load(std::memory_order_acquire);
+    if (!page)
+        return nullptr;
+    return page[fd & (PAGE_SIZE - 1)];
+}
+
+#endif
@@ -0,0 +1,115 @@
+// 静态文件的压缩版本缓存，以及Accept-Encoding协商
+#ifndef _ENCODINGCACHE_H
+#define _ENCODINGCACHE_H
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "FileCache.h"
+#include "HttpParser.h"
+#include "Sync.h"
+#include "noncopyable.h"
+using std::shared_ptr;
+using std::string;
+
+/*
+    按服务器的偏好顺序br > zstd > gzip选择客户端接受的编码，每种编码的内容按下面的顺序获得：
+        1. 旁边预先压缩好的文件（index.html.br、index.html.zst、index.html.gz），不能比原文件旧
+        2. 可压缩的MIME类型（文本、脚本、JSON、XML、SVG）在第一次请求时压缩，编译时需要zlib或brotli
+    结果按（原文件的身份，编码）缓存，原文件被修改或替换后身份改变，旧的结果按LRU自然淘汰，不需要通知
+    没有合适内容的组合也会缓存下来，之后的请求不再重复查找或压缩
+    压缩在请求的线程中同步进行，所以用中等的压缩级别（gzip 6，brotli 5），更高的压缩率交给预压缩文件；
+    同一项只由第一个未命中的线程生成，生成期间其他请求直接发送未编码的内容，不重复压缩
+*/
+class EncodingCache: public noncopyable
+{
+    using SP_CachedFile = shared_ptr<const CachedFile>;
+public:
+    enum Encoding {ENCODING_BR = 0, ENCODING_ZSTD, ENCODING_GZIP, ENCODING_NUM};
+
+    struct Stats
+    {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long compressed;     // 压缩过的文件数
+        unsigned long sidecars;       // 使用的预压缩文件数
+        std::size_t entries;
+        std::size_t bytes;
+    };
+
+    // 在服务器启动前调用一次，capacity为0时不启用，超过max_file_size的文件不压缩
+    static bool Init(std::size_t capacity, std::size_t max_file_size);
+    // 未启用时返回nullptr
+    static EncodingCache *instance() {return instance_;}
+
+    // 解析Accept-Encoding，返回客户端接受的编码的位掩码（第i位对应Encoding i）
+    static unsigned acceptedEncodings(const StringPiece &accept_encoding);
+
+    // 从accepted中选出服务器能提供的最优编码，返回编码后的内容，没有时返回nullptr
+    // original是缓存中的原文件，为nullptr时从fd读取原文件
+    SP_CachedFile select(unsigned accepted, const string &path, const FileId &id, const string &content_type,
+                         const string &last_modified, const SP_CachedFile &original, int fd);
+    Stats stats();
+
+private:
+    static const int SHARD_NUM = 16;
+    static const std::size_t NEGATIVE_ENTRY_BYTES = 64;   // 没有内容的缓存项按这个大小计算
+
+    struct Key
+    {
+        FileId id;
+        int encoding;
+        bool operator==(const Key &rhs) const {return id == rhs.id && encoding == rhs.encoding;}
+    };
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const
+        {
+            std::size_t h = std::hash<unsigned long>()(key.id.ino);
+            h = h * 31 + std::hash<unsigned long>()(key.id.dev);
+            h = h * 31 + std::hash<long>()(key.id.mtime_nsec);
+            return h * 31 + key.encoding;
+        }
+    };
+    struct Entry
+    {
+        Key key;
+        SP_CachedFile file;     // 为nullptr表示这种编码没有合适的内容
+    };
+    struct Shard
+    {
+        using LruList = std::list<Entry>;
+        Locker locker_;
+        LruList lru_;      // 表头是最近使用的
+        std::unordered_map<Key, LruList::iterator, KeyHash> index_;
+        std::unordered_set<Key, KeyHash> building_;    // 正在生成的项
+        std::size_t bytes_ = 0;
+    };
+    enum LookupResult {LOOKUP_HIT, LOOKUP_BUILD, LOOKUP_BUSY};
+
+    EncodingCache(std::size_t capacity, std::size_t max_file_size);
+    Shard &shardOf(const Key &key);
+    // 未命中时由调用者生成（LOOKUP_BUILD），之后必须调用insert()；其他线程正在生成时返回LOOKUP_BUSY
+    LookupResult lookup(const Key &key, SP_CachedFile &file);
+    void insert(const Key &key, const SP_CachedFile &file);
+    SP_CachedFile build(int encoding, const string &path, const FileId &id, const string &content_type,
+                        const string &last_modified, const SP_CachedFile &original, int fd);
+    bool readSidecar(int encoding, const string &path, const FileId &id, string &body);
+
+    static EncodingCache *instance_;
+
+    const std::size_t shard_capacity_;
+    const std::size_t max_file_size_;
+    Shard shards_[SHARD_NUM];
+
+    std::atomic<unsigned long> hits_;
+    std::atomic<unsigned long> misses_;
+    std::atomic<unsigned long> compressed_;
+    std::atomic<unsigned long> sidecars_;
+};
+
+#endif
@@ -11,78 +11,157 @@
 #include <iostream>
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <unordered_map>
 #include <exception>
 #include <signal.h>
+#include <atomic>
+#include <sys/eventfd.h>
+#include <fcntl.h>
 #include "ThreadPool.h"
+#include "ConnectionTable.h"
+#include "ObjectPool.h"
 #include "Timer.h"
 #include "Utils.h"
 #include "Logging.h"
+#include "Metrics.h"
 using std::shared_ptr;
 using std::weak_ptr;
 using std::vector;
 
-const int MAXFD = 1024;
+const int DEFAULT_EPOLL_BATCH = 1024;   // epoll_wait一次最多返回的事件数
+// 工作队列满时积压的任务超过高水位就暂停accept，降到低水位以下再恢复
+const std::size_t OVERFLOW_HIGH_WATERMARK = 1024;
+const std::size_t OVERFLOW_LOW_WATERMARK = 256;
+const int OVERFLOW_RETRY_MS = 1;        // 有积压的任务时epoll_wait的超时时间
 extern int pipefd[2];   // 用于传递信号的管道，在Utils.cpp中定义
 
 template <typename T>
-class Epoll
+class Epoll: public TimerOwner<T>
 {
     using SP_Task = shared_ptr<T>;
     using SP_Self = shared_ptr<Epoll<T>>;
     using WP_Self = weak_ptr<Epoll<T>>;
     using SP_TimerManager = shared_ptr<TimerManager<T>>;
     using SP_ThreadPool = shared_ptr<ThreadPool<T>>;
+    using SP_ConnTable = shared_ptr<ConnectionTable<T>>;
 public:
-    static SP_Self CreateEpoll(SP_ThreadPool tp, int port, int timeout);
+    // 主Reactor，监听listenfd并处理信号，listenfd < 0时不监听，Epoll对象负责关闭它
+    static SP_Self CreateEpoll(SP_ThreadPool tp, SP_ConnTable conns, int listenfd, int timeout, int batch = DEFAULT_EPOLL_BATCH);
+    // 从Reactor，处理主Reactor分配过来的连接或自己监听的连接
+    static SP_Self CreateSubEpoll(SP_ConnTable conns, int timeout, int batch = DEFAULT_EPOLL_BATCH, int listenfd = -1);
     void epoll_wait_and_handle();
+    void loop();      // 事件循环，直到调用quit()
+    void quit();      // 可以在其他线程调用
+    bool isQuit() const;
+    unsigned long queueFull() const {return queue_full_;}         // 工作队列满、拒绝新就绪任务的次数
+    unsigned long acceptPauses() const {return accept_pauses_;}   // 因为积压暂停accept的次数
+    void setSubReactors(const vector<SP_Self> &subs);   // 设置从Reactor后，新连接轮流分配给它们
+    // 监视其他描述符（水平触发），可读时在本Reactor的线程中调用cb，用于平滑升级的Unix套接字和定时器
+    // 只能在本Reactor的线程中调用，不负责关闭fd
+    bool watch(int fd, std::function<void()> cb);
+    void unwatch(int fd);
+    void drain();     // 停止accept，并让空闲连接按新连接的超时时间关闭，可以在其他线程调用
+    void queueConnection(int connfd, const sockaddr_in &addr);   // 在其他线程调用，把新连接交给本Reactor
     bool epoll_add(int fd, int ev, SP_Task task);
     bool epoll_mod(int fd, int ev, SP_Task task);
     bool epoll_del(int fd);
+    void wakeup() override;    // 唤醒阻塞在epoll_wait上的Reactor，可以在其他线程调用
+    void closeConnection(int fd) override {epoll_del(fd);}
     Epoll() = delete;
     Epoll(const Epoll &) = delete;
     Epoll &operator=(const Epoll &) = delete;
-    ~Epoll() = default;
+    ~Epoll();
     
 private:
-    static WP_Self epoll_;     // 单例模式指向唯一实体
-    SP_ThreadPool pool_;   // 线程池指针
-    SP_TimerManager timer_manager_;   // 定时器管理者
+    static WP_Self epoll_;     // 单例模式指向唯一的主Reactor
+    WP_Self self_;             // 指向自身，新任务需要知道自己属于哪个Reactor
+    SP_ThreadPool pool_;   // 线程池指针，从Reactor中为空，任务直接在本线程执行
+    SP_TimerManager timer_manager_;   // 定时器管理者，每个Reactor一个
     int epfd_;
-    int listenfd_;
+    int listenfd_;    // 不监听端口时为-1
+    int wakeupfd_;    // eventfd，用于其他线程唤醒本Reactor
+    int idlefd_;      // 预留的文件描述符，文件描述符耗尽时用它接受并关闭新连接，否则边沿触发的listenfd不会再通知
     int timeout_;     // 新连接来时的初始计时器
-    epoll_event events_[MAXFD];   // 用来保存epoll_wait得到的事件
-    SP_Task fd2Task[MAXFD];      // 保持文件描述符到Task的映射
-    Epoll(shared_ptr<ThreadPool<T>> tp,int port, int timeout);
+    std::atomic<bool> quit_;
+    std::atomic<bool> draining_;      // drain()设置，由本Reactor的线程在下一轮事件循环开始时处理
+    bool drained_;
+    vector<epoll_event> events_;  // 用来保存epoll_wait得到的事件，大小即一次处理的最大事件数
+    SP_ConnTable fd2Task;         // 保持文件描述符到Task的映射，所有Reactor共用
+    vector<SP_Self> subReactors_;   // 从Reactor，为空时在本Reactor处理新连接
+    std::size_t next_;              // 下一个接收新连接的从Reactor
+    Locker locker_;                 // 保护pendingConns_
+    vector<std::pair<int, sockaddr_in>> pendingConns_;   // 主Reactor交过来、尚未注册的新连接
+    /*
+        工作队列满时，就绪的任务放入积压列表，每轮事件循环先按顺序重新提交，不丢弃：
+        连接使用EPOLLET|EPOLLONESHOT，丢掉的事件不会再通知，连接只能等到超时
+        积压超过高水位时暂停accept，让已有的连接先处理完，边沿触发的listenfd在恢复时主动accept一次
+    */
+    std::deque<SP_Task> overflow_;
+    bool accept_paused_;
+    std::atomic<std::size_t> overflow_size_;     // overflow_.size()，给统计信息在其他线程读取
+    std::atomic<unsigned long> queue_full_;
+    std::atomic<unsigned long> accept_pauses_;
+    std::unordered_map<int, std::function<void()>> watchers_;
+    Epoll(SP_ThreadPool tp, SP_ConnTable conns, int listenfd, int timeout, int batch);
     vector<SP_Task> getEventsRequest(int num);   // 在epoll_wait后调用这个函数，返回任务的vector
     void acceptConnection();        // 接受新的连接
+    bool newConnection(int connfd, const sockaddr_in &addr);   // 为新连接创建任务并注册
+    void handlePendingConns();      // 注册主Reactor交过来的新连接
     void handleSignal();            // 处理信号
+    bool initTimer();
+    void dispatch(vector<SP_Task> &requests);    // 把任务交给线程池，放不下的进入积压列表
+    void setAcceptPaused(bool paused);
+    void handleDrain();
 };
 template <typename T>
 weak_ptr<Epoll<T>> Epoll<T>::epoll_;
 
 // 构造函数，需要创建epollfd
 template <typename T>
-Epoll<T>::Epoll(shared_ptr<ThreadPool<T>> tp,int port, int timeout):
-    epfd_(epoll_create(MAXFD)), listenfd_(Create_And_Listen(port)), 
-    pool_(tp),timeout_(timeout), fd2Task{nullptr}, timer_manager_(nullptr)
+Epoll<T>::Epoll(SP_ThreadPool tp, SP_ConnTable conns, int listenfd, int timeout, int batch):
+    pool_(tp), timer_manager_(nullptr), epfd_(epoll_create1(EPOLL_CLOEXEC)), listenfd_(listenfd),
+    wakeupfd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), 
+    idlefd_(listenfd >= 0 ? open("/dev/null", O_RDONLY | O_CLOEXEC) : -1), timeout_(timeout), quit_(false), draining_(false), drained_(false),
+    events_(batch > 0 ? batch : DEFAULT_EPOLL_BATCH), fd2Task(conns), next_(0),
+    accept_paused_(false), overflow_size_(0), queue_full_(0), accept_pauses_(0)
 {
     if (epfd_ < 0)
         throw std::runtime_error("Epoll create failed");
-    if (listenfd_ < 0)
-        throw std::runtime_error("Socket create failed");
+    if (wakeupfd_ < 0)
+        throw std::runtime_error("Eventfd create failed");
+    if (!fd2Task)
+        throw std::runtime_error("Connection table is null");
 }
 
-// 工厂函数，需要传入线程池
 template <typename T>
-shared_ptr<Epoll<T>> Epoll<T>::CreateEpoll(shared_ptr<ThreadPool<T>> tp, int port, int timeout)
+Epoll<T>::~Epoll()
+{
+    close(epfd_);
+    close(wakeupfd_);
+    if (idlefd_ >= 0)
+        close(idlefd_);
+    if (listenfd_ >= 0)
+        close(listenfd_);
+}
+
+// 工厂函数，需要传入线程池。线程池为空时，任务由从Reactor处理
+template <typename T>
+shared_ptr<Epoll<T>> Epoll<T>::CreateEpoll(SP_ThreadPool tp, SP_ConnTable conns, int listenfd, int timeout, int batch)
 {
     if (epoll_.lock())
+    {
+        if (listenfd >= 0)
+            close(listenfd);
         return nullptr;
-    
+    }
+
     SP_Self sp(nullptr);
     try
     {
-        sp.reset(new Epoll<T>(tp, port, timeout));
+        sp.reset(new Epoll<T>(tp, conns, listenfd, timeout, batch));
+        sp->self_ = sp;
         epoll_ = sp;
     }
     catch (const std::bad_alloc &e)
@@ -92,12 +171,14 @@ shared_ptr<Epoll<T>> Epoll<T>::CreateEpoll(shared_ptr<ThreadPool<T>> tp, int por
     }
     catch (const std::runtime_error &e)
     {
+        if (listenfd >= 0)
+            close(listenfd);
         std::cerr << "runtime error: " << e.what() << std::endl;
         return nullptr;
     }
 
     // 把listenfd注册到epoll
-    if (!sp->epoll_add(sp->listenfd_, EPOLLIN | EPOLLET, nullptr))
+    if (sp->listenfd_ >= 0 && !sp->epoll_add(sp->listenfd_, EPOLLIN | EPOLLET, nullptr))
     {
         std::cerr << "epoll_add listenfd failed" << std::endl;
         return nullptr;
@@ -130,11 +211,75 @@ shared_ptr<Epoll<T>> Epoll<T>::CreateEpoll(shared_ptr<ThreadPool<T>> tp, int por
         return nullptr;
     }
 
-    sp->timer_manager_ = TimerManager<T>::CreateTimerManager(sp);
-    T::Init(sp->timer_manager_, sp);
+    if (!sp->initTimer())
+        return nullptr;
+    if (tp)
+    {
+        WP_Self weak = sp;
+        Metrics::addGauge("overflow_tasks", "Ready tasks waiting for room in the full work queue.", [weak]() {
+            auto ep = weak.lock();
+            return ep ? static_cast<double>(ep->overflow_size_.load()) : 0.0;
+        });
+        Metrics::addCounter("queue_full_total", "Times the full work queue rejected a ready task.", [weak]() {
+            auto ep = weak.lock();
+            return ep ? static_cast<double>(ep->queueFull()) : 0.0;
+        });
+        Metrics::addCounter("accept_pauses_total", "Times accepting was paused because of the task backlog.", [weak]() {
+            auto ep = weak.lock();
+            return ep ? static_cast<double>(ep->acceptPauses()) : 0.0;
+        });
+    }
     return epoll_.lock();
 }
 
+// 工厂函数，创建从Reactor，由调用者为它创建线程并执行loop()
+// listenfd >= 0时（SO_REUSEPORT模式），从Reactor自己accept，Epoll对象负责关闭它
+template <typename T>
+shared_ptr<Epoll<T>> Epoll<T>::CreateSubEpoll(SP_ConnTable conns, int timeout, int batch, int listenfd)
+{
+    SP_Self sp(nullptr);
+    try
+    {
+        sp.reset(new Epoll<T>(nullptr, conns, listenfd, timeout, batch));
+        sp->self_ = sp;
+    }
+    catch (const std::bad_alloc &e)
+    {
+        std::cerr << "malloc error: " << e.what() << std::endl;
+        return nullptr;
+    }
+    catch (const std::runtime_error &e)
+    {
+        if (listenfd >= 0)
+            close(listenfd);
+        std::cerr << "runtime error: " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    if (listenfd >= 0 && !sp->epoll_add(listenfd, EPOLLIN | EPOLLET, nullptr))
+    {
+        std::cerr << "epoll_add listenfd failed" << std::endl;
+        return nullptr;
+    }
+
+    if (!sp->initTimer())
+        return nullptr;
+    return sp;
+}
+
+// 注册wakeupfd，并创建本Reactor的定时器管理者
+template <typename T>
+bool Epoll<T>::initTimer()
+{
+    if (!epoll_add(wakeupfd_, EPOLLIN | EPOLLET, nullptr))
+    {
+        std::cerr << "epoll_add wakeupfd failed" << std::endl;
+        return false;
+    }
+    timer_manager_ = TimerManager<T>::CreateTimerManager(this);
+    return timer_manager_ != nullptr;
+}
+
 template <typename T>
 bool Epoll<T>::epoll_add(int fd, int ev, SP_Task task)
 {
@@ -142,11 +287,12 @@ bool Epoll<T>::epoll_add(int fd, int ev, SP_Task task)
     memset(&event, 0, sizeof(event));
     event.data.fd = fd;
     event.events = ev;
-    fd2Task[fd] = task;
+    if (task && !fd2Task->set(fd, task))
+        return false;
     if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) != 0)
     {
         // std::cout << "epoll_add失败,fd=" << fd << std::endl;
-        fd2Task[fd].reset();
+        fd2Task->reset(fd);
         return false;
     }
     return true;
@@ -163,7 +309,7 @@ bool Epoll<T>::epoll_mod(int fd, int ev, SP_Task task)
     if( epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &event) != 0)
     {
         // std::cout << "epoll_mod失败,fd=" << fd << std::endl;
-        fd2Task[fd].reset();
+        fd2Task->reset(fd);
         return false;
     }
     return true;
@@ -172,7 +318,7 @@ bool Epoll<T>::epoll_mod(int fd, int ev, SP_Task task)
 template <typename T>
 bool Epoll<T>::epoll_del(int fd)
 {
-    fd2Task[fd].reset();
+    fd2Task->reset(fd);
     if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr) != 0)
         return false;
     return true;
@@ -182,7 +328,15 @@ bool Epoll<T>::epoll_del(int fd)
 template <typename T>
 void Epoll<T>::epoll_wait_and_handle()
 {
-    int num = epoll_wait(epfd_, events_, MAXFD, 5000);
+    if (draining_ && !drained_)
+        handleDrain();
+    // 等到最近的定时器所在的格，时间轮为空时最多等5s，有积压的任务时很快醒来重新提交
+    int timeout = timer_manager_->nextTimeout();
+    if (timeout < 0)
+        timeout = 5000;
+    if (!overflow_.empty() && timeout > OVERFLOW_RETRY_MS)
+        timeout = OVERFLOW_RETRY_MS;
+    int num = epoll_wait(epfd_, events_.data(), static_cast<int>(events_.size()), timeout);
     if (num == -1 && errno != EINTR)
     {
         // std::cerr << "epoll_wait failed" << std::endl;
@@ -191,14 +345,172 @@ void Epoll<T>::epoll_wait_and_handle()
     }
     // std::cout << "num = " << num << std::endl;
     vector<SP_Task> requests = getEventsRequest(num);
-    for (auto &p : requests)
+    if (pool_)
+        dispatch(requests);
+    else
     {
-        if (!pool_->addTask(p))
-            break;      // 由于线程池的工作队列已满或者线程池已关闭，放弃本次监听的事件
+        // 从Reactor，连接始终在本线程处理
+        for (auto &p : requests)
+            p->process();
     }
     timer_manager_->handleExpired();  // 处理超时的定时器
 }
 
+// 先重新提交积压的任务，保持先来先服务，再提交这一轮的任务
+template <typename T>
+void Epoll<T>::dispatch(vector<SP_Task> &requests)
+{
+    if (pool_->isStop())
+    {
+        overflow_.clear();
+        overflow_size_ = 0;
+        return;
+    }
+    while (!overflow_.empty())
+    {
+        SP_Task &task = overflow_.front();
+        // 积压期间连接已经超时关闭
+        if (fd2Task->get(task->getsock()) == task && !pool_->addTask(task))
+            break;
+        overflow_.pop_front();
+    }
+    for (auto &p : requests)
+    {
+        // 前面还有积压时直接排在后面，保持顺序，只有真正被队列拒绝时才计数
+        if (!overflow_.empty())
+            overflow_.push_back(std::move(p));
+        else if (!pool_->addTask(p))
+        {
+            ++queue_full_;
+            overflow_.push_back(std::move(p));
+        }
+    }
+    overflow_size_ = overflow_.size();
+
+    if (!accept_paused_ && overflow_.size() > OVERFLOW_HIGH_WATERMARK)
+        setAcceptPaused(true);
+    else if (accept_paused_ && overflow_.size() < OVERFLOW_LOW_WATERMARK)
+        setAcceptPaused(false);
+}
+
+template <typename T>
+void Epoll<T>::setAcceptPaused(bool paused)
+{
+    accept_paused_ = paused;
+    if (paused)
+    {
+        ++accept_pauses_;
+        LOG_WARN << "work queue overloaded, " << overflow_.size() << " tasks waiting, pause accepting";
+    }
+    else
+    {
+        LOG_WARN << "work queue drained, resume accepting";
+        // 暂停期间到达的连接不会再触发边沿，主动accept一次
+        if (listenfd_ >= 0)
+            acceptConnection();
+    }
+}
+
+template <typename T>
+void Epoll<T>::loop()
+{
+    while (!quit_)
+        epoll_wait_and_handle();
+}
+
+template <typename T>
+void Epoll<T>::quit()
+{
+    quit_ = true;
+    wakeup();
+}
+
+template <typename T>
+bool Epoll<T>::isQuit() const
+{
+    return quit_;
+}
+
+template <typename T>
+void Epoll<T>::setSubReactors(const vector<SP_Self> &subs)
+{
+    subReactors_ = subs;
+}
+
+template <typename T>
+bool Epoll<T>::watch(int fd, std::function<void()> cb)
+{
+    if (!epoll_add(fd, EPOLLIN, nullptr))
+        return false;
+    watchers_[fd] = std::move(cb);
+    return true;
+}
+
+template <typename T>
+void Epoll<T>::unwatch(int fd)
+{
+    if (watchers_.erase(fd))
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+template <typename T>
+void Epoll<T>::drain()
+{
+    draining_ = true;
+    wakeup();
+}
+
+/*
+    在事件循环开始、epoll_wait之前处理，这一轮不会再有listenfd的事件
+    关闭的只是本进程的描述符，新进程持有同一个监听套接字，accept队列中的连接由新进程接受
+    空闲的持续连接按新连接的超时时间关闭，正在处理的连接由任务回复Connection: close后关闭
+*/
+template <typename T>
+void Epoll<T>::handleDrain()
+{
+    drained_ = true;
+    if (listenfd_ >= 0)
+    {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, listenfd_, nullptr);
+        close(listenfd_);
+        listenfd_ = -1;
+    }
+    timer_manager_->shorten(timeout_);
+    LOG_INFO << "stop accepting, drain " << timer_manager_->size() << " idle connections";
+}
+
+template <typename T>
+void Epoll<T>::queueConnection(int connfd, const sockaddr_in &addr)
+{
+    locker_.lock();
+    pendingConns_.push_back(std::make_pair(connfd, addr));
+    locker_.unlock();
+    wakeup();
+}
+
+template <typename T>
+void Epoll<T>::wakeup()
+{
+    uint64_t one = 1;
+    if (write(wakeupfd_, &one, sizeof(one)) != sizeof(one))
+        LOG_ERROR << "wakeup failed, errno=" << errno;
+}
+
+template <typename T>
+void Epoll<T>::handlePendingConns()
+{
+    uint64_t cnt;
+    while (read(wakeupfd_, &cnt, sizeof(cnt)) > 0) {}
+
+    vector<std::pair<int, sockaddr_in>> conns;
+    locker_.lock();
+    conns.swap(pendingConns_);
+    locker_.unlock();
+
+    for (auto &c : conns)
+        newConnection(c.first, c.second);
+}
+
 // 从events中获取事件，并把事件对应的Task指针存到vector中返回
 template <typename T>
 vector<shared_ptr<T>> Epoll<T>::getEventsRequest(int num)
@@ -210,15 +522,29 @@ vector<shared_ptr<T>> Epoll<T>::getEventsRequest(int num)
         int ev = events_[i].events;
         // 新的用户连接
         if (fd == listenfd_)
-            acceptConnection();
+        {
+            if (!accept_paused_)
+                acceptConnection();
+        }
+        else if (fd == wakeupfd_)
+            handlePendingConns();
         else if ((fd == pipefd[0]) &&  (ev & EPOLLIN))
             handleSignal();
+        else if (!watchers_.empty() && watchers_.count(fd))
+        {
+            // 回调可能取消监视，先复制一份
+            std::function<void()> cb = watchers_[fd];
+            cb();
+        }
         else if ((ev & EPOLLIN) || (ev & EPOLLOUT))
         {
-            if (!fd2Task[fd])
+            SP_Task task = fd2Task->get(fd);
+            if (!task)
+            {
                 LOG_FATAL << "fatal nullptr fd = " << fd;
-            
-            requests.push_back(fd2Task[fd]);
+                continue;
+            }
+            requests.push_back(std::move(task));
         }
         else {/* something else */}
     }
@@ -233,8 +559,24 @@ void Epoll<T>::acceptConnection()
     memset(&addr, 0, sizeof(addr));
     socklen_t addr_len = sizeof(addr);
     int connfd;
-    while ((connfd = accept(listenfd_, (sockaddr *)&addr, &addr_len)) != -1)
+    while (true)
     {
+        connfd = accept(listenfd_, (sockaddr *)&addr, &addr_len);
+        if (connfd == -1)
+        {
+            // 文件描述符耗尽，腾出预留的描述符接受并立即关闭这个连接，否则边沿触发的listenfd不会再通知
+            if (errno == EMFILE && idlefd_ >= 0)
+            {
+                close(idlefd_);
+                idlefd_ = accept(listenfd_, NULL, NULL);
+                if (idlefd_ >= 0)
+                    close(idlefd_);
+                idlefd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                LOG_ERROR << "Too many open files, reject a new connection";
+                continue;
+            }
+            break;
+        }
         LOG_INFO << "accept new connection, socket: " << connfd << " ip: " << dotted_decimal_notation(addr) << ":" << src_port(addr) ;
 
         // 禁用Nagle算法
@@ -246,10 +588,10 @@ void Epoll<T>::acceptConnection()
             continue;
         }
 
-        if (connfd >= MAXFD)
+        if (connfd >= fd2Task->capacity())
         {
             close(connfd);
-            LOG_ERROR << "connfd >= MAXFD, close the socket " << connfd;
+            LOG_ERROR << "connfd >= connection table capacity, close the socket " << connfd;
             continue;
         }
         if (!SetSocketNoBlocking(connfd))
@@ -260,23 +602,40 @@ void Epoll<T>::acceptConnection()
             return;
         }
 
-        SP_Task new_task(new T(connfd, addr));
-        if (!epoll_add(connfd, EPOLLIN | EPOLLET | EPOLLONESHOT, new_task))
+        // 有从Reactor时，轮流分配，连接此后一直由该Reactor处理
+        if (!subReactors_.empty())
         {
-            // std::cerr << "epoll_add failed" << std::endl;
-            LOG_ERROR <<"epoll_add connfd " << connfd << " failed";
-            return;
+            subReactors_[next_]->queueConnection(connfd, addr);
+            next_ = (next_ + 1) % subReactors_.size();
         }
-        if (!timer_manager_->addTimer(new_task, timeout_))
-        {
-            epoll_del(connfd);
-            // std::cerr << "Add timer failed" << std::endl;
-            LOG_ERROR << "Add timer failed";
+        else if (!newConnection(connfd, addr))
             return;
-        }
     }
 }
 
+// 为新连接创建任务，注册到epoll并添加定时器
+// 任务和shared_ptr的控制块一起从本线程的内存池分配，连接关闭后内存留给下一个连接
+template <typename T>
+bool Epoll<T>::newConnection(int connfd, const sockaddr_in &addr)
+{
+    SP_Task new_task = makePooled<T>(connfd, addr);
+    new_task->Init(timer_manager_, self_.lock());
+    if (!epoll_add(connfd, EPOLLIN | EPOLLET | EPOLLONESHOT, new_task))
+    {
+        // std::cerr << "epoll_add failed" << std::endl;
+        LOG_ERROR <<"epoll_add connfd " << connfd << " failed";
+        return false;
+    }
+    if (!timer_manager_->addTimer(new_task.get(), timeout_))
+    {
+        epoll_del(connfd);
+        // std::cerr << "Add timer failed" << std::endl;
+        LOG_ERROR << "Add timer failed";
+        return false;
+    }
+    return true;
+}
+
 template <typename T>
 void Epoll<T>::handleSignal()
 {
@@ -291,7 +650,9 @@ void Epoll<T>::handleSignal()
             case SIGINT:
             case SIGTERM:
                 LOG_WARN << "get SIGINT or SIGTERM";
-                pool_->shutdown();
+                if (pool_)
+                    pool_->shutdown();
+                quit_ = true;
                 break;
             default:
                 // std::cout << "get some signals, and don't know how to handle." << std::endl;
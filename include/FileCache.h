@@ -0,0 +1,123 @@
+// 静态文件缓存
+#ifndef _FILECACHE_H
+#define _FILECACHE_H
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Sync.h"
+#include "noncopyable.h"
+using std::shared_ptr;
+using std::string;
+
+// 文件的身份，文件被修改或者被替换后就会改变
+struct FileId
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime_sec;
+    long mtime_nsec;
+
+    static FileId fromStat(const struct stat &st)
+    {
+        FileId id = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+        return id;
+    }
+    bool operator==(const FileId &rhs) const
+    {
+        return dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+               mtime_sec == rhs.mtime_sec && mtime_nsec == rhs.mtime_nsec;
+    }
+};
+
+// 缓存的文件内容，以及预先计算好的首部字段值
+struct CachedFile
+{
+    string path;
+    string body;
+    string content_type;      // Content-Type首部字段的值
+    string content_length;    // Content-Length首部字段的值
+    string last_modified;     // Last-Modified首部字段的值
+    string content_encoding;  // Content-Encoding首部字段的值，未编码时为空
+    string etag;              // ETag首部字段的值，每种编码各不相同
+    int max_age;              // 缓存策略，见HttpHeaders::maxAge()
+    FileId id;                // 原始文件的身份
+    string head_fields;       // 200响应中这个文件的首部字段，预先拼好
+};
+
+/*
+    按路径缓存文件内容，分成多个分片，每个分片一把锁，按LRU淘汰，总大小有上限
+    文件加入缓存前先用inotify监视，后台线程收到文件被修改、删除、移动的通知后将其移出缓存
+    所以命中时不需要stat()和open()，也不会返回过期的内容
+    缓存项用shared_ptr保存，正在发送的缓存项被淘汰后依然有效
+*/
+class FileCache: public noncopyable
+{
+    using SP_CachedFile = shared_ptr<const CachedFile>;
+public:
+    struct Stats
+    {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long evictions;
+        unsigned long invalidations;
+        std::size_t entries;
+        std::size_t bytes;
+    };
+
+    // 在服务器启动前调用一次，capacity为0时不启用缓存，超过max_file_size的文件不缓存
+    static bool Init(std::size_t capacity, std::size_t max_file_size);
+    // 未启用缓存时返回nullptr
+    static FileCache *instance() {return instance_;}
+
+    std::size_t maxFileSize() const {return max_file_size_;}
+    SP_CachedFile get(const string &path);   // 未命中时返回nullptr
+    // 读取文件并加入缓存，文件不存在、太大或无法监视时返回nullptr
+    SP_CachedFile load(const string &path, const string &content_type);
+    Stats stats();
+
+private:
+    static const int SHARD_NUM = 16;
+    struct Shard
+    {
+        using LruList = std::list<SP_CachedFile>;
+        Locker locker_;
+        LruList lru_;      // 表头是最近使用的
+        std::unordered_map<string, LruList::iterator> index_;
+        std::size_t bytes_ = 0;
+    };
+
+    FileCache(std::size_t capacity, std::size_t max_file_size, int inotify_fd);
+    Shard &shardOf(const string &path);
+    void erase(const string &path);
+    bool watch(const string &path);
+    void unwatch(const std::vector<string> &paths);
+    static void *inotifyThread(void *arg);
+    void handleInotify();
+
+    static FileCache *instance_;
+
+    const std::size_t shard_capacity_;
+    const std::size_t max_file_size_;
+    Shard shards_[SHARD_NUM];
+
+    int inotify_fd_;
+    Locker watch_locker_;    // 保护下面两个映射
+    std::unordered_map<int, std::unordered_set<string>> wd2paths_;   // 同一个文件可能有多个路径
+    std::unordered_map<string, int> path2wd_;
+
+    std::atomic<unsigned long> hits_;
+    std::atomic<unsigned long> misses_;
+    std::atomic<unsigned long> evictions_;
+    std::atomic<unsigned long> invalidations_;
+};
+
+#endif
@@ -0,0 +1,82 @@
+// 预先拼好的HTTP响应首部
+#ifndef _HTTPHEADERS_H
+#define _HTTPHEADERS_H
+#include <pthread.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "FileCache.h"
+#include "HttpParser.h"
+#include "noncopyable.h"
+using std::string;
+
+/*
+    响应首部中不变的部分只拼一次，生成响应时直接追加到发送缓冲区，不再拼接临时字符串：
+        状态行和Connection/Keep-Alive按（状态码，是否持续连接）在第一次使用时生成
+        Date、Server和首部结束的空行每个线程每秒格式化一次
+        400、404的首部和HTML页面整个预先生成，只需要补上Date
+        缓存的文件在200响应中的首部字段随缓存项一起生成（见fileFields()）
+        Cache-Control按MIME类型配置，Expires和Date一样每个线程每秒格式化一次
+*/
+class HttpHeaders: public noncopyable
+{
+public:
+    static const int KEEP_ALIVE_TIMEOUT = 5 * 1000;   // 持续连接的超时时间（毫秒），写在Keep-Alive字段里
+
+    static void appendStatus(Buffer &buf, int status, bool keep_alive);     // 状态行和连接管理字段
+    static void appendField(Buffer &buf, const StringPiece &name, const StringPiece &value);
+    static void appendContentLength(Buffer &buf, std::size_t length);
+    static void appendEnd(Buffer &buf);           // Date、Server和首部结束的空行
+    // 预先生成的完整错误响应，这个状态码没有时返回false
+    static bool appendCanned(Buffer &buf, int status, bool keep_alive);
+    // 错误页面的HTML
+    static string errorPage(int status, const string &msg);
+    // 静态文件的200和206响应都有的字段：Accept-Ranges、Vary、Last-Modified、ETag
+    static void appendFileMeta(Buffer &buf, const StringPiece &last_modified, const StringPiece &etag);
+    // 缓存的文件（或者它的压缩版本）在200响应中的首部字段，从Accept-Ranges到Content-Type
+    static string fileFields(const CachedFile &file);
+
+    // 由文件身份（inode、大小、修改时间）生成的实体标签，suffix区分同一文件的不同编码
+    // 修改时间在一秒之内的文件可能马上又被修改而修改时间不变，生成弱标签
+    static string etag(const FileId &id, const char *suffix = nullptr);
+
+    // 缓存策略，逗号分隔的"MIME类型前缀=秒数"，按顺序匹配，0表示no-cache，在服务器启动前调用一次
+    // 例如"text/html=0,image/=86400"，格式错误时返回false
+    static bool InitCachePolicy(const string &spec);
+    // content_type对应的max-age，没有匹配的规则时返回-1
+    static int maxAge(const string &content_type);
+    // Cache-Control和Expires，max_age小于0时什么也不写
+    static void appendCachePolicy(Buffer &buf, int max_age);
+    static const char *reason(int status);
+
+    HttpHeaders() = delete;
+
+private:
+    static const int STATUS_NUM = 6;
+    struct Status
+    {
+        int code;
+        const char *reason;
+        bool canned;             // 是否预先生成整个错误响应
+    };
+    static const Status statuses_[STATUS_NUM];
+
+    static pthread_once_t once_control_;
+    static void _init();
+    static int _index(int status);
+
+    static string connection_fields_[2];          // [是否持续连接]
+    static string status_lines_[STATUS_NUM][2];   // [状态][是否持续连接]
+    static string canned_heads_[STATUS_NUM][2];   // 错误响应除Date、Server以外的首部
+    static string canned_bodies_[STATUS_NUM];
+
+    struct CacheRule
+    {
+        string prefix;           // MIME类型前缀
+        int max_age;
+    };
+    static std::vector<CacheRule> cache_rules_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+// HTTP请求解析器
+#ifndef _HTTPPARSER_H
+#define _HTTPPARSER_H
+#include <cstddef>
+#include <cstring>
+#include <strings.h>
+#include <string>
+#include <vector>
+
+// 指向一段内存的切片，不拥有内存，只在原数据有效期间有效
+class StringPiece
+{
+public:
+    StringPiece(): data_(nullptr), size_(0) {}
+    StringPiece(const char *data, std::size_t size): data_(data), size_(size) {}
+    StringPiece(const char *str): data_(str), size_(strlen(str)) {}
+    StringPiece(const std::string &str): data_(str.data()), size_(str.size()) {}
+
+    const char *data() const {return data_;}
+    std::size_t size() const {return size_;}
+    bool empty() const {return size_ == 0;}
+    char operator[](std::size_t i) const {return data_[i];}
+    std::string toString() const {return std::string(data_, size_);}
+
+    bool operator==(const StringPiece &rhs) const
+    {return size_ == rhs.size_ && memcmp(data_, rhs.data_, size_) == 0;}
+    bool operator!=(const StringPiece &rhs) const {return !(*this == rhs);}
+    bool equalsIgnoreCase(const StringPiece &rhs) const
+    {return size_ == rhs.size_ && strncasecmp(data_, rhs.data_, size_) == 0;}
+
+private:
+    const char *data_;
+    std::size_t size_;
+};
+
+
+/*
+    逐字节的HTTP/1.x请求解析器（请求行和首部，不包括实体主体）
+    每次调用parse()传入从请求开头到当前收到的全部数据，解析器记住上次停在哪个字节、处于哪个状态，
+    只处理新到的字节，所以数据可以被任意切分，每个字节只扫描一次
+    解析结果只记录相对请求开头的偏移和长度，不拷贝数据：
+    缓冲区扩容或移动后，只要请求开头之后的数据不变，用新的起始地址就能取到切片
+*/
+class HttpParser
+{
+public:
+    enum Method {METHOD_UNKNOWN = 0, METHOD_GET, METHOD_POST};
+    enum Version {HTTP1_1 = 0, HTTP1_0};
+    enum Connection {CONNECTION_DEFAULT = 0, CONNECTION_KEEP_ALIVE, CONNECTION_CLOSE};
+    enum Result {PARSE_FINISH = 0, PARSE_AGAIN = -1, PARSE_ERROR = -2};
+
+    static const std::size_t MAX_HEADERS = 64;            // 首部字段的最大个数
+    static const std::size_t MAX_HEADER_BYTES = 8192;     // 请求行加首部的最大长度
+
+    HttpParser() {reset();}
+    void reset();
+
+    // data指向请求的第一个字节，len是目前收到的字节数
+    // 解析完首部返回PARSE_FINISH，数据不完整返回PARSE_AGAIN，格式错误或超出限制返回PARSE_ERROR
+    int parse(const char *data, std::size_t len);
+    bool finished() const {return state_ == S_DONE;}
+
+    // 以下结果在parse()返回PARSE_FINISH后有效，base是请求第一个字节当前的地址
+    Method method() const {return method_;}
+    Version version() const {return version_;}
+    Connection connection() const {return connection_;}
+    bool hasContentLength() const {return content_length_ >= 0;}
+    long long contentLength() const {return content_length_;}
+    std::size_t headerBytes() const {return pos_;}    // 请求行和首部（包括最后的空行）的长度
+    StringPiece uri(const char *base) const {return StringPiece(base + uri_.offset, uri_.len);}
+    std::size_t headerCount() const {return headers_.size();}
+    StringPiece headerName(const char *base, std::size_t i) const
+    {return StringPiece(base + headers_[i].name.offset, headers_[i].name.len);}
+    StringPiece headerValue(const char *base, std::size_t i) const
+    {return StringPiece(base + headers_[i].value.offset, headers_[i].value.len);}
+    // 按名字查找首部字段（不区分大小写），没有时返回空切片
+    StringPiece header(const char *base, const StringPiece &name) const;
+
+private:
+    enum State {
+        S_START = 0,          // 跳过请求前的空行
+        S_METHOD,
+        S_URI_START,
+        S_URI,
+        S_VERSION,
+        S_REQUEST_LINE_LF,
+        S_HEADER_START,
+        S_HEADER_NAME,
+        S_HEADER_VALUE_START,
+        S_HEADER_VALUE,
+        S_HEADER_LF,
+        S_HEADERS_END_LF,
+        S_DONE,
+        S_ERROR
+    };
+
+    struct Slice
+    {
+        std::size_t offset;
+        std::size_t len;
+    };
+    struct Header
+    {
+        Slice name;
+        Slice value;
+    };
+
+    int fail() {state_ = S_ERROR; return PARSE_ERROR;}
+    bool finishMethod(const char *data);
+    bool finishVersion(const char *data);
+    bool finishHeader(const char *data);
+
+    State state_;
+    std::size_t pos_;          // 下一个要处理的字节
+    Slice token_;              // 正在解析的方法、URI或版本
+    Header header_;            // 正在解析的首部字段
+    std::size_t value_end_;    // 首部字段值最后一个非空白字符的下一个位置
+    Slice uri_;
+    std::vector<Header> headers_;
+    Method method_;
+    Version version_;
+    Connection connection_;
+    long long content_length_;   // 没有Content-Length时为-1
+};
+
+#endif
@@ -2,11 +2,17 @@
 #ifndef _HTTPTASK_H
 #define _HTTPTASK_H
 #include "BaseTask.h"
+#include "Buffer.h"
+#include "HttpParser.h"
+#include "FileCache.h"
 #include "noncopyable.h"
 #include "Logging.h"
 #include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
 using std::string;
 using std::unordered_map;
 
@@ -16,97 +22,146 @@ using std::unordered_map;
 class MimeType: public noncopyable
 {
 public:
-    static string getMime(const string &suffix);
+    static const string &getMime(const string &suffix);
+    static const string &getContentType(const string &suffix);    // 带charset的Content-Type值，预先拼好
     MimeType() = delete;
 
 private:
     static pthread_once_t once_control_;
     static void _init();
     static unordered_map<string,string> mime;
+    static unordered_map<string,string> content_type;
 };
 
 
 class HttpTask: public BaseTask, public std::enable_shared_from_this<HttpTask>
 {
     using SP_TimerManager = shared_ptr<TimerManager<HttpTask>>;
-    using SP_Timer = shared_ptr<TimerNode<HttpTask>>;
     using SP_Epoll = shared_ptr<Epoll<HttpTask>>;
 
     // 主状态机的状态
     enum MainStatus {
-        STATE_PARSE_REQUESTLINE = 0,
-        STATE_PARSE_HEADERS,
-        STATE_RECV_BODY,
-        STATE_ANALYSIS,
+        STATE_PARSE_REQUEST = 0,
         STATE_READY_TO_WRITE,
         STATE_FINISH,
         STATE_ERROR
     };
 
-    enum RequestMethod {METHOD_GET = 0, METHOD_POST};
-    enum HttpVersion {HTTP1_1 = 0, HTTP1_0};
+    // 一个排队中的响应，multipart/byteranges响应的每个部分各占一项
+    struct Response
+    {
+        Response(): head_len(0), cached_file(), body_offset(0), body_end(0),
+                    file_fd(-1), own_file(true), file_offset(0), file_end(0) {}
+        std::size_t head_len;       // 在outBuf_中还没发送的字节数
+        shared_ptr<const CachedFile> cached_file;   // 命中缓存时，实体主体直接从缓存发送
+        std::size_t body_offset;    // cached_file中下一个要发送的字节
+        std::size_t body_end;       // cached_file中要发送的最后一个字节的下一个位置
+        int file_fd;            // 在首部发送完后用sendfile发送的静态文件，没有则为-1
+        bool own_file;          // 多个部分共用一个文件时，只有最后一部分负责关闭
+        off_t file_offset;      // 文件中下一个要发送的字节，EPOLLOUT唤醒后从这里继续
+        off_t file_end;         // 文件中要发送的最后一个字节的下一个位置
+    };
+
+    // Range首部字段中的一个范围，[begin, end)
+    struct ByteRange
+    {
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    static const std::size_t MAX_PIPELINE_DEPTH = 16;   // 一个连接最多排队的响应数
+    static const int MAX_WRITE_IOV = 32;                // 一次writev最多合并的分段数
+    static const std::size_t MAX_RANGES = 16;           // 超过这个数的Range请求按整个文件响应
 
 public:
     HttpTask(int sock, sockaddr_in addr):
         BaseTask(sock, addr), 
         inBuf_(), 
         outBuf_(),
-        main_status_(STATE_PARSE_REQUESTLINE),
-        bytes_have_send_(0),
-        timer_(nullptr),
-        method_(METHOD_GET),
+        main_status_(STATE_PARSE_REQUEST),
+        responses_(),
+        timer_(this),
+        parser_(),
         file_name_(),
-        httpVersion_(HTTP1_1),
-        keep_alive_(false), 
-        headers_() {}
+        keep_alive_(false),
+        send_start_(0) {}
 
 
     ~HttpTask();
-    static void Init(SP_TimerManager, SP_Epoll);
-    void linkTimer(SP_Timer timer);
-    void separateTimer();
-    void bilateralSeparateTimer();
+    void Init(SP_TimerManager, SP_Epoll);
+    TimerNode<HttpTask> &timerNode() {return timer_;}
     void process() override;
 
-// 类静态数据
+    // 完成模式（io_uring后端）使用的接口：所有I/O由后端完成，任务只解析请求、生成响应，不调用epoll_
+    void onReceive(const char *data, std::size_t len);    // 收到数据，处理其中完整的请求
+    int prepareSend(struct iovec *iov, int max_iov);      // 可以直接发送的内存分段，返回分段数
+    bool prepareSendFile(int *fd, off_t *offset, std::size_t *len);   // 最前面的响应还需要从文件发送的部分
+    void onSent(std::size_t len);        // 内存分段发送了len字节
+    void onFileSent(std::size_t len);    // 文件发送了len字节
+    bool hasOutput() const {return !responses_.empty();}
+    bool shouldClose() const {return main_status_ == STATE_FINISH || main_status_ == STATE_ERROR;}
+    int idleTimeout() const;             // 等待下一个请求或请求剩余部分的超时时间
+
+// 所属的Reactor
 private:
-    static SP_TimerManager timer_manager_;  // 业务处理时需要添加计时器
-    static SP_Epoll epoll_;   // 业务处理时需要修改监听的类别
+    SP_TimerManager timer_manager_;  // 业务处理时需要添加计时器
+    SP_Epoll epoll_;   // 业务处理时需要修改监听的类别
 
 // 任务相关变量
 private:   
-    string inBuf_;          // 接收到的数据
-    string outBuf_;         // 待发送的数据
+    Buffer inBuf_;          // 接收到的数据，可能包含多个流水线请求
+    Buffer outBuf_;         // 排队的响应的首部（和小的实体主体）依次排列，发送后取出
     MainStatus main_status_;       // 主状态机
-    int bytes_have_send_;   // 已经发送的字节数
-    SP_Timer timer_;        // 定时器
+    std::vector<Response> responses_;   // 按请求顺序排队的响应，最多MAX_PIPELINE_DEPTH个
+    TimerNode<HttpTask> timer_;   // 定时器
 
 // 解析到的信息
 private:
-    RequestMethod method_;        // 请求方式，GET或POST
+    HttpParser parser_;           // 请求行和首部的解析器，结果是inBuf_中的切片，请求处理完后才取出
     string file_name_;            // 请求的文件名
-    HttpVersion httpVersion_;     // HTTP协议版本，1.0或1.1
     bool keep_alive_;             // 持续连接和非持续连接
-    std::unordered_map<std::string, std::string> headers_;  // 首部行的键值对
+    int64_t send_start_;          // 响应开始排队的时间，全部发送完时统计发送时间，为0时不统计
 
 
 // 私有函数
 private:
     int _read();
     int _write();
+    int _collectIov(struct iovec *iov, int max_iov);
+    void _advance(std::size_t sent);
+    int _sendfile(Response &resp);
+    void _closeFile(Response &resp);
+    void _clearResponses();
     void _disconnect();
-    void _reset();
+    void _finishRequest();
+
+    // 处理接收缓存中所有完整的请求，响应排入队列
+    void _handleRequests();
+    // 发送排队的响应，发完后继续处理剩下的请求
+    void _sendResponses();
+    void _onResponsesSent();
 
-    // 向发送缓存写入错误信息，并修改主状态机
-    void _handleError(int err_num, const string &msg);
+    // 向发送缓存写入错误信息，并修改主状态机，extra_head是额外的首部字段（以CRLF结尾）
+    void _handleError(int err_num, const string &msg, const string &extra_head = string());
 
     // 维护连接，包括修改epoll事件、添加定时器，在process()的最后调用
     void _handleConnection();
 
-    int _parse_requestline();
-    int _parse_headers();
+    int _parse_request();
     int _recv_body();
     int _analysis_request();
+    int _analysis_file();
+
+    // 条件请求（If-None-Match、If-Modified-Since）是否满足，满足时回复304
+    bool _not_modified(const string &etag, time_t mtime, StringPiece &matched);
+    void _queueNotModified(const StringPiece &etag, int max_age);
+
+    // 解析Range和If-Range，结果按起始位置排序并合并重叠的范围
+    int _parse_ranges(std::size_t file_size, const string &last_modified, const string &etag,
+                      std::vector<ByteRange> &ranges);
+    // 按范围排入206响应，单个范围直接发送，多个范围用multipart/byteranges
+    void _queueRanges(const string &last_modified, const string &etag, const string &content_type,
+                      int max_age, std::size_t file_size, const std::vector<ByteRange> &ranges, Response &resp);
 };
 
 #endif
\ No newline at end of file
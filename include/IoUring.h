@@ -0,0 +1,73 @@
+// io_uring的简单封装，直接使用系统调用，不依赖liburing
+#ifndef _IOURING_H
+#define _IOURING_H
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+#include "noncopyable.h"
+using std::shared_ptr;
+
+/*
+    提交队列（SQ）和完成队列（CQ）都是和内核共享的环形数组：
+        getSqe()取得一个空闲的提交项，填好后留在用户态，submitAndWait()一次系统调用提交全部并等待完成
+        peekCqe()/advanceCq()直接读取完成项，不需要系统调用
+    另外支持一个provided buffer ring：内核接收数据时自己从环中挑选缓冲区，
+    所以连接在等待数据时不占用缓冲区，用完后用recycleBuffer()还给内核
+*/
+class IoUring: public noncopyable
+{
+public:
+    // entries为提交队列的大小，内核不支持需要的功能时返回nullptr
+    static shared_ptr<IoUring> CreateIoUring(unsigned entries);
+    ~IoUring();
+    bool enable();      // 创建后处于禁用状态，必须在提交请求的线程中调用一次
+
+
+    io_uring_sqe *getSqe();         // 提交队列满时先提交已有的提交项
+    // 提交所有提交项，并等待至少wait_nr个完成项，timeout_ms < 0时不限时
+    int submitAndWait(unsigned wait_nr, int timeout_ms);
+    io_uring_cqe *peekCqe();        // 没有完成项时返回nullptr
+    void advanceCq(unsigned n);     // 处理完n个完成项后调用
+
+    // 注册provided buffer ring，buffer_num必须是2的幂
+    bool setupBufferRing(uint16_t group, unsigned buffer_num, unsigned buffer_size);
+    uint16_t bufferGroup() const {return buf_group_;}
+    char *buffer(uint16_t bid) const {return buf_base_ + static_cast<std::size_t>(bid) * buf_size_;}
+    void recycleBuffer(uint16_t bid);     // 暂存，commitBuffers()时一起还给内核
+    void commitBuffers();
+
+private:
+    IoUring();
+    bool init(unsigned entries);
+
+    int ring_fd_;
+    void *sq_ptr_;
+    std::size_t sq_size_;
+    void *cq_ptr_;
+    std::size_t cq_size_;
+    io_uring_sqe *sqes_;
+    std::size_t sqes_size_;
+
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned *sq_mask_;
+    unsigned *sq_array_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_;      // 已经填好但还没有告诉内核的提交项的尾部
+
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned *cq_mask_;
+    io_uring_cqe *cqes_;
+
+    io_uring_buf_ring *buf_ring_;
+    std::size_t buf_ring_size_;
+    char *buf_base_;
+    unsigned buf_num_;
+    unsigned buf_size_;
+    uint16_t buf_group_;
+    uint16_t buf_tail_;      // 还给内核的缓冲区写到这里，commitBuffers()时发布
+};
+
+#endif
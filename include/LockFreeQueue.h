@@ -0,0 +1,128 @@
+// 有界无锁多生产者多消费者队列
+#ifndef _LOCKFREEQUEUE_H
+#define _LOCKFREEQUEUE_H
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include "noncopyable.h"
+
+const std::size_t CACHE_LINE_SIZE = 64;
+
+/*
+    环形数组，每个槽位有一个序号（Dmitry Vyukov的有界MPMC队列）
+        槽位序号 == 入队位置：槽位空闲，生产者CAS入队位置后写入
+        槽位序号 == 出队位置+1：槽位有数据，消费者CAS出队位置后取出
+    入队和出队各自只竞争一个原子变量，不需要锁，也不需要为每个元素分配内存
+    数组长度向上取整为2的幂，但最多只放capacity个元素，和互斥锁的工作队列一样，-q N就是N个
+        容量不是2的幂时，入队还要读一次出队位置：读到的值可能偏旧（偏小），只会提前报满，不会超过容量
+*/
+template <typename E>
+class LockFreeQueue: public noncopyable
+{
+public:
+    explicit LockFreeQueue(std::size_t capacity);
+    ~LockFreeQueue() {delete [] cells_;}
+    bool push(E item);      // 队列满时返回false
+    bool pop(E &item);      // 队列空时返回false
+    std::size_t size() const;     // 近似值
+    std::size_t capacity() const {return limit_;}
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq;
+        E data;
+    };
+
+    static std::size_t roundUp(std::size_t n);
+
+    Cell *cells_;
+    const std::size_t mask_;
+    const std::size_t limit_;     // 最多的元素个数，不超过mask_ + 1
+    char pad0_[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> enqueue_pos_;
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> dequeue_pos_;
+    char pad2_[CACHE_LINE_SIZE];
+};
+
+template <typename E>
+std::size_t LockFreeQueue<E>::roundUp(std::size_t n)
+{
+    std::size_t cap = 2;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
+}
+
+template <typename E>
+LockFreeQueue<E>::LockFreeQueue(std::size_t capacity):
+    cells_(new Cell[roundUp(capacity)]), mask_(roundUp(capacity) - 1),
+    limit_(capacity > 0 ? capacity : 1), enqueue_pos_(0), dequeue_pos_(0)
+{
+    for (std::size_t i = 0; i <= mask_; ++i)
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template <typename E>
+bool LockFreeQueue<E>::push(E item)
+{
+    Cell *cell;
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        std::size_t seq = cell->seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0)
+        {
+            if (limit_ <= mask_ && pos - dequeue_pos_.load(std::memory_order_relaxed) >= limit_)
+                return false;     // 达到容量，数组还有空位
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;     // 队列已满
+        else
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+    cell->data = std::move(item);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename E>
+bool LockFreeQueue<E>::pop(E &item)
+{
+    Cell *cell;
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        std::size_t seq = cell->seq.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;     // 队列为空
+        else
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+    item = std::move(cell->data);
+    cell->data = E();       // 不在队列里保留对象的引用
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename E>
+std::size_t LockFreeQueue<E>::size() const
+{
+    std::size_t enq = enqueue_pos_.load(std::memory_order_relaxed);
+    std::size_t deq = dequeue_pos_.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef _LOGSTREAM_H
 #define _LOGSTREAM_H
 #include "noncopyable.h"
+#include "BinaryLog.h"
 #include "stdio.h"
 #include <cstring>
 #include <string>
@@ -36,15 +37,28 @@ private:
     char *cur;
 };
 
+/*
+    文本模式下每个参数立即格式化成字符串
+    二进制模式下每个参数只写入类型和原始字节，由log_decode离线格式化，见BinaryLog.h
+*/
 class LogStream: public noncopyable
 {
     using self = LogStream;
     using Buffer = FixedBuffer<SmallBufferSize>;
 public:
+    explicit LogStream(bool binary = false): binary_(binary) {}
     const Buffer &buffer() const {return buffer_;}
+    void append(const char *data, int len) {buffer_.append(data, len);}
+
     self &operator<<(bool v)
     {
-        buffer_.append(v ? "1" : "0", 1);
+        if (binary_)
+        {
+            char c = v;
+            appendArg(ARG_BOOL, &c, 1);
+        }
+        else
+            buffer_.append(v ? "1" : "0", 1);
         return *this;
     }
 
@@ -64,28 +78,65 @@ public:
 
     self& operator<<(char v)
     {
-        buffer_.append(&v, 1);
+        if (binary_)
+            appendArg(ARG_CHAR, &v, 1);
+        else
+            buffer_.append(&v, 1);
         return *this;
     }
 
     self& operator<<(const char *str)
     {
-        if (str)
-            buffer_.append(str, strlen(str));
+        if (!str)
+            str = "(null)";
+        if (binary_)
+            appendString(str, strlen(str));
         else
-            buffer_.append("(null)", 6);
+            buffer_.append(str, strlen(str));
         return *this;
     }
 
     self& operator<<(const std::string &v)
     {
-        buffer_.append(v.c_str(), v.size());
+        if (binary_)
+            appendString(v.c_str(), v.size());
+        else
+            buffer_.append(v.c_str(), v.size());
         return *this;
     }
 
 private:
-    void append(const char *data, int len) {buffer_.append(data, len);}
+    // 类型和值一起写入，放不下时整个参数都不写，不会留下半个参数
+    void appendArg(char type, const void *value, int len)
+    {
+        char arg[1 + 8];
+        arg[0] = type;
+        memcpy(arg + 1, value, len);
+        buffer_.append(arg, len + 1);
+    }
+    // 二进制模式下按固定宽度保存，long和long long都是8字节
+    template <typename Fixed, typename Integer>
+    void appendInteger(char type, Integer v)
+    {
+        Fixed value = v;
+        appendArg(type, &value, sizeof(value));
+    }
+    // 字符串放不下时截断
+    void appendString(const char *str, size_t len)
+    {
+        if (buffer_.avail() <= 4)
+            return;
+        if (len > buffer_.avail() - 4)
+            len = buffer_.avail() - 4;
+        char head[3] = {ARG_STRING, 0, 0};
+        uint16_t n = len;
+        memcpy(head + 1, &n, sizeof(n));
+        buffer_.append(head, sizeof(head));
+        buffer_.append(str, len);
+    }
+
     Buffer buffer_;
+    const bool binary_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,6 +4,8 @@
 #include "LogStream.h"
 #include "AsyncLogging.h"
 #include "noncopyable.h"
+#include <atomic>
+#include <stdint.h>
 
 class Logger: public noncopyable
 {
@@ -18,38 +20,60 @@ public:
         FATAL,
         NUM_LOG_LEVELS,
     };
-    Logger(const std::string &basename, int line, LogLevel level = INFO);
+    // 一个LOG_xxx调用点的静态信息，在编译时确定，二进制模式下第一次使用时分配编号并把定义写入日志
+    struct Site
+    {
+        const char *file;
+        int line;
+        LogLevel level;
+        std::atomic<uint32_t> id;   // 0表示还没有分配
+    };
+
+    explicit Logger(Site &site);
     ~Logger();
     LogStream &stream() {return impl_.stream_;}
     static LogLevel level() {return g_level_;}
+    // 日志文件的滚动、压缩、无损模式和二进制模式，必须在写第一条日志之前设置
+    // 二进制模式：只记录调用点编号、线程号和参数的原始字节，用log_decode转换成文本
+    static void setOptions(const AsyncLogging::Options &options);
+    static const AsyncLogging::Options &options() {return g_options_;}
+    static bool binary() {return g_binary_;}
+    static AsyncLogging *backend();   // 统计信息用，还没有写过日志时为空
 
 private:
     struct Impl
     {
-        Impl(const std::string &basename, int line, LogLevel level);
+        explicit Impl(Site &site);
         ~Impl();
 
         LogStream stream_;
-        const std::string basename_;
-        int line_;
-        LogLevel level_;
+        Site &site_;
+        int64_t timestamp_;     // 微秒，后端按它合并各个线程的日志
     };
 
     static LogLevel g_level_;
+    static bool g_binary_;
+    static AsyncLogging::Options g_options_;
     Impl impl_;
 };
 
-#define LOG_TRACE if (Logger::level() <= Logger::TRACE) \
-    Logger(__FILE__, __LINE__, Logger::TRACE).stream()
-#define LOG_DEBUG if (Logger::level() <= Logger::DEBUG) \
-    Logger(__FILE__, __LINE__, Logger::DEBUG).stream()
-#define LOG_INFO if (Logger::level() <= Logger::INFO) \
-    Logger(__FILE__, __LINE__).stream()
-#define LOG_WARN if (Logger::level() <= Logger::WARN) \
-    Logger(__FILE__, __LINE__, Logger::WARN).stream()
-#define LOG_ERROR if (Logger::level() <= Logger::ERROR) \
-    Logger(__FILE__, __LINE__, Logger::ERROR).stream()
-#define LOG_FATAL if (Logger::level() <= Logger::FATAL) \
-    Logger(__FILE__, __LINE__, Logger::FATAL).stream()
+// 每个调用点一个静态的Site，常量初始化，不需要运行时的保护
+#define LOG_SITE(level) ([]() -> Logger::Site & { \
+    static Logger::Site site = {__FILE__, __LINE__, level, {0}}; \
+    return site; }())
+
+// 写成只执行一次的for，宏里没有if，调用者的if-else不会和宏配对
+#define LOG_TRACE for (bool log_on_ = Logger::level() <= Logger::TRACE; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::TRACE)).stream()
+#define LOG_DEBUG for (bool log_on_ = Logger::level() <= Logger::DEBUG; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::DEBUG)).stream()
+#define LOG_INFO for (bool log_on_ = Logger::level() <= Logger::INFO; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::INFO)).stream()
+#define LOG_WARN for (bool log_on_ = Logger::level() <= Logger::WARN; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::WARN)).stream()
+#define LOG_ERROR for (bool log_on_ = Logger::level() <= Logger::ERROR; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::ERROR)).stream()
+#define LOG_FATAL for (bool log_on_ = Logger::level() <= Logger::FATAL; log_on_; log_on_ = false) \
+    Logger(LOG_SITE(Logger::FATAL)).stream()
 
 #endif
\ No newline at end of file
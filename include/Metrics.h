@@ -0,0 +1,133 @@
+// 运行时统计信息，GET /__stats以Prometheus文本格式输出
+#ifndef _METRICS_H
+#define _METRICS_H
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include "noncopyable.h"
+
+/*
+    每个线程一份计数器和延迟直方图，第一次使用时登记，读取时把所有线程的加起来：
+        计数器只由所属线程写，用relaxed原子变量的load加store，不需要带lock前缀的指令，也没有缓存行争用
+        连接数这样的增减可能发生在不同线程，分别记录打开和关闭的次数，读取时相减
+        线程退出后它的计数仍然保留，所以输出的计数器是单调增加的
+    延迟直方图是HDR风格的对数线性分桶（纳秒）：每个2的幂区间再分成8格，相对误差不超过12.5%
+        输出时按2的幂合并成Prometheus的histogram，并从细分的桶估计p50、p90、p99、p99.9
+    其他模块的状态（工作队列长度、定时器个数等）由addGauge()登记的函数在读取时计算，
+    其他模块自己累计的次数（缓存命中、日志丢弃等）用addCounter()登记，名字以_total结尾
+*/
+class Metrics: public noncopyable
+{
+public:
+    enum Stage
+    {
+        STAGE_QUEUE = 0,    // 任务在线程池工作队列中等待的时间，只有单Reactor模式有
+        STAGE_PARSE,        // 解析请求行、首部，POST还包括确认请求体收全
+        STAGE_HANDLER,      // 生成响应
+        STAGE_SEND,         // 响应排入队列到全部发送完，包括等待套接字可写
+        STAGE_NUM,
+    };
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_SHIFT = 37;     // 最大约2^40纳秒（18分钟），更大的值记在最后一格
+    static const int BUCKETS = SUB_BUCKETS + (MAX_SHIFT + 1) * SUB_BUCKETS;
+    static const int CODE_NUM = 7;       // 按状态码分别计数，最后一项是其他状态码
+
+    // 只由所属线程写的计数器
+    class Counter
+    {
+    public:
+        Counter(): v_(0) {}
+        void add(uint64_t n) {v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);}
+        uint64_t get() const {return v_.load(std::memory_order_relaxed);}
+    private:
+        std::atomic<uint64_t> v_;
+    };
+
+    struct ThreadMetrics
+    {
+        Counter accepts;
+        Counter closes;
+        Counter bytes_in;
+        Counter bytes_out;
+        Counter responses[CODE_NUM];
+        Counter latency[STAGE_NUM][BUCKETS];
+        Counter latency_sum[STAGE_NUM];    // 纳秒
+    };
+
+    static void setEnabled(bool enabled) {enabled_ = enabled;}
+    static bool enabled() {return enabled_;}
+
+    // 单调时钟（纳秒），关闭时返回0，之后的record()什么都不做，不读时钟
+    static int64_t now()
+    {
+        if (!enabled_)
+            return 0;
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+    static void record(Stage stage, int64_t start, int64_t end)
+    {
+        if (start == 0 || end < start)
+            return;
+        uint64_t ns = end - start;
+        ThreadMetrics &m = local();
+        m.latency[stage][bucketOf(ns)].add(1);
+        m.latency_sum[stage].add(ns);
+    }
+
+    static void connectionOpened() {local().accepts.add(1);}
+    static void connectionClosed() {local().closes.add(1);}
+    static void bytesIn(std::size_t n) {local().bytes_in.add(n);}
+    static void bytesOut(std::size_t n) {local().bytes_out.add(n);}
+    static void response(int status) {local().responses[codeIndex(status)].add(1);}
+
+    // 读取时计算的值，同名的多个函数（例如每个Reactor一个定时器）相加
+    static void addGauge(const std::string &name, const std::string &help, std::function<double()> fn);
+    // 和addGauge()一样，但fn返回的是只增不减的累计值，输出为counter类型
+    static void addCounter(const std::string &name, const std::string &help, std::function<double()> fn);
+    static std::string render();     // Prometheus文本格式
+    static int64_t activeConnections();   // 当前打开的连接数，平滑升级时据此判断旧进程是否处理完
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < static_cast<uint64_t>(SUB_BUCKETS))
+            return static_cast<int>(ns);
+        int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+        if (shift > MAX_SHIFT)
+            return BUCKETS - 1;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + static_cast<int>((ns >> shift) - SUB_BUCKETS);
+    }
+    static uint64_t bucketUpper(int bucket);    // 桶中最大值的下一个值
+
+private:
+    static ThreadMetrics &local()
+    {
+        static thread_local ThreadMetrics *t_metrics = nullptr;
+        if (!t_metrics)
+            t_metrics = registerThread();
+        return *t_metrics;
+    }
+    static ThreadMetrics *registerThread();
+    // 和HttpHeaders中的状态码表一致
+    static int codeIndex(int status)
+    {
+        switch (status)
+        {
+        case 200: return 0;
+        case 206: return 1;
+        case 304: return 2;
+        case 400: return 3;
+        case 404: return 4;
+        case 416: return 5;
+        default: return CODE_NUM - 1;
+        }
+    }
+
+    static bool enabled_;       // 在启动服务器之前设置
+};
+
+#endif
@@ -0,0 +1,265 @@
+// 固定大小内存块的池，用于频繁创建和销毁的连接对象
+#ifndef _OBJECTPOOL_H
+#define _OBJECTPOOL_H
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "Sync.h"
+#include "noncopyable.h"
+using std::shared_ptr;
+
+struct BlockPoolStats
+{
+    std::size_t block_size;
+    unsigned long slabs;          // 向系统申请的次数，每次BLOCK_BATCH块
+    unsigned long allocations;    // 累计分配的块数
+    unsigned long in_use;         // 正在使用的块数（近似值）
+    unsigned long refills;        // 线程缓存从全局链表取块的次数
+    unsigned long flushes;        // 线程缓存向全局链表归还的次数
+};
+
+// 所有BlockPool的登记表，只用于汇总统计信息
+class BlockPoolBase: public noncopyable
+{
+public:
+    static std::vector<BlockPoolStats> allStats();
+
+protected:
+    BlockPoolBase();
+    ~BlockPoolBase() {}
+    virtual BlockPoolStats stats() = 0;
+
+private:
+    static Locker &registryLocker();
+    static std::vector<BlockPoolBase *> &registry();
+};
+
+/*
+    每种大小一个池，每个线程一个缓存：
+        分配和释放都只操作本线程缓存的单链表，不加锁
+        缓存空了从全局链表取BLOCK_BATCH块（全局链表也空了就一次申请BLOCK_BATCH块）
+        缓存超过2*BLOCK_BATCH块时把BLOCK_BATCH块还给全局链表
+    单Reactor模式下任务在主线程分配、在工作线程释放，块经过全局链表回到主线程，每BLOCK_BATCH次才加一次锁
+    统计信息在线程缓存中累计，和全局链表交换时才汇总，所以会有不超过每个线程2*BLOCK_BATCH的滞后
+    申请的内存在进程退出前不还给系统，池的大小由同时存在的对象数的峰值决定
+*/
+template <std::size_t Size>
+class BlockPool: public BlockPoolBase
+{
+public:
+    static const std::size_t BLOCK_BATCH = 64;
+
+    static BlockPool &instance()
+    {
+        static BlockPool *pool = new BlockPool();   // 不析构，线程缓存在进程退出时可能还要归还块
+        return *pool;
+    }
+
+    void *allocate()
+    {
+        ThreadCache &cache = threadCache();
+        if (!cache.head)
+            refill(cache);
+        Block *block = cache.head;
+        cache.head = block->next;
+        --cache.count;
+        ++cache.allocations;
+        return block;
+    }
+
+    void deallocate(void *p)
+    {
+        ThreadCache &cache = threadCache();
+        Block *block = static_cast<Block *>(p);
+        block->next = cache.head;
+        cache.head = block;
+        ++cache.count;
+        ++cache.frees;
+        if (cache.count > 2 * BLOCK_BATCH)
+            flush(cache, BLOCK_BATCH);
+    }
+
+    BlockPoolStats stats() override
+    {
+        locker_.lock();
+        // 另一个线程释放的块可能先汇总，这时还没汇总的分配比释放少
+        unsigned long in_use = allocations_ > frees_ ? allocations_ - frees_ : 0;
+        BlockPoolStats st = {sizeof(Block), slabs_, allocations_, in_use, refills_, flushes_};
+        locker_.unlock();
+        return st;
+    }
+
+private:
+    union Block
+    {
+        Block *next;
+        alignas(std::max_align_t) char data[Size];
+    };
+
+    struct ThreadCache
+    {
+        Block *head = nullptr;
+        std::size_t count = 0;
+        unsigned long allocations = 0;
+        unsigned long frees = 0;
+        // 线程退出时把块全部还给全局链表
+        ~ThreadCache() {BlockPool::instance().flush(*this, count);}
+    };
+
+    BlockPool(): free_(nullptr), slabs_(0), allocations_(0), frees_(0), refills_(0), flushes_(0) {}
+
+    static ThreadCache &threadCache()
+    {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    void refill(ThreadCache &cache)
+    {
+        locker_.lock();
+        _collect(cache);
+        ++refills_;
+        if (!free_)
+        {
+            // 申请失败时抛出std::bad_alloc，和new的行为一致
+            Block *slab;
+            try
+            {
+                slab = static_cast<Block *>(::operator new(sizeof(Block) * BLOCK_BATCH));
+            }
+            catch (...)
+            {
+                locker_.unlock();
+                throw;
+            }
+            for (std::size_t i = 0; i < BLOCK_BATCH; ++i)
+                slab[i].next = i + 1 < BLOCK_BATCH ? &slab[i + 1] : nullptr;
+            free_ = slab;
+            ++slabs_;
+        }
+        for (std::size_t i = 0; i < BLOCK_BATCH && free_; ++i)
+        {
+            Block *block = free_;
+            free_ = block->next;
+            block->next = cache.head;
+            cache.head = block;
+            ++cache.count;
+        }
+        locker_.unlock();
+    }
+
+    void flush(ThreadCache &cache, std::size_t n)
+    {
+        Block *first = cache.head, *last = nullptr;
+        std::size_t moved = 0;
+        while (moved < n && cache.head)
+        {
+            last = cache.head;
+            cache.head = last->next;
+            ++moved;
+        }
+        cache.count -= moved;
+        locker_.lock();
+        _collect(cache);
+        if (last)
+        {
+            last->next = free_;
+            free_ = first;
+        }
+        ++flushes_;
+        locker_.unlock();
+    }
+
+    // 把线程缓存中累计的计数汇总到全局，调用时持有锁
+    void _collect(ThreadCache &cache)
+    {
+        allocations_ += cache.allocations;
+        frees_ += cache.frees;
+        cache.allocations = cache.frees = 0;
+    }
+
+    Locker locker_;
+    Block *free_;              // 全局链表
+    unsigned long slabs_;
+    unsigned long allocations_;
+    unsigned long frees_;
+    unsigned long refills_;
+    unsigned long flushes_;
+};
+
+/*
+    从BlockPool分配的分配器，单个对象从池中分配，数组（n > 1）直接用::operator new
+    配合std::allocate_shared使用时，对象和引用计数在同一块内存中，一次分配
+*/
+template <typename U>
+class PoolAllocator
+{
+public:
+    using value_type = U;
+    static_assert(alignof(U) <= alignof(std::max_align_t), "over-aligned type");
+
+    PoolAllocator() {}
+    template <typename V>
+    PoolAllocator(const PoolAllocator<V> &) {}
+
+    U *allocate(std::size_t n)
+    {
+        if (n == 1)
+            return static_cast<U *>(BlockPool<sizeof(U)>::instance().allocate());
+        return static_cast<U *>(::operator new(n * sizeof(U)));
+    }
+
+    void deallocate(U *p, std::size_t n)
+    {
+        if (n == 1)
+            BlockPool<sizeof(U)>::instance().deallocate(p);
+        else
+            ::operator delete(p);
+    }
+};
+
+template <typename U, typename V>
+bool operator==(const PoolAllocator<U> &, const PoolAllocator<V> &) {return true;}
+template <typename U, typename V>
+bool operator!=(const PoolAllocator<U> &, const PoolAllocator<V> &) {return false;}
+
+// 对象和控制块一起从池中分配的shared_ptr
+template <typename T, typename... Args>
+shared_ptr<T> makePooled(Args&&... args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+/* ****************BlockPoolBase的定义********************* */
+inline BlockPoolBase::BlockPoolBase()
+{
+    registryLocker().lock();
+    registry().push_back(this);
+    registryLocker().unlock();
+}
+
+inline Locker &BlockPoolBase::registryLocker()
+{
+    static Locker *locker = new Locker();
+    return *locker;
+}
+
+inline std::vector<BlockPoolBase *> &BlockPoolBase::registry()
+{
+    static std::vector<BlockPoolBase *> *pools = new std::vector<BlockPoolBase *>();
+    return *pools;
+}
+
+inline std::vector<BlockPoolStats> BlockPoolBase::allStats()
+{
+    std::vector<BlockPoolStats> result;
+    registryLocker().lock();
+    for (BlockPoolBase *pool : registry())
+        result.push_back(pool->stats());
+    registryLocker().unlock();
+    return result;
+}
+
+#endif
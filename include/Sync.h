@@ -1,9 +1,14 @@
-// 封装 互斥锁、条件变量、信号量
+// 封装 互斥锁、条件变量、信号量、事件计数器
 #ifndef _SYNC_H
 #define _SYNC_H
 #include <pthread.h>
 #include <semaphore.h>
 #include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
 
 class Locker
 {
@@ -73,4 +78,49 @@ private:
 };
 
 
-#endif
\ No newline at end of file
+/*
+    事件计数器（eventcount），配合无锁队列让空闲线程睡眠，基于futex
+    等待方：
+        int key = ec.prepareWait();
+        if (条件已满足) ec.cancelWait();
+        else ec.wait(key);
+    通知方先让条件满足，再调用notify()。没有线程等待时notify()不进入内核
+*/
+class EventCount
+{
+public:
+    EventCount(): epoch_(0), waiters_(0) {}
+
+    int prepareWait()
+    {
+        waiters_.fetch_add(1);
+        return epoch_.load();
+    }
+
+    void cancelWait() {waiters_.fetch_sub(1);}
+
+    void wait(int key)
+    {
+        while (epoch_.load() == key)
+            syscall(SYS_futex, reinterpret_cast<int *>(&epoch_), FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+        waiters_.fetch_sub(1);
+    }
+
+    void notify() {wake(1);}
+
+    void notifyAll() {wake(INT_MAX);}
+
+private:
+    void wake(int n)
+    {
+        epoch_.fetch_add(1);
+        if (waiters_.load() > 0)
+            syscall(SYS_futex, reinterpret_cast<int *>(&epoch_), FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+
+    std::atomic<int> epoch_;
+    std::atomic<int> waiters_;
+};
+
+
+#endif
@@ -6,8 +6,12 @@
 #include <list>
 #include <memory>
 #include <iostream>
+#include <atomic>
 #include "Sync.h"
+#include "LockFreeQueue.h"
 #include "Logging.h"
+#include "Metrics.h"
+#include "Affinity.h"
 using std::vector;
 using std::list;
 using std::shared_ptr;
@@ -19,12 +23,18 @@ enum ThreadPoolError {
     THREAD_CREATING_ERROR
 };
 
+/*
+    工作队列有两种实现：
+        1. 互斥锁 + 条件变量 + std::list（默认）
+        2. 有界无锁环形队列 + 事件计数器（lockfree为true），入队出队不加锁、不分配内存，
+           空闲线程在futex上睡眠，没有线程睡眠时通知不进入内核
+*/
 template <typename T>
 class ThreadPool
 {
     using SP_Task = shared_ptr<T>;
 private:
-    bool stop_;
+    std::atomic<bool> stop_;
     int threadNum_;    // 线程数
     int started_;      // 当前正在运行的线程数
     int maxQueue_;      // 工作队列中最大等待个数
@@ -32,14 +42,20 @@ private:
     list<SP_Task> workqueue_;    // 工作队列
     Locker locker_;
     Conditon cond_;
-    static void *run(void *arg);   // 工作线程运行函数
-    ThreadPool(int n, int maxq);    // 构造函数，私有
+    std::unique_ptr<LockFreeQueue<SP_Task>> ring_;   // 无锁工作队列，为空时使用workqueue_
+    EventCount ec_;
+    static void *run(void *);   // 工作线程运行函数
+    void runLockFree();
+    ThreadPool(int n, int maxq, bool lockfree);    // 构造函数，私有
     void wait_threads();   // 等待所有子线程退出
     static weak_ptr<ThreadPool<T>> pool_;   // 静态指针，指向单例模式的唯一线程池
 
 public:
-    static shared_ptr<ThreadPool<T>> CreateThreadPool(int n, int maxq);   // 工厂函数
+    // 工厂函数，cpus[i]是第i个工作线程绑定的CPU，不够n个时后面的线程不绑定
+    static shared_ptr<ThreadPool<T>> CreateThreadPool(int n, int maxq, bool lockfree = false,
+                                                      const vector<int> &cpus = vector<int>());
     bool addTask(SP_Task task);
+    std::size_t queueSize();    // 工作队列中等待的任务数
     void shutdown();    // 结束，退出所有线程
     ThreadPool() = delete;
     ThreadPool(const ThreadPool &) = delete;
@@ -52,14 +68,14 @@ weak_ptr<ThreadPool<T>> ThreadPool<T>::pool_;
 
 
 template <typename T>
-ThreadPool<T>::ThreadPool(int n, int maxq):
-    stop_(false), threadNum_(n), started_(0), threads_(n,0),
-    maxQueue_(maxq), locker_(), cond_(locker_){}
+ThreadPool<T>::ThreadPool(int n, int maxq, bool lockfree):
+    stop_(false), threadNum_(n), started_(0), maxQueue_(maxq), threads_(n,0),
+    locker_(), cond_(locker_), ring_(lockfree ? new LockFreeQueue<SP_Task>(maxq) : nullptr){}
 
 
 // 工厂函数，创建线程池
 template <typename T>
-shared_ptr<ThreadPool<T>> ThreadPool<T>::CreateThreadPool(int n, int maxq)  // 线程数量和工作队列最大长度
+shared_ptr<ThreadPool<T>> ThreadPool<T>::CreateThreadPool(int n, int maxq, bool lockfree, const vector<int> &cpus)  // 线程数量、工作队列最大长度、是否使用无锁队列、绑定的CPU
 {
     if (pool_.lock())
         return nullptr;
@@ -67,7 +83,7 @@ shared_ptr<ThreadPool<T>> ThreadPool<T>::CreateThreadPool(int n, int maxq)  // 
     shared_ptr<ThreadPool> sp(nullptr);
     try
     {
-        sp.reset(new ThreadPool(n, maxq));
+        sp.reset(new ThreadPool(n, maxq, lockfree));
         pool_ = sp;
     }
     catch (const std::bad_alloc &e)
@@ -78,13 +94,19 @@ shared_ptr<ThreadPool<T>> ThreadPool<T>::CreateThreadPool(int n, int maxq)  // 
 
     for (int i = 0; i < n; ++i)
     {
-        if (pthread_create(&(sp->threads_[i]), NULL, run, NULL) != 0)
+        int cpu = i < static_cast<int>(cpus.size()) ? cpus[i] : -1;
+        if (Affinity::createThread(&(sp->threads_[i]), cpu, run, NULL) != 0)
         {
             sp->shutdown();
             return nullptr;
         }
         ++sp->started_;
     }
+    weak_ptr<ThreadPool<T>> weak = sp;
+    Metrics::addGauge("threadpool_queue_depth", "Tasks waiting in the thread pool work queue.", [weak]() {
+        auto pool = weak.lock();
+        return pool ? static_cast<double>(pool->queueSize()) : 0.0;
+    });
     return pool_.lock();
 }
 
@@ -93,16 +115,22 @@ shared_ptr<ThreadPool<T>> ThreadPool<T>::CreateThreadPool(int n, int maxq)  // 
 template <typename T>
 bool ThreadPool<T>::addTask(SP_Task task)
 {
-    if (workqueue_.size() >= maxQueue_)
-        return false;
-    
+    task->markQueued(Metrics::now());
+    if (ring_)
+    {
+        if (stop_ || !ring_->push(std::move(task)))
+            return false;
+        ec_.notify();
+        return true;
+    }
+
     locker_.lock();
-    if (stop_)
+    if (stop_ || workqueue_.size() >= static_cast<std::size_t>(maxQueue_))
     {
         locker_.unlock();
         return false;
     }
-    workqueue_.push_back(task);
+    workqueue_.push_back(std::move(task));
     locker_.unlock();
     cond_.signal();
     return true;
@@ -111,11 +139,16 @@ bool ThreadPool<T>::addTask(SP_Task task)
 
 // 工作线程运行函数
 template <typename T>
-void *ThreadPool<T>::run(void *arg)
+void *ThreadPool<T>::run(void *)
 {
     auto sp = pool_.lock();
     if (!sp)
         return NULL;
+    if (sp->ring_)
+    {
+        sp->runLockFree();
+        return NULL;
+    }
     while (!sp->stop_)
     {
         sp->locker_.lock();
@@ -128,6 +161,7 @@ void *ThreadPool<T>::run(void *arg)
         SP_Task task = sp->workqueue_.front();
         sp->workqueue_.pop_front();
         sp->locker_.unlock();
+        Metrics::record(Metrics::STAGE_QUEUE, task->queuedAt(), Metrics::now());
         task->process();
     }
 
@@ -136,14 +170,56 @@ void *ThreadPool<T>::run(void *arg)
     return NULL;
 }
 
+// 无锁队列的工作线程，队列为空时在事件计数器上睡眠
+template <typename T>
+void ThreadPool<T>::runLockFree()
+{
+    SP_Task task;
+    while (!stop_)
+    {
+        if (ring_->pop(task))
+        {
+            Metrics::record(Metrics::STAGE_QUEUE, task->queuedAt(), Metrics::now());
+            task->process();
+            task.reset();
+            continue;
+        }
+        int key = ec_.prepareWait();
+        if (stop_ || ring_->pop(task))
+        {
+            ec_.cancelWait();
+            if (task)
+            {
+                Metrics::record(Metrics::STAGE_QUEUE, task->queuedAt(), Metrics::now());
+                task->process();
+                task.reset();
+            }
+            continue;
+        }
+        ec_.wait(key);
+    }
+    locker_.lock();
+    --started_;
+    locker_.unlock();
+}
+
+// 可以多次调用（例如排空时收到SIGTERM），只有第一次等待线程退出，同一个线程不会被join两次
 template <typename T>
 void ThreadPool<T>::shutdown()
 {
+    vector<pthread_t> threads;
     locker_.lock();
+    if (stop_)
+    {
+        locker_.unlock();
+        return;
+    }
     stop_ = true;
+    threads.swap(threads_);
     locker_.unlock();
     cond_.broadcast();
-    for (auto tid : threads_)
+    ec_.notifyAll();
+    for (auto tid : threads)
     {
         if (tid == 0)
             break;
@@ -152,6 +228,17 @@ void ThreadPool<T>::shutdown()
     }
 }
 
+template <typename T>
+std::size_t ThreadPool<T>::queueSize()
+{
+    if (ring_)
+        return ring_->size();
+    locker_.lock();
+    std::size_t n = workqueue_.size();
+    locker_.unlock();
+    return n;
+}
+
 template <typename T>
 bool ThreadPool<T>::isStop() const
 {
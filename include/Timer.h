@@ -1,240 +1,313 @@
 // 定义定时器
 #ifndef _TIMER_H
 #define _TIMER_H
-#include <sys/time.h>
+#include <time.h>
+#include <stdint.h>
 #include <memory>
-#include <queue>
 #include <vector>
+#include <iostream>
+#include <arpa/inet.h>
 #include "Sync.h"
+#include "noncopyable.h"
 #include "Logging.h"
+#include "Metrics.h"
 using std::shared_ptr;
-using std::weak_ptr;
 
-template <typename T> class Epoll;  // 前向声明
+template <typename T> class TimerManager;  // 前向声明
 
+const int TIMER_TICK_MS = 50;        // 时间轮每一格的时间（毫秒），即定时器的精度
+const int TIMER_WHEEL_SLOTS = 256;   // 时间轮的格数，转一圈是12.8s，更长的定时器要转多圈
+
+// 拥有时间轮的事件循环（Epoll或Uring）需要提供的操作
 template <typename T>
-class TimerNode
+class TimerOwner
 {
-    using SP_Task = shared_ptr<T>;
-    using SP_Epoll = shared_ptr<Epoll<T>>;
 public:
-    TimerNode() = delete;
-    TimerNode(const TimerNode &) = delete;               // 禁止拷贝构造
-    TimerNode &operator=(const TimerNode &) = delete;    // 禁止拷贝赋值
-    TimerNode(SP_Task task, int timeout);   // 构造函数，需要传入任务指针和计时时间（毫秒）
-    ~TimerNode();
-    time_t getExpTime() const;     // 返回超时时间
-    void setDeleted();             // 将定时器设为删除的
-    void separate();               // 将定时器和任务分离
-    bool isVaild();                // 验证定时器是否有效，如果已经超时，则设为删除的
-    static void setEpoll(SP_Epoll epoll);    // 静态函数，设置epoll_
-
-private:
-    bool deleted;
-    time_t expired_time_;
-    SP_Task task_;
-    static SP_Epoll epoll_;
+    virtual void wakeup() = 0;                  // 新的定时器比事件循环等待的时间早，唤醒它重新计算超时时间
+    virtual void closeConnection(int fd) = 0;   // 定时器超时，关闭连接
+protected:
+    ~TimerOwner() {}
 };
 
-template <typename T> 
-shared_ptr<Epoll<T>> TimerNode<T>::epoll_(nullptr);
-
-// 仿函数，用于在优先队列中对定时器进行排序
+// 定时器节点，直接嵌入在任务对象中，刷新定时器时原地移动，不需要分配内存
 template <typename T>
-struct CmpTimer
+class TimerNode: public noncopyable
 {
-    using SP_Timer = shared_ptr<TimerNode<T>>;
-    bool operator()(const SP_Timer &t1, const SP_Timer &t2)
-    {
-        return t1->getExpTime() > t2->getExpTime();
-    }
+    friend class TimerManager<T>;
+public:
+    explicit TimerNode(T *task = nullptr): task_(task), prev_(nullptr), next_(nullptr), expire_tick_(0) {}
+    bool isLinked() const {return prev_ != nullptr;}   // 是否在时间轮中
+
+private:
+    T *task_;             // 所属的任务，时间轮的表头为nullptr
+    std::weak_ptr<T> weak_task_;   // 第一次挂上时记下，超时时用它取得任务，不对正在析构的任务调用shared_from_this()
+    TimerNode *prev_;     // 时间轮每一格是带表头的双向循环链表
+    TimerNode *next_;
+    uint64_t expire_tick_;   // 在第几格超时
 };
 
 
-// 管理定时器队列，单例模式
+/*
+    哈希时间轮，每个事件循环一个
+    定时器按超时的格数挂在 expire_tick % TIMER_WHEEL_SLOTS 格上，添加、刷新、删除都是O(1)
+    事件循环根据nextTimeout()等到最近的非空格，每次返回后调用handleExpired()，
+    走过的每一格中已经到期的定时器被移除，对应的连接被关闭，没到期的（要转多圈的）留在原地
+
+    任务和计时器对象的生命周期：
+        任务对象的智能指针只存在于Epoll的fd2task中（处理时工作线程中还有一个），定时器不拥有任务
+        定时器超时时，时间轮先摘下节点并用节点中的weak_ptr取得任务，解锁后调用closeConnection()，
+        fd2task中的指针被清空后任务对象析构
+        任务收到新消息时调用delTimer()摘下节点，处理完后用addTimer()重新挂上
+        任务对象析构时必须调用delTimer()，保证时间轮中不会留下悬空的节点
+*/
 template <typename T>
 class TimerManager
 {
     using SP_Task = shared_ptr<T>;
-    using SP_Timer = shared_ptr<TimerNode<T>>;
     using SP_Self = shared_ptr<TimerManager<T>>;
-    using WP_Self = weak_ptr<TimerManager<T>>;
 public:
-    static SP_Self CreateTimerManager(shared_ptr<Epoll<T>> epoll);  // 工厂函数
-    bool addTimer(SP_Task task, int timeout);
+    static SP_Self CreateTimerManager(TimerOwner<T> *owner);  // 工厂函数
+    bool addTimer(T *task, int timeout);   // 添加或刷新定时器（毫秒），timeout < 0时不设置
+    void delTimer(T *task);
+    void shorten(int timeout);   // 把所有更晚超时的定时器提前到timeout毫秒后，平滑升级时用来关闭空闲连接
     void handleExpired();
+    int nextTimeout();       // 距离最近的非空格还有多少毫秒，没有定时器时返回-1
+    std::size_t size();      // 时间轮中的定时器个数
 
 private:
-    TimerManager() = default;
+    explicit TimerManager(TimerOwner<T> *owner);
     TimerManager(const TimerManager &) = delete;
     TimerManager &operator=(const TimerManager &) = delete;
+    static uint64_t nowMs();
+    void link(TimerNode<T> *node);
+    static void unlink(TimerNode<T> *node);
 
     Locker locker_;
-    std::priority_queue<SP_Timer, std::vector<SP_Timer>, CmpTimer<T>> timer_queue_;
-    static WP_Self manager_;
+    TimerNode<T> wheel_[TIMER_WHEEL_SLOTS];    // 每一格的表头
+    uint64_t current_tick_;              // 已经处理到的格数
+    uint64_t wake_tick_;                 // 事件循环最晚在这一格醒来，更早的定时器需要唤醒它
+    std::size_t count_;
+    TimerOwner<T> *owner_;      // 拥有TimerManager的事件循环，生命周期更长
 };
 
-template <typename T>
-weak_ptr<TimerManager<T>> TimerManager<T>::manager_;
-
 /* ****************成员函数定义部分********************* */
 template <typename T>
-TimerNode<T>::TimerNode(SP_Task task, int timeout): task_(task), deleted(false)
+TimerManager<T>::TimerManager(TimerOwner<T> *owner):
+    current_tick_(nowMs() / TIMER_TICK_MS), wake_tick_(UINT64_MAX), count_(0), owner_(owner)
 {
-    timeval now;
-    gettimeofday(&now, NULL);
-    expired_time_ = now.tv_sec * 1000 + now.tv_usec / 1000 + timeout;
+    for (auto &head : wheel_)
+        head.prev_ = head.next_ = &head;
 }
 
 template <typename T>
-TimerNode<T>::~TimerNode()
+shared_ptr<TimerManager<T>> TimerManager<T>::CreateTimerManager(TimerOwner<T> *owner)
 {
-    if (task_)
+    SP_Self sp(nullptr);
+    try
     {
-        LOG_INFO << "timeout, socket: " << task_->getsock() << " ip: " << inet_ntoa(task_->getaddr().sin_addr);
-        epoll_->epoll_del(task_->getsock());
+        sp.reset(new TimerManager(owner));
     }
+    catch(const std::bad_alloc &e)
+    {
+        std::cerr << "malloc error: " << e.what() << std::endl;
+        return nullptr;
+    }
+    // 每个事件循环一个时间轮，输出时相加
+    std::weak_ptr<TimerManager<T>> weak = sp;
+    Metrics::addGauge("timers", "Timers pending in the timing wheels.", [weak]() {
+        auto tm = weak.lock();
+        return tm ? static_cast<double>(tm->size()) : 0.0;
+    });
+    return sp;
 }
 
+// 单调时钟，精度几毫秒，不需要陷入内核
 template <typename T>
-time_t TimerNode<T>::getExpTime() const
+uint64_t TimerManager<T>::nowMs()
 {
-    return expired_time_;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
 }
 
 template <typename T>
-void TimerNode<T>::setDeleted()
+void TimerManager<T>::link(TimerNode<T> *node)
 {
-    deleted = true;
+    TimerNode<T> &head = wheel_[node->expire_tick_ % TIMER_WHEEL_SLOTS];
+    node->prev_ = head.prev_;
+    node->next_ = &head;
+    head.prev_->next_ = node;
+    head.prev_ = node;
 }
 
 template <typename T>
-void TimerNode<T>::separate()
+void TimerManager<T>::unlink(TimerNode<T> *node)
 {
-    if (task_)
-        task_.reset();
-    setDeleted();
+    node->prev_->next_ = node->next_;
+    node->next_->prev_ = node->prev_;
+    node->prev_ = node->next_ = nullptr;
 }
 
 template <typename T>
-bool TimerNode<T>::isVaild()
+bool TimerManager<T>::addTimer(T *task, int timeout)
 {
-    if (deleted)
-        return false;
-    timeval now;
-    gettimeofday(&now, NULL);
-    time_t nowtime = now.tv_sec * 1000 + now.tv_usec / 1000;
-    if (nowtime < expired_time_)
+    // 如果timeout < 0，就是不设置计时器
+    if (timeout < 0)
         return true;
-    // 如果计时器到期了，需要将其与任务解耦
+
+    TimerNode<T> *node = &task->timerNode();
+    uint64_t expire_tick = (nowMs() + timeout + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    // 只有任务自己会添加定时器，这时它一定还被智能指针持有
+    if (node->weak_task_.expired())
+        node->weak_task_ = task->shared_from_this();
+
+    locker_.lock();
+    if (node->isLinked())
+        unlink(node);
     else
-    {
-        setDeleted();
-        if (task_)
-            task_->separateTimer();
-        return false;
-    }
+        ++count_;
+    // 已经走过的格不会再处理，放到下一格
+    node->expire_tick_ = expire_tick > current_tick_ ? expire_tick : current_tick_ + 1;
+    link(node);
+    bool wake = node->expire_tick_ < wake_tick_;
+    if (wake)
+        wake_tick_ = node->expire_tick_;
+    locker_.unlock();
+
+    // 事件循环可能正在等待更晚的格（时间轮为空时是无限期），唤醒它重新计算超时时间
+    if (wake)
+        owner_->wakeup();
+    return true;
 }
 
 template <typename T>
-void TimerNode<T>::setEpoll(SP_Epoll epoll)
+void TimerManager<T>::delTimer(T *task)
 {
-    epoll_ = epoll;
+    TimerNode<T> *node = &task->timerNode();
+    locker_.lock();
+    if (node->isLinked())
+    {
+        unlink(node);
+        --count_;
+    }
+    locker_.unlock();
 }
 
-
-/* -------------------分割线-----------------------*/
-
-
+// 先把要移动的节点摘下来再挂到新的格上，避免遍历时又遇到刚挂上的节点
 template <typename T>
-shared_ptr<TimerManager<T>> TimerManager<T>::CreateTimerManager(shared_ptr<Epoll<T>> epoll)
+void TimerManager<T>::shorten(int timeout)
 {
-    if (manager_.lock())
-        return nullptr;
-    
-    SP_Self sp(nullptr);
-    try
+    uint64_t expire_tick = (nowMs() + timeout + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    std::vector<TimerNode<T> *> moved;
+    locker_.lock();
+    if (expire_tick <= current_tick_)
+        expire_tick = current_tick_ + 1;
+    for (auto &head : wheel_)
     {
-        sp.reset(new TimerManager());
-        manager_ = sp;
+        TimerNode<T> *node = head.next_;
+        while (node != &head)
+        {
+            TimerNode<T> *next = node->next_;
+            if (node->expire_tick_ > expire_tick)
+            {
+                unlink(node);
+                moved.push_back(node);
+            }
+            node = next;
+        }
     }
-    catch(const std::bad_alloc &e)
+    for (TimerNode<T> *node : moved)
     {
-        std::cerr << "malloc error: " << e.what() << std::endl;
-        return nullptr;
+        node->expire_tick_ = expire_tick;
+        link(node);
     }
+    bool wake = !moved.empty() && expire_tick < wake_tick_;
+    if (wake)
+        wake_tick_ = expire_tick;
+    locker_.unlock();
 
-    TimerNode<T>::setEpoll(epoll);   // 设置TimerNode中的静态成员
-    return manager_.lock();
+    if (wake)
+        owner_->wakeup();
 }
 
 template <typename T>
-bool TimerManager<T>::addTimer(SP_Task task, int timeout)
+void TimerManager<T>::handleExpired()
 {
-    // 如果timeout < 0，就是不设置计时器
-    if (timeout < 0)
-        return true;
+    uint64_t now_tick = nowMs() / TIMER_TICK_MS;
+    std::vector<SP_Task> expired;
 
-    // 先创建一个新的TimerNode节点
-    SP_Timer new_timer(nullptr);
-    try
+    locker_.lock();
+    if (now_tick <= current_tick_)
     {
-        new_timer.reset(new TimerNode<T>(task, timeout));
+        locker_.unlock();
+        return;
     }
-    catch(const std::bad_alloc &e)
+    // 落后超过一圈时，每一格只需要处理一次
+    uint64_t first = current_tick_ + 1;
+    if (now_tick - current_tick_ > static_cast<uint64_t>(TIMER_WHEEL_SLOTS))
+        first = now_tick - TIMER_WHEEL_SLOTS + 1;
+    for (uint64_t tick = first; tick <= now_tick && count_ > 0; ++tick)
     {
-        std::cerr << "TimerNode Creating failed: " << e.what() << '\n';
-        return false;
+        TimerNode<T> &head = wheel_[tick % TIMER_WHEEL_SLOTS];
+        TimerNode<T> *node = head.next_;
+        while (node != &head)
+        {
+            TimerNode<T> *next = node->next_;
+            if (node->expire_tick_ <= now_tick)
+            {
+                unlink(node);
+                --count_;
+                // 线程池模式下任务可能正在其他线程中析构（阻塞在delTimer()上），这时不需要再关闭
+                SP_Task task = node->weak_task_.lock();
+                if (task)
+                    expired.push_back(std::move(task));
+            }
+            node = next;
+        }
     }
-
-    // 然后把定时器指针添加到优先队列中
-    locker_.lock();
-    timer_queue_.push(new_timer);
+    current_tick_ = now_tick;
     locker_.unlock();
 
-    // 将计时器与任务关联
-    task->linkTimer(new_timer);
-
-    return true;
+    // 解锁后再关闭连接，任务析构时会调用delTimer()
+    for (auto &task : expired)
+    {
+        LOG_INFO << "timeout, socket: " << task->getsock() << " ip: " << inet_ntoa(task->getaddr().sin_addr);
+        owner_->closeConnection(task->getsock());
+    }
 }
 
-
-/*
-任务和计时器对象的生命周期：
-    在以下两个地方存在任务对象的智能指针：
-        1. Epoll类中有fd2task[]
-        2. TimerNode计时器对象中
-    
-    在以下两个地方存在计时器对象的智能指针：
-        1. 计时器队列timer_queue_
-        2. 任务对象中 （task->linkTimer(new_timer);）
-
-    销毁一个计时器对象的两种方式：
-        1. 计时器超时
-            执行isVaild()函数时，如果发现超时，则从任务对象中删除该计时器的指针（单向分离），然后从timer_queue_中pop，
-            于是计时器智能指针的引用为0,执行计时器对象的析构函数。在析构函数中，删除fd2task[]中的任务对象指针，
-            然后自身析构。此时任务对象的智能指针的引用为0,删除任务对象
-        2. 任务对象收到新消息
-            任务对象和计时器双向分离，计时器设置deleted，以后的某个时间从timer_queue_中pop，于是计时器智能指针的引用为0,
-            执行计时器对象的析构函数。在析构函数中，由于已经双向分离，所以无法从fd2task[]中的任务对象指针，所以只析构计时器对象，
-            任务对象依旧存在。
-*/
+// 时间轮不为空时一圈之内一定有非空的格；这一格里可能只有要转多圈的定时器，那样只是提前醒来一次
 template <typename T>
-void TimerManager<T>::handleExpired()
+int TimerManager<T>::nextTimeout()
 {
     locker_.lock();
-    while (!timer_queue_.empty())
+    if (count_ == 0)
     {
-        auto &node = timer_queue_.top();
-        if (node->isVaild())
+        wake_tick_ = UINT64_MAX;
+        locker_.unlock();
+        return -1;
+    }
+    uint64_t tick = current_tick_ + 1;
+    for (int i = 1; i < TIMER_WHEEL_SLOTS; ++i, ++tick)
+    {
+        const TimerNode<T> &head = wheel_[tick % TIMER_WHEEL_SLOTS];
+        if (head.next_ != &head)
             break;
-        else
-        {
-            timer_queue_.pop();
-            // std::cout << "删除定时器" << std::endl;
-        }
     }
+    wake_tick_ = tick;
+    locker_.unlock();
+    uint64_t now = nowMs();
+    uint64_t next = tick * TIMER_TICK_MS;
+    return next > now ? static_cast<int>(next - now) : 0;
+}
+
+template <typename T>
+std::size_t TimerManager<T>::size()
+{
+    locker_.lock();
+    std::size_t n = count_;
     locker_.unlock();
+    return n;
 }
 
-#endif
\ No newline at end of file
+#endif
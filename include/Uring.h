@@ -0,0 +1,603 @@
+// 基于io_uring的事件循环
+#ifndef _URING_H
+#define _URING_H
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "IoUring.h"
+#include "ConnectionTable.h"
+#include "ObjectPool.h"
+#include "Timer.h"
+#include "Utils.h"
+#include "Logging.h"
+using std::shared_ptr;
+using std::vector;
+
+const unsigned URING_ENTRIES = 4096;         // 提交队列的大小
+const unsigned URING_BUFFER_NUM = 1024;      // 接收用的provided buffer个数，必须是2的幂
+const unsigned URING_BUFFER_SIZE = 16384;    // 每个provided buffer的大小
+const std::size_t URING_FILE_CHUNK = 65536;  // 大文件每次读取并发送的字节数
+const int URING_MAX_IOV = 16;                // 一次sendmsg最多合并的分段数
+
+/*
+    完成模式的Reactor，每个线程一个，自己监听端口（多个时用SO_REUSEPORT）：
+        accept：一个多次触发的accept请求接受所有新连接
+        接收：每个连接一个多次触发的recv请求，数据由内核写入provided buffer ring中挑选的缓冲区，
+             交给任务的onReceive()后立即归还，等待数据的连接不占用缓冲区
+        发送：任务排队的响应用sendmsg一次发出；不在缓存中的文件用链接在一起的read和send分块发送
+        每轮事件循环中产生的所有请求在下一次io_uring_enter()时一起提交，同时等待完成项，
+        所以一个请求通常只需要一次系统调用，不再需要epoll_wait、recv、send和epoll_ctl
+    连接关闭时先shutdown()，等该连接所有未完成的请求都返回后才释放任务对象（同时关闭套接字），
+    保证文件描述符在内核还在使用时不会被复用
+*/
+template <typename T>
+class Uring: public TimerOwner<T>
+{
+    using SP_Task = shared_ptr<T>;
+    using SP_Self = shared_ptr<Uring<T>>;
+    using SP_TimerManager = shared_ptr<TimerManager<T>>;
+    using SP_ConnTable = shared_ptr<ConnectionTable<T>>;
+public:
+    // listenfd由Uring负责关闭，内核不支持io_uring或需要的功能时返回nullptr，调用者应改用epoll
+    static SP_Self CreateUring(SP_ConnTable conns, int listenfd, int timeout);
+    void loop();      // 事件循环，直到调用quit()
+    void quit();      // 可以在其他线程调用
+    void drain();     // 取消accept，并让空闲连接按新连接的超时时间关闭，可以在其他线程调用
+    void wakeup() override;
+    void closeConnection(int fd) override;
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+    ~Uring();
+
+private:
+    enum OpType {OP_ACCEPT = 1, OP_WAKEUP, OP_RECV, OP_SEND, OP_FILE_READ, OP_FILE_SEND, OP_CANCEL};
+
+    // 每个连接在本Reactor中的状态
+    struct Connection
+    {
+        Connection(): task(), inflight(0), recv_armed(false), sending(false), closing(false),
+                      file_error(false), file_chunk(0) {}
+        SP_Task task;
+        int inflight;        // 还没有返回的请求数
+        bool recv_armed;     // 多次触发的recv是否还有效
+        bool sending;        // 同一时间只有一个发送请求，保证响应的顺序
+        bool closing;
+        bool file_error;     // 读取文件失败或读到的字节不够，链接的send会被取消
+        std::size_t file_chunk;
+        struct iovec iov[URING_MAX_IOV];
+        struct msghdr msg;
+        std::unique_ptr<char[]> file_buf;   // 发送不在缓存中的文件时才分配
+
+        // 和任务一样从内存池分配
+        static void *operator new(std::size_t) {return BlockPool<sizeof(Connection)>::instance().allocate();}
+        static void operator delete(void *p) {BlockPool<sizeof(Connection)>::instance().deallocate(p);}
+    };
+
+    static uint64_t encode(int fd, OpType op) {return (static_cast<uint64_t>(fd) << 8) | op;}
+
+    Uring(shared_ptr<IoUring> ring, SP_ConnTable conns, int listenfd, int timeout);
+    bool init();
+    void handleCompletion(uint64_t user_data, int res, unsigned flags);
+    void armAccept();
+    void armWakeup();
+    bool armRecv(int fd, Connection &conn);     // 没有SQE时关闭连接并返回false，连接可能已经释放
+    void handleAccept(int res);
+    void newConnection(int connfd);
+    void handleRecv(int fd, int res, unsigned flags);
+    void handleSend(int fd, OpType op, int res);
+    void afterProcess(int fd, Connection &conn);
+    void startSend(int fd, Connection &conn);
+    void finishIfIdle(int fd);
+    void handleDrain();
+    Connection *find(int fd);
+
+    shared_ptr<IoUring> ring_;
+    SP_TimerManager timer_manager_;   // 定时器管理者，每个Reactor一个
+    SP_ConnTable fd2Task;             // 所有Reactor共用的连接表，限制连接数
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;   // 本Reactor的连接
+    vector<int> starved_;     // provided buffer用完而停止接收的连接，归还缓冲区后重新开始接收
+    int listenfd_;
+    int wakeupfd_;    // eventfd，用于其他线程唤醒本Reactor
+    int idlefd_;      // 预留的文件描述符，文件描述符耗尽时用它接受并关闭新连接
+    int timeout_;     // 新连接来时的初始计时器
+    std::atomic<bool> quit_;
+    std::atomic<bool> draining_;
+    bool drained_;
+    uint64_t wakeup_buf_;
+};
+
+template <typename T>
+Uring<T>::Uring(shared_ptr<IoUring> ring, SP_ConnTable conns, int listenfd, int timeout):
+    ring_(ring), timer_manager_(nullptr), fd2Task(conns), listenfd_(listenfd),
+    wakeupfd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), idlefd_(open("/dev/null", O_RDONLY | O_CLOEXEC)),
+    timeout_(timeout), quit_(false), draining_(false), drained_(false), wakeup_buf_(0)
+{
+    if (wakeupfd_ < 0)
+        throw std::runtime_error("Eventfd create failed");
+    if (!fd2Task)
+        throw std::runtime_error("Connection table is null");
+}
+
+template <typename T>
+Uring<T>::~Uring()
+{
+    // 先关闭io_uring，取消所有未完成的请求，再释放连接
+    ring_.reset();
+    for (auto &c : conns_)
+        fd2Task->reset(c.first);
+    conns_.clear();
+    close(wakeupfd_);
+    if (idlefd_ >= 0)
+        close(idlefd_);
+    if (listenfd_ >= 0)
+        close(listenfd_);
+}
+
+template <typename T>
+shared_ptr<Uring<T>> Uring<T>::CreateUring(SP_ConnTable conns, int listenfd, int timeout)
+{
+    shared_ptr<IoUring> ring = IoUring::CreateIoUring(URING_ENTRIES);
+    if (!ring || !ring->setupBufferRing(0, URING_BUFFER_NUM, URING_BUFFER_SIZE))
+    {
+        close(listenfd);
+        return nullptr;
+    }
+
+    SP_Self sp(nullptr);
+    try
+    {
+        sp.reset(new Uring<T>(ring, conns, listenfd, timeout));
+    }
+    catch (const std::bad_alloc &e)
+    {
+        close(listenfd);
+        std::cerr << "malloc error: " << e.what() << std::endl;
+        return nullptr;
+    }
+    catch (const std::runtime_error &e)
+    {
+        close(listenfd);
+        std::cerr << "runtime error: " << e.what() << std::endl;
+        return nullptr;
+    }
+    if (!sp->init())
+        return nullptr;
+    return sp;
+}
+
+template <typename T>
+bool Uring<T>::init()
+{
+    timer_manager_ = TimerManager<T>::CreateTimerManager(this);
+    if (!timer_manager_)
+        return false;
+    armAccept();
+    armWakeup();
+    return true;
+}
+
+template <typename T>
+void Uring<T>::loop()
+{
+    if (!ring_->enable())
+        return;
+    while (!quit_)
+    {
+        if (draining_ && !drained_)
+            handleDrain();
+        // 提交上一轮产生的所有请求，并等待完成项，最多等到最近的定时器所在的格
+        int timeout = timer_manager_->nextTimeout();
+        if (ring_->submitAndWait(1, timeout < 0 ? 5000 : timeout) < 0)
+            break;
+
+        io_uring_cqe *cqe;
+        while ((cqe = ring_->peekCqe()) != nullptr)
+        {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ring_->advanceCq(1);
+            handleCompletion(user_data, res, flags);
+        }
+
+        // 归还本轮用完的缓冲区，之前因为缓冲区不够而停止的接收重新开始
+        ring_->commitBuffers();
+        for (int fd : starved_)
+        {
+            Connection *conn = find(fd);
+            if (conn && !conn->closing && !conn->recv_armed)
+                armRecv(fd, *conn);
+        }
+        starved_.clear();
+
+        timer_manager_->handleExpired();
+    }
+}
+
+template <typename T>
+void Uring<T>::quit()
+{
+    quit_ = true;
+    wakeup();
+}
+
+template <typename T>
+void Uring<T>::drain()
+{
+    draining_ = true;
+    wakeup();
+}
+
+// 多次触发的accept持有监听套接字的引用，只关闭描述符不够，要先取消它
+// 取消之前已经完成的accept照常处理，之后accept队列中的连接由新进程接受
+template <typename T>
+void Uring<T>::handleDrain()
+{
+    drained_ = true;
+    io_uring_sqe *sqe = ring_->getSqe();
+    if (!sqe)
+    {
+        LOG_ERROR << "io_uring submission queue full, accept not cancelled";
+        drained_ = false;
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = encode(listenfd_, OP_ACCEPT);
+    sqe->user_data = encode(0, OP_CANCEL);
+    close(listenfd_);
+    listenfd_ = -1;
+    timer_manager_->shorten(timeout_);
+    LOG_INFO << "stop accepting, drain " << timer_manager_->size() << " idle connections";
+}
+
+template <typename T>
+void Uring<T>::wakeup()
+{
+    uint64_t one = 1;
+    if (write(wakeupfd_, &one, sizeof(one)) != sizeof(one))
+        LOG_ERROR << "wakeup failed, errno=" << errno;
+}
+
+template <typename T>
+typename Uring<T>::Connection *Uring<T>::find(int fd)
+{
+    auto it = conns_.find(fd);
+    return it == conns_.end() ? nullptr : it->second.get();
+}
+
+template <typename T>
+void Uring<T>::armAccept()
+{
+    io_uring_sqe *sqe = ring_->getSqe();
+    if (!sqe)
+    {
+        LOG_ERROR << "io_uring submission queue full, accept not armed";
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = encode(listenfd_, OP_ACCEPT);
+}
+
+template <typename T>
+void Uring<T>::armWakeup()
+{
+    io_uring_sqe *sqe = ring_->getSqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeupfd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeup_buf_);
+    sqe->len = sizeof(wakeup_buf_);
+    sqe->user_data = encode(wakeupfd_, OP_WAKEUP);
+}
+
+template <typename T>
+bool Uring<T>::armRecv(int fd, Connection &conn)
+{
+    io_uring_sqe *sqe = ring_->getSqe();
+    if (!sqe)
+    {
+        closeConnection(fd);
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ring_->bufferGroup();
+    sqe->user_data = encode(fd, OP_RECV);
+    conn.recv_armed = true;
+    ++conn.inflight;
+    return true;
+}
+
+template <typename T>
+void Uring<T>::handleCompletion(uint64_t user_data, int res, unsigned flags)
+{
+    int fd = static_cast<int>(user_data >> 8);
+    OpType op = static_cast<OpType>(user_data & 0xff);
+    switch (op)
+    {
+        case OP_ACCEPT:
+            handleAccept(res);
+            if (!(flags & IORING_CQE_F_MORE) && !quit_ && listenfd_ >= 0)
+                armAccept();
+            break;
+        case OP_CANCEL:
+            break;
+        case OP_WAKEUP:
+            if (!quit_)
+                armWakeup();
+            break;
+        case OP_RECV:
+            handleRecv(fd, res, flags);
+            break;
+        case OP_SEND:
+        case OP_FILE_READ:
+        case OP_FILE_SEND:
+            handleSend(fd, op, res);
+            break;
+        default:
+            LOG_ERROR << "unknown io_uring completion " << user_data;
+    }
+}
+
+template <typename T>
+void Uring<T>::handleAccept(int res)
+{
+    if (res >= 0)
+    {
+        newConnection(res);
+        return;
+    }
+    // 文件描述符耗尽，腾出预留的描述符接受并立即关闭一个连接，避免连接一直堆积在accept队列中
+    if ((res == -EMFILE || res == -ENFILE) && idlefd_ >= 0)
+    {
+        close(idlefd_);
+        idlefd_ = accept(listenfd_, NULL, NULL);
+        if (idlefd_ >= 0)
+            close(idlefd_);
+        idlefd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        LOG_ERROR << "Too many open files, reject a new connection";
+    }
+    else if (res != -EAGAIN && res != -EINTR && res != -ECANCELED)
+        LOG_ERROR << "accept failed, errno=" << -res;
+}
+
+// 为新连接创建任务，开始接收并添加定时器
+template <typename T>
+void Uring<T>::newConnection(int connfd)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len = sizeof(addr);
+    getpeername(connfd, (sockaddr *)&addr, &addr_len);
+    LOG_INFO << "accept new connection, socket: " << connfd << " ip: " << dotted_decimal_notation(addr) << ":" << src_port(addr) ;
+
+    if (connfd >= fd2Task->capacity())
+    {
+        close(connfd);
+        LOG_ERROR << "connfd >= connection table capacity, close the socket " << connfd;
+        return;
+    }
+
+    std::unique_ptr<Connection> conn(new Connection());
+    conn->task = makePooled<T>(connfd, addr);
+    conn->task->Init(timer_manager_, nullptr);
+    if (!fd2Task->set(connfd, conn->task))
+    {
+        LOG_ERROR << "connection table full, close the socket " << connfd;
+        return;
+    }
+    Connection &c = *conn;
+    conns_[connfd] = std::move(conn);
+    if (armRecv(connfd, c))
+        timer_manager_->addTimer(c.task.get(), timeout_);
+}
+
+template <typename T>
+void Uring<T>::handleRecv(int fd, int res, unsigned flags)
+{
+    Connection *conn = find(fd);
+    if (!conn)
+        return;
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        conn->recv_armed = false;
+        --conn->inflight;
+    }
+
+    if (res > 0)
+    {
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->closing)
+        {
+            // 处理期间不会超时
+            timer_manager_->delTimer(conn->task.get());
+            conn->task->onReceive(ring_->buffer(bid), res);
+        }
+        ring_->recycleBuffer(bid);
+        if (!conn->closing)
+        {
+            afterProcess(fd, *conn);
+            // 多次触发的recv已经结束时，afterProcess关闭连接会直接释放它
+            conn = find(fd);
+            if (conn && !conn->closing && !conn->recv_armed)
+                armRecv(fd, *conn);
+        }
+    }
+    else if (res == -ENOBUFS)
+    {
+        if (!conn->closing && !conn->recv_armed)
+            starved_.push_back(fd);
+    }
+    else
+    {
+        // 对端已经关闭，或者出错
+        if (res == 0)
+            LOG_INFO << "Receive zero byte message, socket = " << fd;
+        closeConnection(fd);
+    }
+    finishIfIdle(fd);
+}
+
+// 任务处理完收到的数据或者发送完成后：继续发送、关闭连接，或者等待下一个请求
+template <typename T>
+void Uring<T>::afterProcess(int fd, Connection &conn)
+{
+    if (conn.sending)
+        return;
+    if (conn.task->hasOutput())
+        startSend(fd, conn);
+    else if (conn.task->shouldClose())
+        closeConnection(fd);
+    else
+        timer_manager_->addTimer(conn.task.get(), conn.task->idleTimeout());
+}
+
+template <typename T>
+void Uring<T>::startSend(int fd, Connection &conn)
+{
+    int iovcnt = conn.task->prepareSend(conn.iov, URING_MAX_IOV);
+    if (iovcnt > 0)
+    {
+        io_uring_sqe *sqe = ring_->getSqe();
+        if (!sqe)
+        {
+            closeConnection(fd);
+            return;
+        }
+        memset(&conn.msg, 0, sizeof(conn.msg));
+        conn.msg.msg_iov = conn.iov;
+        conn.msg.msg_iovlen = iovcnt;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = encode(fd, OP_SEND);
+        conn.sending = true;
+        ++conn.inflight;
+        return;
+    }
+
+    // 内存中的部分都发完了，用链接在一起的read和send发送下一块文件内容
+    int file_fd;
+    off_t offset;
+    std::size_t len;
+    if (!conn.task->prepareSendFile(&file_fd, &offset, &len))
+        return;
+    if (!conn.file_buf)
+        conn.file_buf.reset(new char[URING_FILE_CHUNK]);
+    conn.file_chunk = std::min(len, URING_FILE_CHUNK);
+    conn.file_error = false;
+
+    io_uring_sqe *read_sqe = ring_->getSqe();
+    if (!read_sqe)
+    {
+        closeConnection(fd);
+        return;
+    }
+    read_sqe->opcode = IORING_OP_READ;
+    read_sqe->fd = file_fd;
+    read_sqe->off = offset;
+    read_sqe->addr = reinterpret_cast<uint64_t>(conn.file_buf.get());
+    read_sqe->len = conn.file_chunk;
+    read_sqe->flags = IOSQE_IO_LINK;   // 读到的字节数不够时send会被取消
+    read_sqe->user_data = encode(fd, OP_FILE_READ);
+    ++conn.inflight;
+
+    io_uring_sqe *send_sqe = ring_->getSqe();
+    if (!send_sqe)
+    {
+        // 读请求已经在队列中，等它返回后再关闭
+        conn.sending = true;
+        conn.file_error = true;
+        closeConnection(fd);
+        return;
+    }
+    send_sqe->opcode = IORING_OP_SEND;
+    send_sqe->fd = fd;
+    send_sqe->addr = reinterpret_cast<uint64_t>(conn.file_buf.get());
+    send_sqe->len = conn.file_chunk;
+    send_sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    send_sqe->user_data = encode(fd, OP_FILE_SEND);
+    conn.sending = true;
+    ++conn.inflight;
+}
+
+template <typename T>
+void Uring<T>::handleSend(int fd, OpType op, int res)
+{
+    Connection *conn = find(fd);
+    if (!conn)
+        return;
+    --conn->inflight;
+
+    if (op == OP_FILE_READ)
+    {
+        if (res < 0 || static_cast<std::size_t>(res) != conn->file_chunk)
+            conn->file_error = true;
+        finishIfIdle(fd);
+        return;
+    }
+
+    conn->sending = false;
+    if (!conn->closing)
+    {
+        if (res < 0 || (op == OP_FILE_SEND && conn->file_error))
+        {
+            LOG_ERROR << "Send message failed, socket = " << fd << " errno=" << -res;
+            closeConnection(fd);
+        }
+        else
+        {
+            if (op == OP_SEND)
+                conn->task->onSent(res);
+            else
+                conn->task->onFileSent(res);
+            afterProcess(fd, *conn);
+        }
+    }
+    finishIfIdle(fd);
+}
+
+// 关闭连接：先shutdown让未完成的请求尽快返回，全部返回后再释放任务
+template <typename T>
+void Uring<T>::closeConnection(int fd)
+{
+    Connection *conn = find(fd);
+    if (!conn || conn->closing)
+        return;
+    conn->closing = true;
+    timer_manager_->delTimer(conn->task.get());
+    shutdown(fd, SHUT_RDWR);
+    finishIfIdle(fd);
+}
+
+template <typename T>
+void Uring<T>::finishIfIdle(int fd)
+{
+    Connection *conn = find(fd);
+    if (!conn || !conn->closing || conn->inflight > 0)
+        return;
+    fd2Task->reset(fd);
+    conns_.erase(fd);    // 任务对象析构时关闭套接字
+}
+
+#endif
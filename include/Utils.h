@@ -1,18 +1,38 @@
 // 一些小工具
 #ifndef _UTILS_H
 #define _UTILS_H
+#include <ctime>
 #include <string>
+#include <vector>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
 #define TESTOUT std::cout << "this is just a test" << std::endl;
 
 // 创建服务器套接字,如果失败，返回-1
-int Create_And_Listen(int port);
+// reuseport为true时设置SO_REUSEPORT，多个套接字可以监听同一个端口，由内核分配连接
+int Create_And_Listen(int port, bool reuseport = false);
+
+// 给SO_REUSEPORT组挂载CBPF程序，按照处理SYN的CPU编号选择组内第(cpu % group_size)个套接字
+// 只需对组内任意一个套接字调用一次
+bool Attach_Reuseport_CPU_Steering(int listenfd, int group_size);
+
+// 平滑升级用的Unix域套接字（非阻塞、close-on-exec），如果失败，返回-1
+// 监听前删除path上残留的套接字文件，所以只能由当前没有其他进程在监听的一方调用
+int Create_Unix_Listen(const std::string &path);
+// 阻塞地连接path，没有进程在监听时返回-1
+int Connect_Unix(const std::string &path);
+// 用SCM_RIGHTS传递一组文件描述符，接收方得到的是同一个打开的文件（套接字）的新描述符
+bool Send_Fds(int sock, const std::vector<int> &fds);
+// 阻塞地接收Send_Fds()发来的文件描述符，格式错误或对方关闭时返回false
+bool Recv_Fds(int sock, std::vector<int> &fds);
 
 // 设置为非阻塞模式
 bool SetSocketNoBlocking(int fd);
 
+// 把RLIMIT_NOFILE的软限制提高到want（want <= 0 时提高到硬限制），返回调整后的软限制
+int Raise_Fd_Limit(int want);
+
 // 信号处理函数，使用pipe告知epoll
 void sig_hander(int sig);
 
@@ -24,9 +44,13 @@ std::string get_time_str();
 
 // 返回当前GMT时间字符串，格式类似于： Tue, 11 Jul 2023 07:22:04 GMT
 std::string get_gmt_time_str();
+// 返回时刻t的GMT时间字符串，用于Last-Modified等首部字段
+std::string get_gmt_time_str(time_t t);
+// 解析上面格式的GMT时间字符串，用于If-Modified-Since等首部字段，格式错误时返回false
+bool parse_gmt_time_str(const std::string &str, time_t &t);
 
-// 生成日志文件名
-std::string get_logfile_name();
+// 生成日志文件名：basename加上当前时间和suffix，例如WebServer20230706210557.log
+std::string get_logfile_name(const std::string &basename, const std::string &suffix);
 
 // 根据sockaddr_in，返回IP地址的点分十进制字符串
 std::string dotted_decimal_notation(const sockaddr_in &addr);
@@ -1,17 +1,54 @@
 // WebServer模板类，把所有东西都整合起来
 #include "ThreadPool.h"
 #include "Epoll.h"
+#include "Uring.h"
+#include "Config.h"
 #include "Logging.h"
+#include "Affinity.h"
+#include <algorithm>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <string>
 #include <exception>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
 using std::shared_ptr;
 using std::weak_ptr;
+using std::vector;
 
 // const int THREAD_NUM = 16;
 // const int MAX_QUEUE = 10000;
+const char UPGRADE_READY = 'R';     // 新进程创建好所有事件循环后回复旧进程
+const int DRAIN_CHECK_MS = 100;     // 排空时检查剩余连接数的间隔
 
 
+/*
+    两种工作模式：
+        1. 单Reactor + 线程池：主线程的Epoll监听所有连接，就绪的任务放入线程池的工作队列
+        2. 多Reactor（one loop per thread）：主线程的Epoll只负责accept，新连接轮流分配给从Reactor，
+           每个从Reactor在自己的线程中运行，拥有自己的epollfd、fd2Task和TimerManager，
+           连接的整个生命周期都在同一个线程中处理，不经过工作队列
+           开启reuseport时，每个从Reactor用SO_REUSEPORT各自监听同一端口，由内核分配连接，
+           主线程只处理信号；再开启cpu_steering则由CBPF程序把CPU c上收到的连接交给第c % reactor_num个Reactor，
+           没有配置cpu_affinity时第i个事件循环绑定CPU i，连接就在处理SYN的CPU上处理
+    开启io_uring时，启动max(1, reactor_num)个Uring线程，各自监听端口，主线程的Epoll只处理信号；
+    内核不支持时退回上面两种模式
+    配置了cpu_affinity时按CPU列表的顺序绑定线程，每个线程的内存优先从它所在的节点分配：
+        主线程绑定第一个CPU；多Reactor和io_uring模式下第i个事件循环绑定第i个（列表从0开始连续时和cpu_steering的分配一致，
+        主线程只accept或者只处理信号，和第一个事件循环共用一个CPU）；单Reactor模式下第i个工作线程绑定第i+1个
+        CPU不够时循环使用。从Reactor处理的连接在它自己的线程中创建，任务、缓冲区和内存池都在本地节点
+
+    平滑升级（配置了upgrade_path）：
+        1. 旧进程在upgrade_path上监听Unix套接字，新进程用相同的参数启动，连接它并用SCM_RIGHTS接收所有监听套接字，
+           按创建顺序依次代替Create_And_Listen()创建的套接字，数量不符时新进程退出，旧进程照常服务
+        2. 新进程的事件循环都创建好后回复UPGRADE_READY，然后在upgrade_path上监听，等待下一次升级
+        3. 旧进程收到回复后排空：所有事件循环停止accept（只关闭自己的描述符，套接字和accept队列仍然由新进程持有，
+           不会丢失连接），之后的请求都回复Connection: close，空闲连接按新连接的超时时间关闭
+        4. 连接数降到0或超过drain_timeout秒后旧进程退出
+        新进程在回复之前退出（连接断开）时旧进程放弃这次升级，继续accept
+*/
 // 也是单例模式
 template <typename T>
 class WebServer
@@ -20,14 +57,44 @@ class WebServer
     using WP_Self = weak_ptr<WebServer<T>>;
     using SP_ThreadPool = shared_ptr<ThreadPool<T>>;
     using SP_Epoll = shared_ptr<Epoll<T>>;
+    using SP_Uring = shared_ptr<Uring<T>>;
+    using SP_ConnTable = shared_ptr<ConnectionTable<T>>;
 private:
     static WP_Self self_;
     SP_ThreadPool pool_;
     SP_Epoll epoll_;
-    WebServer(int thread_num, int maxq, int port, int timeout);
+    SP_ConnTable conns_;             // 所有Reactor共用的连接表
+    vector<SP_Epoll> reactors_;      // 从Reactor
+    vector<SP_Uring> urings_;        // io_uring模式下的事件循环
+    vector<pthread_t> reactor_threads_;
+    vector<int> cpus_;               // 线程绑定的CPU，为空时不绑定
+    vector<int> listen_fds_;         // 按创建顺序的监听套接字，平滑升级时交给新进程，由各个事件循环负责关闭
+    std::deque<int> inherited_fds_;  // 从旧进程接管、还没有用到的监听套接字
+    std::string upgrade_path_;
+    int upgrade_listenfd_;
+    int upgrade_connfd_;     // 旧进程中是正在升级的新进程的连接，新进程中是到旧进程的连接
+    int drain_timerfd_;
+    int drain_ticks_left_;
+    explicit WebServer(const ServerConfig &config);
+    bool createUrings(const ServerConfig &config);
+    static void *reactorThread(void *arg);
+    static void *uringThread(void *arg);
+    void stopReactors();
+    int cpuFor(std::size_t i) const {return cpus_.empty() ? -1 : cpus_[i % cpus_.size()];}
+    void initAffinity(const std::string &spec);
+    void initSteeringAffinity(int n);
+    static int listenFdCount(const ServerConfig &config);
+    void inheritListenFds(const ServerConfig &config);
+    int takeListenFd(int port, bool reuseport);
+    void initUpgrade();
+    void onUpgradeConnection();
+    void onUpgradeReply();
+    void startDrain();
+    void onDrainTick();
     
 public:
-    static SP_Self CreateWebServer(int port, int timeout, int thread_num, int maxq);
+    ~WebServer();
+    static SP_Self CreateWebServer(const ServerConfig &config);
     void work();
 };
 
@@ -36,18 +103,374 @@ weak_ptr<WebServer<T>> WebServer<T>::self_;
 
 
 template <typename T>
-WebServer<T>::WebServer(int port, int timeout, int thread_num, int maxq)
+WebServer<T>::WebServer(const ServerConfig &config):
+    upgrade_path_(config.upgrade_path), upgrade_listenfd_(-1), upgrade_connfd_(-1), drain_timerfd_(-1),
+    drain_ticks_left_(config.drain_timeout * 1000 / DRAIN_CHECK_MS)
 {
-    pool_ = ThreadPool<T>::CreateThreadPool(thread_num, maxq);
-    if (!pool_)
-        throw std::runtime_error("Thread Pool failed");
-    epoll_ = Epoll<T>::CreateEpoll(pool_, port, timeout);
+    // 主线程先绑定，之后它创建的Epoll等对象都在本地节点
+    if (!config.cpu_affinity.empty())
+        initAffinity(config.cpu_affinity);
+    if (config.cpu_steering && config.reactor_num > 1)
+        initSteeringAffinity(config.reactor_num);
+
+    // 连接表的容量就是进程能打开的文件描述符数，内存随实际连接数按页增长
+    int max_fd = Raise_Fd_Limit(config.max_conn);
+    if (max_fd <= 0)
+        throw std::runtime_error("Get RLIMIT_NOFILE failed");
+    conns_.reset(new ConnectionTable<T>(max_fd));
+    LOG_INFO << "Connection table capacity: " << max_fd;
+    if (!upgrade_path_.empty())
+        inheritListenFds(config);
+
+    if (config.io_uring && createUrings(config))
+    {
+        epoll_ = Epoll<T>::CreateEpoll(pool_, conns_, -1, config.timeout, config.epoll_batch);
+        if (!epoll_)
+            throw std::runtime_error("Epoll failed");
+        for (std::size_t i = 0; i < urings_.size(); ++i)
+        {
+            pthread_t tid;
+            if (Affinity::createThread(&tid, cpuFor(i), uringThread, urings_[i].get()) != 0)
+            {
+                stopReactors();
+                throw std::runtime_error("Uring thread creating failed");
+            }
+            reactor_threads_.push_back(tid);
+        }
+        return;
+    }
+
+    bool reuseport = config.reuseport && config.reactor_num > 0;
+    if (config.reactor_num > 0)
+    {
+        for (int i = 0; i < config.reactor_num; ++i)
+        {
+            // 按顺序创建监听套接字，第i个套接字在SO_REUSEPORT组中的下标也是i
+            int listenfd = -1;
+            if (reuseport && (listenfd = takeListenFd(config.port, true)) < 0)
+                throw std::runtime_error("Reuseport socket create failed");
+            SP_Epoll reactor = Epoll<T>::CreateSubEpoll(conns_, config.timeout, config.epoll_batch, listenfd);
+            if (!reactor)
+                throw std::runtime_error("Sub reactor failed");
+            reactors_.push_back(reactor);
+            if (reuseport && config.cpu_steering && i == config.reactor_num - 1 &&
+                !Attach_Reuseport_CPU_Steering(listenfd, config.reactor_num))
+                LOG_WARN << "CPU steering unavailable, fall back to kernel hashing";
+        }
+    }
+    else
+    {
+        vector<int> worker_cpus;
+        for (int i = 0; !cpus_.empty() && i < config.thread_num; ++i)
+            worker_cpus.push_back(cpuFor(static_cast<std::size_t>(i) + 1));
+        pool_ = ThreadPool<T>::CreateThreadPool(config.thread_num, config.max_queue, config.lockfree_queue, worker_cpus);
+        if (!pool_)
+            throw std::runtime_error("Thread Pool failed");
+    }
+    int listenfd = -1;
+    if (!reuseport && (listenfd = takeListenFd(config.port, false)) < 0)
+        throw std::runtime_error("Socket create failed");
+    epoll_ = Epoll<T>::CreateEpoll(pool_, conns_, listenfd, config.timeout, config.epoll_batch);
     if (!epoll_)
         throw std::runtime_error("Epoll failed");
+    epoll_->setSubReactors(reactors_);
+
+    for (std::size_t i = 0; i < reactors_.size(); ++i)
+    {
+        pthread_t tid;
+        if (Affinity::createThread(&tid, cpuFor(i), reactorThread, reactors_[i].get()) != 0)
+        {
+            stopReactors();
+            throw std::runtime_error("Reactor thread creating failed");
+        }
+        reactor_threads_.push_back(tid);
+    }
+}
+
+template <typename T>
+WebServer<T>::~WebServer()
+{
+    stopReactors();
+    for (int fd : {upgrade_listenfd_, upgrade_connfd_, drain_timerfd_})
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+template <typename T>
+void *WebServer<T>::reactorThread(void *arg)
+{
+    Epoll<T> *reactor = static_cast<Epoll<T> *>(arg);
+    reactor->loop();
+    return NULL;
+}
+
+// 每个Uring用SO_REUSEPORT各自监听端口，任何一个创建失败都退回epoll
+template <typename T>
+bool WebServer<T>::createUrings(const ServerConfig &config)
+{
+    int n = config.reactor_num > 0 ? config.reactor_num : 1;
+    for (int i = 0; i < n; ++i)
+    {
+        int listenfd = takeListenFd(config.port, n > 1);
+        if (listenfd < 0)
+            throw std::runtime_error("Listen socket create failed");
+        SP_Uring uring = Uring<T>::CreateUring(conns_, listenfd, config.timeout);
+        if (!uring)
+        {
+            // 接管的套接字已经被关闭，而且退回epoll后需要的套接字数量不同
+            if (upgrade_connfd_ >= 0)
+                throw std::runtime_error("io_uring unavailable, cannot take over the listen sockets");
+            urings_.clear();
+            listen_fds_.clear();
+            LOG_WARN << "io_uring unavailable, fall back to epoll";
+            return false;
+        }
+        urings_.push_back(uring);
+        if (n > 1 && config.cpu_steering && i == n - 1 && !Attach_Reuseport_CPU_Steering(listenfd, n))
+            LOG_WARN << "CPU steering unavailable, fall back to kernel hashing";
+    }
+    LOG_INFO << "Using io_uring with " << n << " event loops";
+    return true;
+}
+
+template <typename T>
+void *WebServer<T>::uringThread(void *arg)
+{
+    Uring<T> *uring = static_cast<Uring<T> *>(arg);
+    uring->loop();
+    return NULL;
+}
+
+template <typename T>
+void WebServer<T>::stopReactors()
+{
+    for (auto &reactor : reactors_)
+        reactor->quit();
+    for (auto &uring : urings_)
+        uring->quit();
+    for (auto tid : reactor_threads_)
+        pthread_join(tid, NULL);
+    reactor_threads_.clear();
+}
+
+template <typename T>
+void WebServer<T>::initAffinity(const std::string &spec)
+{
+    if (!Affinity::ParseCpuList(spec, cpus_))
+        throw std::runtime_error("Invalid CPU list " + spec);
+    std::string list;
+    for (int cpu : cpus_)
+        list += (list.empty() ? "" : ",") + std::to_string(cpu) + "(node " + std::to_string(Affinity::nodeOf(cpu)) + ")";
+    LOG_INFO << "pin threads to cpus " << list << ", " << Affinity::nodeCount() << " NUMA nodes";
+    Affinity::pinCurrentThread(cpus_[0]);
+}
+
+// CBPF程序按CPU编号分配连接，第i个事件循环必须绑定CPU i，否则只是按CPU把连接分散开
+template <typename T>
+void WebServer<T>::initSteeringAffinity(int n)
+{
+    if (!cpus_.empty())
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            if (cpuFor(i) != i)
+            {
+                LOG_WARN << "CPU steering: event loop " << i << " is pinned to cpu " << cpuFor(i)
+                         << ", connections are not handled on the cpu that took the SYN";
+                return;
+            }
+        }
+        return;
+    }
+    vector<int> allowed = Affinity::allowedCpus();
+    for (int i = 0; i < n; ++i)
+    {
+        if (!std::binary_search(allowed.begin(), allowed.end(), i))
+        {
+            LOG_WARN << "CPU steering: cpu " << i << " is not available, event loops are not pinned "
+                     << "and connections are only spread by cpu";
+            return;
+        }
+    }
+    for (int i = 0; i < n; ++i)
+        cpus_.push_back(i);
+    LOG_INFO << "CPU steering: pin event loop i to cpu i (0-" << n - 1 << ")";
+}
+
+// 和构造函数中创建监听套接字的顺序一致
+template <typename T>
+int WebServer<T>::listenFdCount(const ServerConfig &config)
+{
+    if (config.io_uring)
+        return config.reactor_num > 0 ? config.reactor_num : 1;
+    if (config.reuseport && config.reactor_num > 0)
+        return config.reactor_num;
+    return 1;
+}
+
+// 没有旧进程在监听upgrade_path时正常启动，连接上了但接管失败时抛出异常，旧进程看到连接断开后继续服务
+template <typename T>
+void WebServer<T>::inheritListenFds(const ServerConfig &config)
+{
+    upgrade_connfd_ = Connect_Unix(upgrade_path_);
+    if (upgrade_connfd_ < 0)
+        return;
+    vector<int> fds;
+    if (!Recv_Fds(upgrade_connfd_, fds))
+        throw std::runtime_error("Receive listen sockets from the old process failed");
+    if (static_cast<int>(fds.size()) != listenFdCount(config))
+    {
+        for (int fd : fds)
+            close(fd);
+        LOG_ERROR << "old process passed " << fds.size() << " listen sockets, expect " << listenFdCount(config)
+                  << ", start with the same options as the old process";
+        throw std::runtime_error("Listen socket count mismatch");
+    }
+    inherited_fds_.assign(fds.begin(), fds.end());
+    LOG_INFO << "take over " << fds.size() << " listen sockets from the old process";
+}
+
+template <typename T>
+int WebServer<T>::takeListenFd(int port, bool reuseport)
+{
+    int listenfd;
+    if (!inherited_fds_.empty())
+    {
+        listenfd = inherited_fds_.front();
+        inherited_fds_.pop_front();
+    }
+    else
+        listenfd = Create_And_Listen(port, reuseport);
+    if (listenfd >= 0)
+        listen_fds_.push_back(listenfd);
+    return listenfd;
+}
+
+// 所有事件循环都已经创建，通知旧进程开始排空，然后等待下一次升级
+// 升级用的套接字出错时只是不能再升级，不影响服务
+template <typename T>
+void WebServer<T>::initUpgrade()
+{
+    if (upgrade_connfd_ >= 0)
+    {
+        char ready = UPGRADE_READY;
+        if (send(upgrade_connfd_, &ready, 1, MSG_NOSIGNAL) != 1)
+            LOG_ERROR << "notify the old process failed, errno=" << errno;
+        close(upgrade_connfd_);
+        upgrade_connfd_ = -1;
+    }
+    if (upgrade_path_.empty())
+        return;
+    upgrade_listenfd_ = Create_Unix_Listen(upgrade_path_);
+    if (upgrade_listenfd_ < 0 || !epoll_->watch(upgrade_listenfd_, [this]() {onUpgradeConnection();}))
+    {
+        LOG_ERROR << "listen on upgrade socket " << upgrade_path_ << " failed, errno=" << errno;
+        if (upgrade_listenfd_ >= 0)
+            close(upgrade_listenfd_);
+        upgrade_listenfd_ = -1;
+        return;
+    }
+    LOG_INFO << "waiting for upgrade on " << upgrade_path_;
+}
+
+// 同一时间只进行一次升级，监听套接字交出去后等待新进程回复
+template <typename T>
+void WebServer<T>::onUpgradeConnection()
+{
+    int fd = accept4(upgrade_listenfd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (upgrade_connfd_ >= 0)
+    {
+        LOG_WARN << "upgrade already in progress, reject another one";
+        close(fd);
+        return;
+    }
+    if (!Send_Fds(fd, listen_fds_) || !epoll_->watch(fd, [this]() {onUpgradeReply();}))
+    {
+        LOG_ERROR << "pass listen sockets to the new process failed, errno=" << errno;
+        close(fd);
+        return;
+    }
+    upgrade_connfd_ = fd;
+    LOG_WARN << "upgrade: passed " << listen_fds_.size() << " listen sockets, waiting for the new process";
+}
+
+template <typename T>
+void WebServer<T>::onUpgradeReply()
+{
+    char reply = 0;
+    ssize_t n = recv(upgrade_connfd_, &reply, 1, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    epoll_->unwatch(upgrade_connfd_);
+    close(upgrade_connfd_);
+    upgrade_connfd_ = -1;
+    if (n == 1 && reply == UPGRADE_READY)
+    {
+        startDrain();
+        return;
+    }
+    LOG_ERROR << "upgrade aborted, the new process exited before it was ready";
+}
+
+template <typename T>
+void WebServer<T>::startDrain()
+{
+    LOG_WARN << "upgrade: the new process is ready, stop accepting and drain "
+             << Metrics::activeConnections() << " connections";
+    // upgrade_path已经属于新进程，只关闭描述符，不删除文件
+    epoll_->unwatch(upgrade_listenfd_);
+    close(upgrade_listenfd_);
+    upgrade_listenfd_ = -1;
+
+    T::setDraining();
+    epoll_->drain();
+    for (auto &reactor : reactors_)
+        reactor->drain();
+    for (auto &uring : urings_)
+        uring->drain();
+
+    drain_timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = DRAIN_CHECK_MS * 1000000L;
+    its.it_value = its.it_interval;
+    if (drain_timerfd_ < 0 || timerfd_settime(drain_timerfd_, 0, &its, NULL) != 0 ||
+        !epoll_->watch(drain_timerfd_, [this]() {onDrainTick();}))
+    {
+        LOG_ERROR << "create drain timer failed, errno=" << errno << ", stop now";
+        epoll_->quit();
+    }
 }
 
 template <typename T>
-shared_ptr<WebServer<T>> WebServer<T>::CreateWebServer(int port, int timeout, int thread_num, int maxq)
+void WebServer<T>::onDrainTick()
+{
+    uint64_t expirations = 0;
+    if (read(drain_timerfd_, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    drain_ticks_left_ -= static_cast<int>(expirations);
+    int64_t active = Metrics::activeConnections();
+    if (active > 0 && drain_ticks_left_ > 0)
+        return;
+    if (active > 0)
+    {
+        LOG_WARN << "drain timeout, close " << active << " remaining connections";
+    }
+    else
+    {
+        LOG_INFO << "all connections drained";
+    }
+    if (pool_)
+        pool_->shutdown();
+    epoll_->quit();
+}
+
+template <typename T>
+shared_ptr<WebServer<T>> WebServer<T>::CreateWebServer(const ServerConfig &config)
 {
     if (self_.lock())
         return nullptr;
@@ -55,7 +478,7 @@ shared_ptr<WebServer<T>> WebServer<T>::CreateWebServer(int port, int timeout, in
     SP_Self sp(nullptr);
     try
     {
-        sp.reset(new WebServer<T>(port, timeout, thread_num, maxq));
+        sp.reset(new WebServer<T>(config));
         self_ = sp;
     }
     catch (const std::bad_alloc &e)
@@ -78,6 +501,8 @@ shared_ptr<WebServer<T>> WebServer<T>::CreateWebServer(int port, int timeout, in
     sa.sa_flags = 0;
     sigaction(SIGPIPE, &sa, NULL);
 
+    self_.lock()->initUpgrade();
+
     LOG_INFO << "Server started";
     return self_.lock();
 }
@@ -86,9 +511,10 @@ shared_ptr<WebServer<T>> WebServer<T>::CreateWebServer(int port, int timeout, in
 template <typename T>
 void WebServer<T>::work()
 {
-    while (!pool_->isStop())
+    while (!epoll_->isQuit())
     {
         epoll_->epoll_wait_and_handle();
     }
+    stopReactors();
     LOG_INFO << "Server stopped";
 }
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include "Affinity.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include "Logging.h"
+
+namespace {
+
+const int MAX_NODES = 1024;
+
+// 解析"0-3,8"形式的列表，sysfs中的cpulist也是这个格式
+bool parseRanges(const std::string &spec, std::vector<int> &out)
+{
+    out.clear();
+    std::size_t i = 0;
+    while (i < spec.size())
+    {
+        std::size_t end = spec.find(',', i);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(i, end - i);
+        i = end + 1;
+        if (item.empty() || item.find_first_not_of("0123456789-") != std::string::npos)
+            return false;
+        std::size_t dash = item.find('-');
+        int first = atoi(item.c_str());
+        int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+        if (dash == 0 || dash + 1 == item.size() || (dash != std::string::npos && item.find('-', dash + 1) != std::string::npos) ||
+            last < first || last >= CPU_SETSIZE)
+            return false;
+        for (int cpu = first; cpu <= last; ++cpu)
+            out.push_back(cpu);
+    }
+    return !out.empty();
+}
+
+std::string readLine(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+        return std::string();
+    char buf[4096];
+    std::string line;
+    if (fgets(buf, sizeof(buf), f))
+        line = buf;
+    fclose(f);
+    while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+        line.pop_back();
+    return line;
+}
+
+int readInt(const std::string &path, int def)
+{
+    std::string line = readLine(path);
+    return line.empty() ? def : atoi(line.c_str());
+}
+
+std::vector<int> nodeIds()
+{
+    std::vector<int> ids;
+    if (DIR *d = opendir("/sys/devices/system/node"))
+    {
+        while (dirent *entry = readdir(d))
+        {
+            int id;
+            char extra;
+            if (sscanf(entry->d_name, "node%d%c", &id, &extra) == 1)
+                ids.push_back(id);
+        }
+        closedir(d);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// 启动时读一次，之后只读
+struct Topology
+{
+    std::vector<int> node_of_cpu;
+    int nodes;
+    Topology(): node_of_cpu(CPU_SETSIZE, 0), nodes(0)
+    {
+        for (int id : nodeIds())
+        {
+            std::vector<int> cpus;
+            char path[64];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+            if (parseRanges(readLine(path), cpus))
+            {
+                for (int cpu : cpus)
+                    node_of_cpu[cpu] = id;
+            }
+            ++nodes;
+        }
+        if (nodes == 0)
+            nodes = 1;
+    }
+};
+
+const Topology &topology()
+{
+    static Topology topo;
+    return topo;
+}
+
+struct ThreadStart
+{
+    void *(*fn)(void *);
+    void *arg;
+    int cpu;
+};
+
+void *threadTrampoline(void *p)
+{
+    ThreadStart start = *static_cast<ThreadStart *>(p);
+    delete static_cast<ThreadStart *>(p);
+    Affinity::pinCurrentThread(start.cpu);
+    return start.fn(start.arg);
+}
+
+} // namespace
+
+bool Affinity::ParseCpuList(const std::string &spec, std::vector<int> &cpus)
+{
+    std::vector<int> result;
+    if (spec == "cores")
+        result = physicalCores();
+    else if (!parseRanges(spec, result))
+        return false;
+    std::vector<int> allowed = allowedCpus();
+    for (int cpu : result)
+    {
+        if (!std::binary_search(allowed.begin(), allowed.end(), cpu))
+            return false;
+    }
+    if (result.empty())
+        return false;
+    cpus.swap(result);
+    return true;
+}
+
+std::vector<int> Affinity::allowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// 同一个封装（和die）中core_id相同的是超线程的兄弟，只取编号最小的
+std::vector<int> Affinity::physicalCores()
+{
+    std::map<std::pair<int, int>, int> first;   // (封装, 核心) -> CPU
+    std::vector<int> cores;
+    for (int cpu : allowedCpus())
+    {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int package = readInt(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/die_id", cpu);
+        package = package * 256 + readInt(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = readInt(path, cpu);
+        if (first.insert(std::make_pair(std::make_pair(package, core), cpu)).second)
+            cores.push_back(cpu);
+    }
+    std::stable_sort(cores.begin(), cores.end(), [](int a, int b) {return nodeOf(a) < nodeOf(b);});
+    return cores;
+}
+
+int Affinity::nodeOf(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return 0;
+    return topology().node_of_cpu[cpu];
+}
+
+int Affinity::nodeCount()
+{
+    return topology().nodes;
+}
+
+bool Affinity::pinCurrentThread(int cpu)
+{
+    if (cpu < 0)
+        return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        LOG_WARN << "pin thread to cpu " << cpu << " failed, errno=" << err;
+        return false;
+    }
+    int node = nodeOf(cpu);
+    if (nodeCount() > 1 && node < MAX_NODES)
+    {
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        // 内核把maxnode减一后使用，和libnuma一样多传一位
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAX_NODES + 1) != 0)
+            LOG_WARN << "prefer memory of node " << node << " failed, errno=" << errno;
+    }
+    return true;
+}
+
+int Affinity::createThread(pthread_t *tid, int cpu, void *(*fn)(void *), void *arg)
+{
+    if (cpu < 0)
+        return pthread_create(tid, NULL, fn, arg);
+    ThreadStart *start = new ThreadStart{fn, arg, cpu};
+    int ret = pthread_create(tid, NULL, threadTrampoline, start);
+    if (ret != 0)
+        delete start;
+    return ret;
+}
+
+Affinity::NumaStats Affinity::numaStats()
+{
+    NumaStats stats;
+    for (int id : nodeIds())
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", id);
+        FILE *f = fopen(path, "r");
+        if (!f)
+            continue;
+        char name[32];
+        unsigned long long value;
+        while (fscanf(f, "%31s %llu", name, &value) == 2)
+        {
+            if (strcmp(name, "local_node") == 0)
+                stats.local_node += value;
+            else if (strcmp(name, "other_node") == 0)
+                stats.other_node += value;
+            else if (strcmp(name, "numa_miss") == 0)
+                stats.miss += value;
+        }
+        fclose(f);
+    }
+    return stats;
+}
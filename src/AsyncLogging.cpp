@@ -1,7 +1,19 @@
 #include "AsyncLogging.h"
 #include "Utils.h"
+#include "Affinity.h"
 #include <algorithm>
 #include <stdexcept>
+#include <cstdlib>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 namespace {
     void *threadFunction(void *arg)
@@ -10,27 +22,231 @@ namespace {
         AsyncLogger_->threadFunc();
         return NULL;
     }
+
+    // 环中的每条记录是一个首部加上日志内容，按16字节对齐，所以环末尾剩下的空间总能放下一个首部
+    struct RecordHeader
+    {
+        int64_t timestamp;
+        uint32_t len;
+        uint32_t unused;
+    };
+    const std::size_t RECORD_ALIGN = sizeof(RecordHeader);
+    const uint32_t WRAP_MARK = 0xffffffff;    // 环末尾放不下一条记录，剩下的空间跳过
+    const int FULL_RETRIES = 4;               // 环满时让出CPU的次数，之后丢弃
+    const int STALL_SLEEP_US = 100;           // 无损模式下让出CPU几次以后每次睡眠的时间
+    const std::size_t MAX_PENDING_BLOCKS = 16;   // 一轮积压的块超过这个数量时先写出，限制后端的内存
+
+    int64_t now_us()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+
+    std::size_t recordSize(std::size_t len)
+    {
+        return sizeof(RecordHeader) + ((len + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1));
+    }
 } // namespace
 
+// 一个线程的环形缓冲区，tail_只由这个线程修改，head_只由后端修改
+class AsyncLogging::ThreadRing: public noncopyable
+{
+public:
+    ThreadRing(): data_(new char[RING_SIZE]), tail_(0), head_(0), dropped_(0), abandoned_(false) {}
+
+    // 放不下时返回false，half_full表示需要唤醒后端
+    bool tryPush(const char *logline, std::size_t len, int64_t timestamp, bool &half_full)
+    {
+        std::size_t need = recordSize(len);
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        std::size_t head = head_.load(std::memory_order_acquire);
+        std::size_t pos = tail & (RING_SIZE - 1);
+        std::size_t skip = RING_SIZE - pos < need ? RING_SIZE - pos : 0;
+        if (RING_SIZE - (tail - head) < skip + need)
+        {
+            half_full = true;
+            return false;
+        }
+        if (skip)
+        {
+            RecordHeader mark = {0, WRAP_MARK, 0};
+            memcpy(data_.get() + pos, &mark, sizeof(mark));
+            tail += skip;
+            pos = 0;
+        }
+        RecordHeader header = {timestamp, static_cast<uint32_t>(len), 0};
+        memcpy(data_.get() + pos, &header, sizeof(header));
+        memcpy(data_.get() + pos + sizeof(header), logline, len);
+        tail += need;
+        tail_.store(tail, std::memory_order_release);
+        half_full = tail - head > RING_SIZE / 2;
+        return true;
+    }
+
+    std::unique_ptr<char[]> data_;
+    char pad0_[64];     // 生产者和消费者修改的变量放在不同的缓存行
+    std::atomic<std::size_t> tail_;    // 单调增加的位置，取模后才是数组下标
+    char pad1_[64];
+    std::atomic<std::size_t> head_;
+    char pad2_[64];
+    std::atomic<unsigned long> dropped_;
+    std::atomic<bool> abandoned_;      // 线程已经退出，取完剩下的记录后可以删除
+};
+
+// 后端遍历一个环中[pos, end)之间的记录
+struct AsyncLogging::Cursor
+{
+    ThreadRing *ring;
+    std::size_t pos;
+    std::size_t end;
+    int64_t timestamp;
+    const char *line;
+    uint32_t len;
+
+    // 移动到下一条记录，没有了返回false
+    bool next()
+    {
+        while (pos < end)
+        {
+            RecordHeader header;
+            std::size_t offset = pos & (RING_SIZE - 1);
+            memcpy(&header, ring->data_.get() + offset, sizeof(header));
+            if (header.len == WRAP_MARK)
+            {
+                pos += RING_SIZE - offset;
+                continue;
+            }
+            timestamp = header.timestamp;
+            line = ring->data_.get() + offset + sizeof(header);
+            len = header.len;
+            return true;
+        }
+        return false;
+    }
+};
+
+#ifdef HAVE_ZLIB
+// 每块压缩成一个独立的gzip成员，多个成员连接起来仍然是合法的gzip文件，进程崩溃时也只损失最后一块
+class AsyncLogging::Compressor: public noncopyable
+{
+public:
+    Compressor()
+    {
+        memset(&zs_, 0, sizeof(zs_));
+        // 后端的速度比压缩率重要
+        ok_ = deflateInit2(&zs_, Z_BEST_SPEED, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~Compressor()
+    {
+        if (ok_)
+            deflateEnd(&zs_);
+    }
+    bool compress(const char *data, std::size_t len, std::string &out)
+    {
+        if (!ok_ || deflateReset(&zs_) != Z_OK)
+            return false;
+        out.resize(deflateBound(&zs_, len));
+        zs_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs_.avail_in = len;
+        zs_.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        zs_.avail_out = out.size();
+        int ret = deflate(&zs_, Z_FINISH);
+        out.resize(zs_.total_out);
+        return ret == Z_STREAM_END;
+    }
+
+private:
+    z_stream zs_;
+    bool ok_;
+};
+#else
+class AsyncLogging::Compressor: public noncopyable
+{
+public:
+    bool compress(const char *, std::size_t, std::string &) {return false;}
+};
+#endif
+
+bool AsyncLogging::ParseOptions(const std::string &spec, Options &options)
+{
+    Options result = options;
+    std::size_t i = 0;
+    while (i < spec.size())
+    {
+        std::size_t end = spec.find(',', i);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(i, end - i);
+        i = end + 1;
+        if (item.empty())
+            continue;
+        if (item == "gzip")
+        {
+#ifndef HAVE_ZLIB
+            return false;
+#endif
+            result.gzip = true;
+            continue;
+        }
+        if (item == "lossless")
+        {
+            result.lossless = true;
+            continue;
+        }
+        std::size_t eq = item.find('=');
+        if (eq == std::string::npos || eq + 1 == item.size() ||
+            item.find_first_not_of("0123456789", eq + 1) != std::string::npos || item.size() - eq > 10)
+            return false;
+        std::string key = item.substr(0, eq);
+        long value = atol(item.c_str() + eq + 1);
+        if (key == "roll")
+            result.roll_bytes = static_cast<std::size_t>(value) << 20;
+        else if (key == "interval")
+            result.roll_interval = value;
+        else if (key == "cpu")
+        {
+            std::vector<int> cpus;
+            if (!Affinity::ParseCpuList(item.substr(eq + 1), cpus))
+                return false;
+            result.cpu = cpus[0];
+        }
+        else
+            return false;
+    }
+    options = result;
+    return true;
+}
+
 std::vector<std::string> AsyncLogging::fileOpened_;
+std::atomic<uint64_t> AsyncLogging::nextId_(0);
+const std::size_t AsyncLogging::RING_SIZE;
 
-AsyncLogging::AsyncLogging(const std::string &filename,int flushIntervel):
-    file_(fopen(filename.c_str(), "a")),
-    filename_(filename),
+AsyncLogging::AsyncLogging(const std::string &basename, int flushIntervel, const Options &options):
+    fd_(-1),
+    basename_(basename),
     flushInterval_(flushIntervel),
+    options_(options),
+    id_(++nextId_),
     running_(false),
     locker_(),
     cond_(locker_),
-    currentBuffer_(new Buffer),
-    nextBuffer_(new Buffer)
+    wakeup_pending_(false),
+    dropped_total_(0),
+    stalls_(0),
+    rolls_(0),
+    outputBuffer_(new Buffer),
+    compressor_(options.gzip ? new Compressor() : nullptr),
+    fileBytes_(0),
+    openTime_(0),
+    fileSeq_(0),
+    lastOpenSecond_(-1)
 {
-    if (std::find(fileOpened_.begin(), fileOpened_.end(), filename) != fileOpened_.end())
+    if (std::find(fileOpened_.begin(), fileOpened_.end(), basename) != fileOpened_.end())
         throw std::runtime_error("Filename has been opened");
 
-    fileOpened_.push_back(filename);
-    currentBuffer_->bzero();
-    nextBuffer_->bzero();
-    buffer_.reserve(16);
+    fileOpened_.push_back(basename);
+    openFile();
 }
 
 AsyncLogging::~AsyncLogging()
@@ -39,103 +255,331 @@ AsyncLogging::~AsyncLogging()
         stop();
 }
 
+std::string AsyncLogging::filename()
+{
+    locker_.lock();
+    std::string name = filename_;
+    locker_.unlock();
+    return name;
+}
+
+// 文件名不会和已有的文件重复，已经存在时（例如同一秒内滚动或者重启）增加序号
+void AsyncLogging::openFile()
+{
+    std::string suffix = options_.binary ? ".blog" : ".log";
+    if (options_.gzip)
+        suffix += ".gz";
+    time_t now = time(NULL);
+    fileSeq_ = now == lastOpenSecond_ ? fileSeq_ + 1 : 0;
+    lastOpenSecond_ = now;
+    std::string name;
+    while (true)
+    {
+        name = get_logfile_name(basename_, fileSeq_ ? "." + std::to_string(fileSeq_) + suffix : suffix);
+        fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd_ >= 0 || errno != EEXIST)
+            break;
+        ++fileSeq_;
+    }
+    fileBytes_ = 0;
+    openTime_ = now;
+
+    // 二进制日志的文件头和调用点的定义，每个文件都能单独解码
+    locker_.lock();
+    filename_ = name;
+    std::vector<Header> headers = headers_;
+    locker_.unlock();
+    if (options_.binary)
+        output(BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+    for (const Header &header : headers)
+        outputRecord(header.record.data(), header.record.size(), header.timestamp);
+}
+
+void AsyncLogging::rollIfNeeded()
+{
+    if ((options_.roll_bytes > 0 && fileBytes_ >= options_.roll_bytes) ||
+        (options_.roll_interval > 0 && time(NULL) - openTime_ >= options_.roll_interval))
+    {
+        if (fd_ >= 0)
+            close(fd_);
+        openFile();
+        ++rolls_;
+    }
+}
+
 void AsyncLogging::start() 
 {
     running_ = true;
-    pthread_create(&tid_, NULL, threadFunction, this);
+    Affinity::createThread(&tid_, options_.cpu, threadFunction, this);
 }
 
 void AsyncLogging::stop()
 {
+    locker_.lock();
     running_ = false;
     cond_.signal();
+    locker_.unlock();
     pthread_join(tid_, NULL);
 }
 
-void AsyncLogging::append(const char *logline, int len)
+AsyncLogging::ThreadRing *AsyncLogging::threadRing()
+{
+    // 本线程在各个日志对象中的环，线程退出时标记为已放弃，由后端取完后删除
+    struct Holder
+    {
+        std::vector<std::pair<uint64_t, RingPtr>> rings;
+        ~Holder()
+        {
+            for (auto &r : rings)
+                r.second->abandoned_.store(true, std::memory_order_release);
+        }
+    };
+    static thread_local Holder holder;
+    for (auto &r : holder.rings)
+    {
+        if (r.first == id_)
+            return r.second.get();
+    }
+
+    RingPtr ring(new ThreadRing());
+    locker_.lock();
+    rings_.push_back(ring);
+    locker_.unlock();
+    holder.rings.push_back(std::make_pair(id_, ring));
+    return ring.get();
+}
+
+// 环满时唤醒后端并让出CPU，几次之后还是满的才丢弃，CPU比线程少时后端也能分到时间
+// 无损模式下一直等到有空间，但后端已经停止时只能丢弃
+void AsyncLogging::append(const char *logline, int len, int64_t timestamp)
+{
+    ThreadRing *ring = threadRing();
+    bool half_full = false;
+    for (int i = 0; !ring->tryPush(logline, len, timestamp, half_full); ++i)
+    {
+        wakeup();
+        if (i < FULL_RETRIES)
+        {
+            sched_yield();
+            continue;
+        }
+        if (!options_.lossless || !running_)
+        {
+            ring->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (i == FULL_RETRIES)
+            ++stalls_;
+        usleep(STALL_SLEEP_US);
+    }
+    if (half_full)
+        wakeup();
+}
+
+void AsyncLogging::appendHeader(const char *record, int len, int64_t timestamp)
+{
+    Header header = {timestamp, std::string(record, len)};
+    locker_.lock();
+    headers_.push_back(header);
+    locker_.unlock();
+    append(record, len, timestamp);
+}
+
+// 一轮只有第一个发现环过半的线程加锁通知后端
+void AsyncLogging::wakeup()
 {
+    if (wakeup_pending_.load(std::memory_order_relaxed) || wakeup_pending_.exchange(true))
+        return;
     locker_.lock();
-    if (currentBuffer_->avail() >= len)
+    cond_.signal();
+    locker_.unlock();
+}
+
+void AsyncLogging::output(const char *data, std::size_t len)
+{
+    if (outputBuffer_->avail() <= len)
+        sealBuffer();
+    outputBuffer_->append(data, len);
+}
+
+void AsyncLogging::sealBuffer()
+{
+    if (outputBuffer_->size() == 0)
+        return;
+    if (compressor_)
     {
-        currentBuffer_->append(logline, len);  // 最多的情况
+        compressed_.push_back(std::string());
+        if (!compressor_->compress(outputBuffer_->getData(), outputBuffer_->size(), compressed_.back()))
+            compressed_.pop_back();
+        outputBuffer_->reset();
     }
     else
     {
-        buffer_.push_back(std::move(currentBuffer_));
-        if (nextBuffer_)
-            currentBuffer_.reset(nextBuffer_.release());   // 较少发生
+        full_.push_back(std::move(outputBuffer_));
+        if (!spare_.empty())
+        {
+            outputBuffer_ = std::move(spare_.back());
+            spare_.pop_back();
+        }
         else
-            currentBuffer_.reset(new Buffer);    // 很少发生
-        currentBuffer_->append(logline, len);
-        cond_.signal();
+            outputBuffer_.reset(new Buffer);
     }
-
-    locker_.unlock();
+    if (full_.size() + compressed_.size() >= MAX_PENDING_BLOCKS)
+        writeBlocks();
 }
 
-void AsyncLogging::threadFunc()
+// 一次writev最多IOV_MAX块，只写了一部分时从写到的位置继续
+void AsyncLogging::writeBlocks()
 {
-    BufferPtr newBuffer1(new Buffer);
-    BufferPtr newBuffer2(new Buffer);
-    newBuffer1->bzero();
-    newBuffer2->bzero();
-    BufferVector buffersToWrite;
-    buffersToWrite.reserve(16);
+    std::vector<struct iovec> iov;
+    for (BufferPtr &block : full_)
+        iov.push_back({const_cast<char *>(block->getData()), block->size()});
+    for (std::string &block : compressed_)
+        iov.push_back({&block[0], block.size()});
+    std::size_t i = 0;
+    while (i < iov.size() && fd_ >= 0)
+    {
+        ssize_t written = writev(fd_, &iov[i], std::min<std::size_t>(iov.size() - i, IOV_MAX));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            break;
+        fileBytes_ += written;
+        while (written > 0)
+        {
+            std::size_t n = std::min<std::size_t>(written, iov[i].iov_len);
+            iov[i].iov_base = static_cast<char *>(iov[i].iov_base) + n;
+            iov[i].iov_len -= n;
+            written -= n;
+            if (iov[i].iov_len == 0)
+                ++i;
+        }
+    }
 
-    do
+    // 只保留两个空闲块，积压时多申请的块写完后释放
+    for (BufferPtr &block : full_)
     {
-        locker_.lock();
+        block->reset();
+        if (spare_.size() < 2)
+            spare_.push_back(std::move(block));
+    }
+    full_.clear();
+    compressed_.clear();
+}
 
-        if (buffer_.empty())
-            cond_.waitForSeconds(flushInterval_);
-        buffer_.push_back(std::move(currentBuffer_));
-        currentBuffer_.reset(newBuffer1.release());
-        buffersToWrite.swap(buffer_);
-        if (!nextBuffer_)
-            nextBuffer_.reset(newBuffer2.release());
+// 文本模式下记录就是一行日志，二进制模式下加上帧首部
+void AsyncLogging::outputRecord(const char *data, std::size_t len, int64_t timestamp)
+{
+    if (options_.binary)
+    {
+        BinLogFrame frame = {static_cast<uint32_t>(len), 0, timestamp};
+        output(reinterpret_cast<const char *>(&frame), sizeof(frame));
+    }
+    output(data, len);
+}
 
-        locker_.unlock();
+// 每个环取到当前写完的位置，多路归并，每次输出时间戳最小的记录，一个环取完后才释放它的空间
+std::size_t AsyncLogging::drainRings(std::vector<RingPtr> &rings)
+{
+    std::vector<Cursor> cursors;
+    for (RingPtr &ring : rings)
+    {
+        Cursor c;
+        c.ring = ring.get();
+        c.pos = ring->head_.load(std::memory_order_relaxed);
+        c.end = ring->tail_.load(std::memory_order_acquire);
+        if (c.next())
+            cursors.push_back(c);
+        else
+            ring->head_.store(c.end, std::memory_order_release);
+    }
 
-        char errorBuf[256] = {0};
-        // 丢弃过多的数据
-        if (buffersToWrite.size() > 25)
+    // 时间戳最小的环连续输出，直到超过第二小的时间戳，线程少或者日志集中在一个线程时几乎不用比较
+    std::size_t n = 0;
+    while (!cursors.empty())
+    {
+        std::size_t min = 0;
+        for (std::size_t i = 1; i < cursors.size(); ++i)
         {
-            snprintf(errorBuf, sizeof(errorBuf), "Dropped log messages at %s, %zd larger buffers\n",
-                     get_time_str().c_str(), buffersToWrite.size()-2);
-            
-            buffersToWrite.erase(buffersToWrite.begin() +2, buffersToWrite.end());
+            if (cursors[i].timestamp < cursors[min].timestamp)
+                min = i;
         }
-
-        // 写入硬盘
-        for (auto &bp : buffersToWrite)
+        int64_t limit = INT64_MAX;
+        for (std::size_t i = 0; i < cursors.size(); ++i)
         {
-            fwrite(bp->getData(), 1, bp->size(), file_);
+            if (i != min && cursors[i].timestamp < limit)
+                limit = cursors[i].timestamp;
         }
-        if (strlen(errorBuf) > 0)
-            fwrite(errorBuf, 1, strlen(errorBuf), file_);
-        
-        // 重新填充newBuffer1和newBuffer2
-        if (!newBuffer1)
-        {
-            newBuffer1.reset(buffersToWrite.back().release());
-            buffersToWrite.pop_back();
-            newBuffer1->reset();
+        Cursor &c = cursors[min];
+        bool more;
+        do
+        {
+            outputRecord(c.line, c.len, c.timestamp);
+            ++n;
+            c.pos += recordSize(c.len);
+            more = c.next();
+        } while (more && c.timestamp <= limit);
+        if (!more)
+        {
+            c.ring->head_.store(c.end, std::memory_order_release);
+            cursors.erase(cursors.begin() + min);
         }
-        if (!newBuffer2)
+    }
+    return n;
+}
+
+void AsyncLogging::threadFunc()
+{
+    std::vector<RingPtr> rings;
+    while (true)
+    {
+        locker_.lock();
+        if (running_ && !wakeup_pending_)
+            cond_.waitForSeconds(flushInterval_);
+        wakeup_pending_ = false;
+        bool stopping = !running_;
+        rings = rings_;
+        locker_.unlock();
+
+        drainRings(rings);
+
+        // 环满时前端丢弃的记录
+        unsigned long dropped = 0;
+        for (RingPtr &ring : rings)
+            dropped += ring->dropped_.exchange(0);
+        if (dropped > 0)
         {
-            newBuffer2.reset(buffersToWrite.back().release());
-            buffersToWrite.pop_back();
-            newBuffer2->reset();
+            dropped_total_ += dropped;
+            char errorBuf[256];
+            errorBuf[0] = RECORD_TEXT;
+            int skip = options_.binary ? 1 : 0;
+            int len = snprintf(errorBuf + skip, sizeof(errorBuf) - skip, "Dropped %lu log messages at %s, thread buffers full\n",
+                               dropped, get_time_str().c_str());
+            outputRecord(errorBuf, len + skip, now_us());
         }
-        buffersToWrite.clear();
 
-        // flush
-        fflush(file_);
-    } while (running_);
+        // 写入硬盘，最后一轮不再滚动
+        sealBuffer();
+        writeBlocks();
+        if (!stopping)
+            rollIfNeeded();
+
+        // 删除已经退出并且取完的线程的环
+        locker_.lock();
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const RingPtr &ring) {
+            return ring->abandoned_.load(std::memory_order_acquire) &&
+                   ring->head_.load(std::memory_order_relaxed) == ring->tail_.load(std::memory_order_acquire);
+        }), rings_.end());
+        locker_.unlock();
+        rings.clear();
+
+        if (stopping)
+            break;
+    }
 
-    fflush(file_);
-    fclose(file_);
-    auto it = std::find(fileOpened_.begin(), fileOpened_.end(), filename_);
+    if (fd_ >= 0)
+        close(fd_);
+    auto it = std::find(fileOpened_.begin(), fileOpened_.end(), basename_);
     if (it != fileOpened_.end())
         fileOpened_.erase(it);
 }
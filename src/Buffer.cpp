@@ -0,0 +1,115 @@
+#include "Buffer.h"
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+const std::size_t Buffer::INITIAL_SIZE;
+const std::size_t Buffer::MAX_IDLE_SIZE;
+
+const char *Buffer::findCRLF(const char *start) const
+{
+    const char *end = beginWrite();
+    if (!start || start >= end)
+        return nullptr;
+    const char *crlf = static_cast<const char *>(memmem(start, end - start, "\r\n", 2));
+    return crlf;
+}
+
+void Buffer::retrieve(std::size_t len)
+{
+    if (len < readableBytes())
+        readerIndex_ += len;
+    else
+        retrieveAll();
+}
+
+std::string Buffer::retrieveAsString(std::size_t len)
+{
+    len = std::min(len, readableBytes());
+    std::string str(peek(), len);
+    retrieve(len);
+    return str;
+}
+
+void Buffer::append(const char *data, std::size_t len)
+{
+    ensureWritableBytes(len);
+    std::copy(data, data + len, beginWrite());
+    hasWritten(len);
+}
+
+void Buffer::ensureWritableBytes(std::size_t len)
+{
+    if (writableBytes() < len)
+        makeSpace(len);
+}
+
+void Buffer::makeSpace(std::size_t len)
+{
+    std::size_t readable = readableBytes();
+    if (writableBytes() + readerIndex_ >= len)
+    {
+        // 前面已经读取的空间够用，把可读的数据挪到开头
+        std::copy(begin() + readerIndex_, begin() + writerIndex_, begin());
+    }
+    else
+    {
+        std::size_t new_size = std::max(buffer_.size() * 2, std::max(INITIAL_SIZE, readable + len));
+        std::vector<char> new_buffer(new_size);
+        if (readable > 0)
+            std::copy(begin() + readerIndex_, begin() + writerIndex_, new_buffer.begin());
+        buffer_.swap(new_buffer);
+    }
+    readerIndex_ = 0;
+    writerIndex_ = readable;
+}
+
+void Buffer::shrinkIfIdle()
+{
+    if (readableBytes() == 0 && buffer_.capacity() > MAX_IDLE_SIZE)
+    {
+        std::vector<char>().swap(buffer_);
+        readerIndex_ = writerIndex_ = 0;
+    }
+}
+
+ssize_t Buffer::readFd(int fd, int *savedErrno)
+{
+    char extrabuf[65536];
+    struct iovec vec[2];
+    const std::size_t writable = writableBytes();
+    int iovcnt = 0;
+    if (writable > 0)
+    {
+        vec[iovcnt].iov_base = beginWrite();
+        vec[iovcnt].iov_len = writable;
+        ++iovcnt;
+    }
+    vec[iovcnt].iov_base = extrabuf;
+    vec[iovcnt].iov_len = sizeof(extrabuf);
+    ++iovcnt;
+
+    const ssize_t n = readv(fd, vec, iovcnt);
+    if (n < 0)
+        *savedErrno = errno;
+    else if (static_cast<std::size_t>(n) <= writable)
+        writerIndex_ += n;
+    else
+    {
+        writerIndex_ += writable;
+        append(extrabuf, n - writable);
+    }
+    return n;
+}
+
+ssize_t Buffer::writeFd(int fd, int *savedErrno)
+{
+    ssize_t n = send(fd, peek(), readableBytes(), 0);
+    if (n < 0)
+        *savedErrno = errno;
+    else
+        retrieve(n);
+    return n;
+}
@@ -1,9 +1,6 @@
 #include "EchoTask.h"
 #include "Logging.h"
-#include <cstring>
-
-shared_ptr<TimerManager<Echo>> Echo::timer_manager_(nullptr);
-shared_ptr<Epoll<Echo>> Echo::epoll_(nullptr);
+#include <string>
 
 void Echo::Init(SP_TimerManager tm, SP_Epoll ep)
 {
@@ -11,35 +8,18 @@ void Echo::Init(SP_TimerManager tm, SP_Epoll ep)
     epoll_ = ep;
 }
 
-void Echo::linkTimer(SP_Timer timer)
-{
-    timer_ = timer;
-}
-
-void Echo::separateTimer()
+Echo::~Echo()
 {
-    if (timer_)
-    {
-        timer_->setDeleted();
-        timer_.reset();
-    }
-}
-
-void Echo::bilateralSeparateTimer()
-{
-    if (timer_)
-    {
-        timer_->separate();
-        timer_.reset();
-    }
+    if (timer_manager_)
+        timer_manager_->delTimer(this);
 }
 
 void Echo::process()
 {
     if (status == READY_TO_READ)
     {
-        // 先和计时器双向解耦
-        bilateralSeparateTimer();
+        // 处理期间不会超时
+        timer_manager_->delTimer(this);
         // 从sock读取数据
         int ret = read_from_sock();
         if (ret == READ_ERROR)
@@ -49,15 +29,16 @@ void Echo::process()
             disconnection();
             return;
         }
-        LOG_INFO << "receive message from " << inet_ntoa(addr_.sin_addr) <<" : " << m_buf;
+        LOG_INFO << "receive message from " << inet_ntoa(addr_.sin_addr) <<" : " << std::string(m_buf.peek(), m_buf.readableBytes());
         
         // 进行大小写变换
-        for (int i = 0; i < m_read_index; ++i)
+        char *data = m_buf.beginRead();
+        for (std::size_t i = 0; i < m_buf.readableBytes(); ++i)
         {
-            if (m_buf[i] >= 'a' && m_buf[i] <= 'z')
-                m_buf[i] += ('A'-'a');
-            else if (m_buf[i] >= 'A' && m_buf[i] <= 'Z')
-                m_buf[i] += ('a'-'A');
+            if (data[i] >= 'a' && data[i] <= 'z')
+                data[i] += ('A'-'a');
+            else if (data[i] >= 'A' && data[i] <= 'Z')
+                data[i] += ('a'-'A');
         }
         // 更改状态机
         status = READY_TO_WRITE;
@@ -81,14 +62,12 @@ void Echo::process()
             return;
         }
         LOG_INFO << "send message to " << inet_ntoa(addr_.sin_addr) << " successful";
-        // 清空数据缓存
-        memset(m_buf, 0, BUF_SIZE);
-        m_read_index = 0;
-        m_bytes_have_send = 0;
+        // 数据已全部取出，空闲时释放过大的缓冲区
+        m_buf.shrinkIfIdle();
         // 更改状态机
         status = READY_TO_READ;
         // 重新添加计时器
-        timer_manager_->addTimer(shared_from_this(), TIMEOUT);
+        timer_manager_->addTimer(this, TIMEOUT);
         // 修改epoll中注册的事件为等待读
         epoll_->epoll_mod(sock_, EPOLLIN | EPOLLET | EPOLLONESHOT, shared_from_this());
     }
@@ -97,53 +76,50 @@ void Echo::process()
 
 int Echo::read_from_sock()
 {
-    int str_len;
+    int saved_errno = 0;
+    ssize_t str_len;
     while (1)
     {
-        str_len = recv(sock_, m_buf+m_read_index, BUF_SIZE-m_read_index, 0);
+        str_len = m_buf.readFd(sock_, &saved_errno);
         if (str_len < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                if (m_buf[m_read_index-1] == '\n')
-                    m_buf[m_read_index-1] = '\0';
+            if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)
                 return READ_FINISH;
-            }
+            else if (saved_errno == EINTR)
+                continue;
             else
                 return READ_ERROR;
         }
         if (str_len == 0)
             return READ_ERROR;
-        else
-            m_read_index += str_len;
     }
 }
 
 int Echo::write_to_sock()
 {
-    if (m_buf[m_read_index-1] == '\0')
-        m_buf[m_read_index-1] = '\n';
-    int str_len;
-    while (m_bytes_have_send < m_read_index)
+    int saved_errno = 0;
+    ssize_t str_len;
+    while (m_buf.readableBytes() > 0)
     {
-        str_len = send(sock_, m_buf+m_bytes_have_send, strlen(m_buf+m_bytes_have_send), 0);
+        // 已发送的数据从缓冲区取出，下次从剩下的开始发
+        str_len = m_buf.writeFd(sock_, &saved_errno);
         if (str_len < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || EPOLLONESHOT)
+            if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)
                 return WRITE_AGAIN;
+            else if (saved_errno == EINTR)
+                continue;
             return WRITE_ERROR;
         }
         else if (str_len == 0)
             return WRITE_ERROR;
-        else
-            m_bytes_have_send += str_len;
     }
     return WRITE_FINISH;
 }
 
 void Echo::disconnection()
 {
-    bilateralSeparateTimer();
+    timer_manager_->delTimer(this);
     close(sock_);
     epoll_->epoll_del(sock_);
     /*  
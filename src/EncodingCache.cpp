@@ -0,0 +1,329 @@
+#include "EncodingCache.h"
+#include "Logging.h"
+#include "HttpHeaders.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+const std::size_t EncodingCache::NEGATIVE_ENTRY_BYTES;
+
+namespace {
+
+// 按Encoding的顺序排列
+const char *const ENCODING_NAMES[EncodingCache::ENCODING_NUM] = {"br", "zstd", "gzip"};
+const char *const SIDECAR_SUFFIXES[EncodingCache::ENCODING_NUM] = {".br", ".zst", ".gz"};
+
+// 压缩后至少要小这么多（百分比）才值得使用
+const std::size_t MIN_SAVING_PERCENT = 10;
+// 在事件循环或工作线程中同步压缩，级别太高会让同一线程上的其他连接等待几十毫秒
+const int GZIP_LEVEL = 6;
+const int BROTLI_QUALITY = 5;
+
+bool startsWith(const string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// 已经压缩过的格式（图片、音视频、gzip）再压缩没有意义
+bool isCompressible(const string &content_type)
+{
+    return startsWith(content_type, "text/") ||
+           content_type.find("javascript") != string::npos ||
+           content_type.find("json") != string::npos ||
+           content_type.find("xml") != string::npos;
+}
+
+// q=0表示不接受，其他值都按接受处理
+bool qualityIsZero(const StringPiece &param)
+{
+    std::size_t i = 0;
+    while (i < param.size() && (param[i] == ' ' || param[i] == '\t'))
+        ++i;
+    if (i + 2 > param.size() || (param[i] != 'q' && param[i] != 'Q') || param[i+1] != '=')
+        return false;
+    for (i += 2; i < param.size(); ++i)
+    {
+        if (param[i] != '0' && param[i] != '.' && param[i] != ' ' && param[i] != '\t')
+            return false;
+    }
+    return true;
+}
+
+bool readAll(int fd, std::size_t size, string &body)
+{
+    body.resize(size);
+    std::size_t have_read = 0;
+    while (have_read < size)
+    {
+        ssize_t len = pread(fd, &body[have_read], size - have_read, have_read);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        have_read += len;
+    }
+    return true;
+}
+
+bool compress(int encoding, const string &in, string &out)
+{
+#ifdef HAVE_ZLIB
+    if (encoding == EncodingCache::ENCODING_GZIP)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // windowBits加16输出gzip格式
+        if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        out.resize(deflateBound(&zs, in.size()));
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+        zs.avail_in = in.size();
+        zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        zs.avail_out = out.size();
+        int ret = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+#endif
+#ifdef HAVE_BROTLI
+    if (encoding == EncodingCache::ENCODING_BR)
+    {
+        std::size_t out_size = BrotliEncoderMaxCompressedSize(in.size());
+        if (out_size == 0)
+            return false;
+        out.resize(out_size);
+        if (!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(),
+                                   reinterpret_cast<const uint8_t *>(in.data()), &out_size,
+                                   reinterpret_cast<uint8_t *>(&out[0])))
+            return false;
+        out.resize(out_size);
+        return true;
+    }
+#endif
+    (void)encoding;
+    (void)in;
+    (void)out;
+    return false;
+}
+
+} // namespace
+
+EncodingCache *EncodingCache::instance_ = nullptr;
+
+bool EncodingCache::Init(std::size_t capacity, std::size_t max_file_size)
+{
+    if (instance_ || capacity == 0)
+        return true;
+    instance_ = new EncodingCache(capacity, max_file_size);
+    return true;
+}
+
+EncodingCache::EncodingCache(std::size_t capacity, std::size_t max_file_size):
+    shard_capacity_(capacity / SHARD_NUM > 0 ? capacity / SHARD_NUM : 1),
+    max_file_size_(max_file_size), hits_(0), misses_(0), compressed_(0), sidecars_(0)
+{
+
+}
+
+/*
+    Accept-Encoding: gzip, deflate, br;q=1.0, *;q=0
+    没有列出的编码按"*"处理，没有"*"时不接受
+*/
+unsigned EncodingCache::acceptedEncodings(const StringPiece &accept_encoding)
+{
+    unsigned listed = 0, accepted = 0;
+    bool wildcard = false;
+    std::size_t i = 0;
+    while (i < accept_encoding.size())
+    {
+        while (i < accept_encoding.size() && (accept_encoding[i] == ' ' || accept_encoding[i] == '\t' || accept_encoding[i] == ','))
+            ++i;
+        std::size_t begin = i;
+        while (i < accept_encoding.size() && accept_encoding[i] != ',')
+            ++i;
+        StringPiece item(accept_encoding.data() + begin, i - begin);
+
+        // 编码名和参数
+        std::size_t name_len = 0;
+        while (name_len < item.size() && item[name_len] != ';' && item[name_len] != ' ' && item[name_len] != '\t')
+            ++name_len;
+        StringPiece name(item.data(), name_len);
+        std::size_t semicolon = name_len;
+        while (semicolon < item.size() && item[semicolon] != ';')
+            ++semicolon;
+        bool zero = semicolon < item.size() &&
+                    qualityIsZero(StringPiece(item.data() + semicolon + 1, item.size() - semicolon - 1));
+
+        if (name == "*")
+        {
+            wildcard = !zero;
+            continue;
+        }
+        for (int e = 0; e < ENCODING_NUM; ++e)
+        {
+            // x-gzip是gzip的旧名字
+            if (name.equalsIgnoreCase(ENCODING_NAMES[e]) || (e == ENCODING_GZIP && name.equalsIgnoreCase("x-gzip")))
+            {
+                listed |= 1u << e;
+                if (!zero)
+                    accepted |= 1u << e;
+            }
+        }
+    }
+    if (wildcard)
+        accepted |= ((1u << ENCODING_NUM) - 1) & ~listed;
+    return accepted;
+}
+
+shared_ptr<const CachedFile> EncodingCache::select(unsigned accepted, const string &path, const FileId &id,
+                                                   const string &content_type, const string &last_modified,
+                                                   const SP_CachedFile &original, int fd)
+{
+    if (static_cast<std::size_t>(id.size) > max_file_size_)
+        return nullptr;
+    for (int e = 0; e < ENCODING_NUM; ++e)
+    {
+        if (!(accepted & (1u << e)))
+            continue;
+        Key key = {id, e};
+        SP_CachedFile file;
+        LookupResult result = lookup(key, file);
+        if (result == LOOKUP_BUSY)
+            return nullptr;     // 其他线程正在生成，这次发送未编码的内容
+        if (result == LOOKUP_BUILD)
+        {
+            // 第一次请求这种编码：查找预压缩文件或者压缩，结果（包括没有结果）都缓存下来
+            file = build(e, path, id, content_type, last_modified, original, fd);
+            insert(key, file);
+        }
+        if (file)
+            return file;
+    }
+    return nullptr;
+}
+
+EncodingCache::Shard &EncodingCache::shardOf(const Key &key)
+{
+    return shards_[KeyHash()(key) % SHARD_NUM];
+}
+
+EncodingCache::LookupResult EncodingCache::lookup(const Key &key, SP_CachedFile &file)
+{
+    Shard &shard = shardOf(key);
+    shard.locker_.lock();
+    auto it = shard.index_.find(key);
+    if (it == shard.index_.end())
+    {
+        bool first = shard.building_.insert(key).second;
+        shard.locker_.unlock();
+        ++misses_;
+        return first ? LOOKUP_BUILD : LOOKUP_BUSY;
+    }
+    shard.lru_.splice(shard.lru_.begin(), shard.lru_, it->second);
+    file = it->second->file;
+    shard.locker_.unlock();
+    ++hits_;
+    return LOOKUP_HIT;
+}
+
+void EncodingCache::insert(const Key &key, const SP_CachedFile &file)
+{
+    std::size_t bytes = file ? file->body.size() : NEGATIVE_ENTRY_BYTES;
+    Shard &shard = shardOf(key);
+    shard.locker_.lock();
+    shard.building_.erase(key);
+    if (shard.index_.find(key) != shard.index_.end())
+    {
+        shard.locker_.unlock();
+        return;
+    }
+    Entry entry = {key, file};
+    shard.lru_.push_front(entry);
+    shard.index_[key] = shard.lru_.begin();
+    shard.bytes_ += bytes;
+    while (shard.bytes_ > shard_capacity_ && shard.lru_.size() > 1)
+    {
+        const Entry &victim = shard.lru_.back();
+        shard.bytes_ -= victim.file ? victim.file->body.size() : NEGATIVE_ENTRY_BYTES;
+        shard.index_.erase(victim.key);
+        shard.lru_.pop_back();
+    }
+    shard.locker_.unlock();
+}
+
+shared_ptr<const CachedFile> EncodingCache::build(int encoding, const string &path, const FileId &id,
+                                                  const string &content_type, const string &last_modified,
+                                                  const SP_CachedFile &original, int fd)
+{
+    shared_ptr<CachedFile> file(new CachedFile);
+    if (readSidecar(encoding, path, id, file->body))
+        ++sidecars_;
+    else
+    {
+        if (!isCompressible(content_type))
+            return nullptr;
+        string body;
+        if (!original && (fd < 0 || !readAll(fd, id.size, body)))
+            return nullptr;
+        const string &in = original ? original->body : body;
+        if (!compress(encoding, in, file->body) ||
+            file->body.size() * 100 > in.size() * (100 - MIN_SAVING_PERCENT))
+            return nullptr;
+        ++compressed_;
+        LOG_INFO << "compress " << path << " with " << ENCODING_NAMES[encoding] << ": "
+                 << in.size() << " -> " << file->body.size() << " bytes";
+    }
+    file->path = path;
+    file->content_type = content_type;
+    file->content_length = std::to_string(file->body.size());
+    file->last_modified = last_modified;
+    file->content_encoding = ENCODING_NAMES[encoding];
+    file->id = id;
+    file->etag = HttpHeaders::etag(id, ENCODING_NAMES[encoding]);
+    file->max_age = HttpHeaders::maxAge(content_type);
+    file->head_fields = HttpHeaders::fileFields(*file);
+    return file;
+}
+
+// 预压缩文件必须是普通文件，并且不比原文件旧，否则说明原文件更新后没有重新生成
+bool EncodingCache::readSidecar(int encoding, const string &path, const FileId &id, string &body)
+{
+    int fd = open((path + SIDECAR_SUFFIXES[encoding]).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat file_info;
+    bool ok = fstat(fd, &file_info) == 0 && S_ISREG(file_info.st_mode) &&
+              static_cast<std::size_t>(file_info.st_size) <= max_file_size_ &&
+              (file_info.st_mtim.tv_sec > id.mtime_sec ||
+               (file_info.st_mtim.tv_sec == id.mtime_sec && file_info.st_mtim.tv_nsec >= id.mtime_nsec)) &&
+              readAll(fd, file_info.st_size, body);
+    close(fd);
+    return ok;
+}
+
+EncodingCache::Stats EncodingCache::stats()
+{
+    Stats st;
+    st.hits = hits_;
+    st.misses = misses_;
+    st.compressed = compressed_;
+    st.sidecars = sidecars_;
+    st.entries = 0;
+    st.bytes = 0;
+    for (Shard &shard : shards_)
+    {
+        shard.locker_.lock();
+        st.entries += shard.index_.size();
+        st.bytes += shard.bytes_;
+        shard.locker_.unlock();
+    }
+    return st;
+}
@@ -0,0 +1,284 @@
+#include "FileCache.h"
+#include "Logging.h"
+#include "Utils.h"
+#include "HttpHeaders.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <functional>
+
+namespace {
+    // 文件内容被修改，或者文件被删除、移动、替换时都要让缓存失效
+    const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF;
+} // namespace
+
+FileCache *FileCache::instance_ = nullptr;
+
+bool FileCache::Init(std::size_t capacity, std::size_t max_file_size)
+{
+    if (instance_ || capacity == 0)
+        return true;
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+        LOG_ERROR << "inotify_init failed, file cache disabled, errno=" << errno;
+        return false;
+    }
+    FileCache *cache = new FileCache(capacity, max_file_size, inotify_fd);
+
+    // 后台线程阻塞在inotify_fd上，缓存和进程的生命周期相同
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, inotifyThread, cache) != 0)
+    {
+        LOG_ERROR << "Create inotify thread failed, file cache disabled";
+        close(inotify_fd);
+        delete cache;
+        return false;
+    }
+    pthread_detach(tid);
+    instance_ = cache;
+    return true;
+}
+
+FileCache::FileCache(std::size_t capacity, std::size_t max_file_size, int inotify_fd):
+    shard_capacity_(capacity / SHARD_NUM > 0 ? capacity / SHARD_NUM : 1),
+    max_file_size_(max_file_size), inotify_fd_(inotify_fd),
+    hits_(0), misses_(0), evictions_(0), invalidations_(0)
+{
+
+}
+
+FileCache::Shard &FileCache::shardOf(const string &path)
+{
+    return shards_[std::hash<string>()(path) % SHARD_NUM];
+}
+
+shared_ptr<const CachedFile> FileCache::get(const string &path)
+{
+    Shard &shard = shardOf(path);
+    shard.locker_.lock();
+    auto it = shard.index_.find(path);
+    if (it == shard.index_.end())
+    {
+        shard.locker_.unlock();
+        ++misses_;
+        return nullptr;
+    }
+    shard.lru_.splice(shard.lru_.begin(), shard.lru_, it->second);
+    SP_CachedFile file = *it->second;
+    shard.locker_.unlock();
+    ++hits_;
+    return file;
+}
+
+shared_ptr<const CachedFile> FileCache::load(const string &path, const string &content_type)
+{
+    // 先监视再读取，读取过程中文件被修改也能收到通知
+    if (!watch(path))
+        return nullptr;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        unwatch(std::vector<string>(1, path));
+        return nullptr;
+    }
+    struct stat file_info;
+    if (fstat(fd, &file_info) < 0 || !S_ISREG(file_info.st_mode) ||
+        static_cast<std::size_t>(file_info.st_size) > max_file_size_)
+    {
+        close(fd);
+        unwatch(std::vector<string>(1, path));
+        return nullptr;
+    }
+
+    shared_ptr<CachedFile> file(new CachedFile);
+    file->path = path;
+    file->body.resize(file_info.st_size);
+    std::size_t have_read = 0;
+    while (have_read < file->body.size())
+    {
+        ssize_t len = read(fd, &file->body[have_read], file->body.size() - have_read);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        have_read += len;
+    }
+    close(fd);
+    if (have_read != file->body.size())
+    {
+        unwatch(std::vector<string>(1, path));
+        return nullptr;
+    }
+    file->content_type = content_type;
+    file->content_length = std::to_string(file->body.size());
+    file->last_modified = get_gmt_time_str(file_info.st_mtime);
+    file->id = FileId::fromStat(file_info);
+    file->etag = HttpHeaders::etag(file->id);
+    file->max_age = HttpHeaders::maxAge(content_type);
+    file->head_fields = HttpHeaders::fileFields(*file);
+
+    // 插入缓存并淘汰最久未使用的文件
+    std::vector<string> evicted;
+    Shard &shard = shardOf(path);
+    shard.locker_.lock();
+    auto it = shard.index_.find(path);
+    if (it != shard.index_.end())
+    {
+        shard.bytes_ -= (*it->second)->body.size();
+        shard.lru_.erase(it->second);
+        shard.index_.erase(it);
+    }
+    shard.lru_.push_front(file);
+    shard.index_[path] = shard.lru_.begin();
+    shard.bytes_ += file->body.size();
+    while (shard.bytes_ > shard_capacity_ && shard.lru_.size() > 1)
+    {
+        const SP_CachedFile &victim = shard.lru_.back();
+        shard.bytes_ -= victim->body.size();
+        evicted.push_back(victim->path);
+        shard.index_.erase(victim->path);
+        shard.lru_.pop_back();
+        ++evictions_;
+    }
+    shard.locker_.unlock();
+
+    unwatch(evicted);
+
+    // 读取期间收到了通知，监视已被移除，刚读到的内容只用于这一次请求
+    watch_locker_.lock();
+    bool still_watched = path2wd_.find(path) != path2wd_.end();
+    watch_locker_.unlock();
+    if (!still_watched)
+        erase(path);
+    return file;
+}
+
+void FileCache::erase(const string &path)
+{
+    Shard &shard = shardOf(path);
+    shard.locker_.lock();
+    auto it = shard.index_.find(path);
+    if (it != shard.index_.end())
+    {
+        shard.bytes_ -= (*it->second)->body.size();
+        shard.lru_.erase(it->second);
+        shard.index_.erase(it);
+        ++invalidations_;
+    }
+    shard.locker_.unlock();
+}
+
+bool FileCache::watch(const string &path)
+{
+    watch_locker_.lock();
+    if (path2wd_.find(path) != path2wd_.end())
+    {
+        watch_locker_.unlock();
+        return true;
+    }
+    int wd = inotify_add_watch(inotify_fd_, path.c_str(), WATCH_MASK);
+    if (wd >= 0)
+    {
+        wd2paths_[wd].insert(path);
+        path2wd_[path] = wd;
+    }
+    watch_locker_.unlock();
+    return wd >= 0;
+}
+
+// 被淘汰的文件不再需要监视，同一个文件的所有路径都被淘汰后才移除监视
+void FileCache::unwatch(const std::vector<string> &paths)
+{
+    if (paths.empty())
+        return;
+    watch_locker_.lock();
+    for (const string &path : paths)
+    {
+        auto it = path2wd_.find(path);
+        if (it == path2wd_.end())
+            continue;
+        int wd = it->second;
+        path2wd_.erase(it);
+        auto &same_file = wd2paths_[wd];
+        same_file.erase(path);
+        if (same_file.empty())
+        {
+            wd2paths_.erase(wd);
+            inotify_rm_watch(inotify_fd_, wd);
+        }
+    }
+    watch_locker_.unlock();
+}
+
+void *FileCache::inotifyThread(void *arg)
+{
+    static_cast<FileCache *>(arg)->handleInotify();
+    return NULL;
+}
+
+void FileCache::handleInotify()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true)
+    {
+        ssize_t len = read(inotify_fd_, buf, sizeof(buf));
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR << "read inotify failed, errno=" << errno;
+            return;
+        }
+
+        for (char *ptr = buf; ptr < buf + len; )
+        {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            // 取出这个文件的所有路径，并移除监视，下次加入缓存时重新监视
+            std::vector<string> paths;
+            watch_locker_.lock();
+            auto it = wd2paths_.find(event->wd);
+            if (it != wd2paths_.end())
+            {
+                paths.assign(it->second.begin(), it->second.end());
+                for (const string &path : paths)
+                    path2wd_.erase(path);
+                wd2paths_.erase(it);
+                if (!(event->mask & IN_IGNORED))
+                    inotify_rm_watch(inotify_fd_, event->wd);
+            }
+            watch_locker_.unlock();
+
+            for (const string &path : paths)
+            {
+                erase(path);
+                LOG_INFO << "file cache invalidate " << path;
+            }
+        }
+    }
+}
+
+FileCache::Stats FileCache::stats()
+{
+    Stats st;
+    st.hits = hits_;
+    st.misses = misses_;
+    st.evictions = evictions_;
+    st.invalidations = invalidations_;
+    st.entries = 0;
+    st.bytes = 0;
+    for (Shard &shard : shards_)
+    {
+        shard.locker_.lock();
+        st.entries += shard.index_.size();
+        st.bytes += shard.bytes_;
+        shard.locker_.unlock();
+    }
+    return st;
+}
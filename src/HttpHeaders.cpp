@@ -0,0 +1,274 @@
+#include "HttpHeaders.h"
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Metrics.h"
+
+const int HttpHeaders::KEEP_ALIVE_TIMEOUT;
+const int HttpHeaders::STATUS_NUM;
+
+const HttpHeaders::Status HttpHeaders::statuses_[STATUS_NUM] = {
+    {200, "OK", false},
+    {206, "Partial Content", false},
+    {304, "Not Modified", false},
+    {400, "Bad Request", true},
+    {404, "Not Found", true},
+    {416, "Range Not Satisfiable", false},
+};
+
+pthread_once_t HttpHeaders::once_control_ = PTHREAD_ONCE_INIT;
+string HttpHeaders::connection_fields_[2];
+string HttpHeaders::status_lines_[STATUS_NUM][2];
+string HttpHeaders::canned_heads_[STATUS_NUM][2];
+string HttpHeaders::canned_bodies_[STATUS_NUM];
+std::vector<HttpHeaders::CacheRule> HttpHeaders::cache_rules_;
+
+namespace {
+
+const char SERVER_NAME[] = "Huanggomery's Web Server";
+const char FILE_FIELDS[] = "Accept-Ranges: bytes\r\nVary: Accept-Encoding\r\n";
+
+// 每个线程缓存的首部结尾，秒数变化时才重新格式化
+struct DateCache
+{
+    time_t sec;
+    std::size_t len;
+    char tail[128];
+};
+thread_local DateCache t_date = {-1, 0, {0}};
+
+// 每个线程缓存最近一次的Cache-Control和Expires，大多数文件的策略相同
+struct ExpiresCache
+{
+    time_t sec;
+    int max_age;
+    std::size_t len;
+    char fields[128];
+};
+thread_local ExpiresCache t_expires = {-1, -1, 0, {0}};
+
+// 把n写成十进制，返回写入的字节数
+std::size_t formatSize(char *buf, std::size_t n)
+{
+    char tmp[24];
+    std::size_t len = 0;
+    do
+    {
+        tmp[len++] = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    for (std::size_t i = 0; i < len; ++i)
+        buf[i] = tmp[len - 1 - i];
+    return len;
+}
+
+}
+
+void HttpHeaders::_init()
+{
+    connection_fields_[0] = "Connection: close\r\n";
+    connection_fields_[1] = "Connection: keep-alive\r\nKeep-Alive: timeout=" + std::to_string(KEEP_ALIVE_TIMEOUT / 1000) + "\r\n";
+    for (int i = 0; i < STATUS_NUM; ++i)
+    {
+        string line = "HTTP/1.1 " + std::to_string(statuses_[i].code) + " " + statuses_[i].reason + "\r\n";
+        status_lines_[i][0] = line + connection_fields_[0];
+        status_lines_[i][1] = line + connection_fields_[1];
+        if (!statuses_[i].canned)
+            continue;
+        canned_bodies_[i] = errorPage(statuses_[i].code, statuses_[i].reason);
+        for (int keep_alive = 0; keep_alive < 2; ++keep_alive)
+        {
+            canned_heads_[i][keep_alive] = status_lines_[i][keep_alive] +
+                "Content-Length: " + std::to_string(canned_bodies_[i].size()) + "\r\n" +
+                "Content-Type: text/html; charset=utf-8\r\n";
+        }
+    }
+}
+
+int HttpHeaders::_index(int status)
+{
+    for (int i = 0; i < STATUS_NUM; ++i)
+    {
+        if (statuses_[i].code == status)
+            return i;
+    }
+    return -1;
+}
+
+const char *HttpHeaders::reason(int status)
+{
+    int i = _index(status);
+    return i < 0 ? "Unknown" : statuses_[i].reason;
+}
+
+void HttpHeaders::appendStatus(Buffer &buf, int status, bool keep_alive)
+{
+    pthread_once(&once_control_, _init);
+    Metrics::response(status);
+    int i = _index(status);
+    if (i >= 0)
+    {
+        buf.append(status_lines_[i][keep_alive]);
+        return;
+    }
+    // 不在表中的状态码
+    buf.append("HTTP/1.1 " + std::to_string(status) + " Unknown\r\n");
+    buf.append(connection_fields_[keep_alive]);
+}
+
+void HttpHeaders::appendField(Buffer &buf, const StringPiece &name, const StringPiece &value)
+{
+    buf.ensureWritableBytes(name.size() + value.size() + 4);
+    char *p = buf.beginWrite();
+    memcpy(p, name.data(), name.size());
+    p += name.size();
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, value.data(), value.size());
+    p += value.size();
+    *p++ = '\r';
+    *p++ = '\n';
+    buf.hasWritten(name.size() + value.size() + 4);
+}
+
+void HttpHeaders::appendContentLength(Buffer &buf, std::size_t length)
+{
+    static const char prefix[] = "Content-Length: ";
+    buf.ensureWritableBytes(sizeof(prefix) + 24);
+    char *p = buf.beginWrite();
+    memcpy(p, prefix, sizeof(prefix) - 1);
+    std::size_t len = sizeof(prefix) - 1;
+    len += formatSize(p + len, length);
+    p[len++] = '\r';
+    p[len++] = '\n';
+    buf.hasWritten(len);
+}
+
+void HttpHeaders::appendEnd(Buffer &buf)
+{
+    time_t now = time(NULL);
+    if (now != t_date.sec)
+    {
+        struct tm tm_time;
+        gmtime_r(&now, &tm_time);
+        std::size_t len = strftime(t_date.tail, sizeof(t_date.tail), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm_time);
+        len += snprintf(t_date.tail + len, sizeof(t_date.tail) - len, "Server: %s\r\n\r\n", SERVER_NAME);
+        t_date.len = len;
+        t_date.sec = now;
+    }
+    buf.append(t_date.tail, t_date.len);
+}
+
+bool HttpHeaders::appendCanned(Buffer &buf, int status, bool keep_alive)
+{
+    pthread_once(&once_control_, _init);
+    int i = _index(status);
+    if (i < 0 || !statuses_[i].canned)
+        return false;
+    Metrics::response(status);
+    buf.append(canned_heads_[i][keep_alive]);
+    appendEnd(buf);
+    buf.append(canned_bodies_[i]);
+    return true;
+}
+
+string HttpHeaders::errorPage(int status, const string &msg)
+{
+    string entity_body;
+    entity_body += "<html><title>哎呀~出错了</title>";
+    entity_body += "<body bgcolor=\"ffffff\">";
+    entity_body += std::to_string(status) + " " + msg;
+    entity_body += "<hr><em> " + string(SERVER_NAME) + "</em>\n</body></html>";
+    return entity_body;
+}
+
+// 发送哪种编码取决于Accept-Encoding，所以总是带上Vary
+void HttpHeaders::appendFileMeta(Buffer &buf, const StringPiece &last_modified, const StringPiece &etag)
+{
+    buf.append(FILE_FIELDS, sizeof(FILE_FIELDS) - 1);
+    appendField(buf, "Last-Modified", last_modified);
+    appendField(buf, "ETag", etag);
+}
+
+string HttpHeaders::fileFields(const CachedFile &file)
+{
+    string fields = FILE_FIELDS;
+    fields += "Last-Modified: " + file.last_modified + "\r\n";
+    fields += "ETag: " + file.etag + "\r\n";
+    if (!file.content_encoding.empty())
+        fields += "Content-Encoding: " + file.content_encoding + "\r\n";
+    fields += "Content-Length: " + file.content_length + "\r\n";
+    fields += "Content-Type: " + file.content_type + "\r\n";
+    return fields;
+}
+
+string HttpHeaders::etag(const FileId &id, const char *suffix)
+{
+    char buf[96];
+    bool weak = id.mtime_sec >= time(NULL) - 1;
+    int len = snprintf(buf, sizeof(buf), "%s\"%lx-%lx-%lx%08lx%s%s\"", weak ? "W/" : "",
+                       static_cast<unsigned long>(id.ino), static_cast<unsigned long>(id.size),
+                       static_cast<unsigned long>(id.mtime_sec), static_cast<unsigned long>(id.mtime_nsec),
+                       suffix ? "-" : "", suffix ? suffix : "");
+    return string(buf, len);
+}
+
+bool HttpHeaders::InitCachePolicy(const string &spec)
+{
+    std::vector<CacheRule> rules;
+    std::size_t i = 0;
+    while (i < spec.size())
+    {
+        std::size_t end = spec.find(',', i);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(i, end - i);
+        i = end + 1;
+        if (item.empty())
+            continue;
+        std::size_t eq = item.find('=');
+        if (eq == string::npos || eq == 0 || eq + 1 == item.size() ||
+            item.find_first_not_of("0123456789", eq + 1) != string::npos || item.size() - eq > 10)
+            return false;
+        CacheRule rule = {item.substr(0, eq), atoi(item.c_str() + eq + 1)};
+        rules.push_back(rule);
+    }
+    cache_rules_.swap(rules);
+    return true;
+}
+
+int HttpHeaders::maxAge(const string &content_type)
+{
+    for (const CacheRule &rule : cache_rules_)
+    {
+        if (content_type.compare(0, rule.prefix.size(), rule.prefix) == 0)
+            return rule.max_age;
+    }
+    return -1;
+}
+
+void HttpHeaders::appendCachePolicy(Buffer &buf, int max_age)
+{
+    static const char no_cache[] = "Cache-Control: no-cache\r\n";
+    if (max_age < 0)
+        return;
+    if (max_age == 0)
+    {
+        buf.append(no_cache, sizeof(no_cache) - 1);
+        return;
+    }
+    time_t now = time(NULL);
+    if (now != t_expires.sec || max_age != t_expires.max_age)
+    {
+        time_t expires = now + max_age;
+        struct tm tm_time;
+        gmtime_r(&expires, &tm_time);
+        std::size_t len = snprintf(t_expires.fields, sizeof(t_expires.fields), "Cache-Control: max-age=%d\r\n", max_age);
+        len += strftime(t_expires.fields + len, sizeof(t_expires.fields) - len, "Expires: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm_time);
+        t_expires.len = len;
+        t_expires.sec = now;
+        t_expires.max_age = max_age;
+    }
+    buf.append(t_expires.fields, t_expires.len);
+}
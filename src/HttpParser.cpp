@@ -0,0 +1,292 @@
+#include "HttpParser.h"
+
+const std::size_t HttpParser::MAX_HEADERS;
+const std::size_t HttpParser::MAX_HEADER_BYTES;
+
+namespace {
+
+// RFC 7230中token允许的字符
+bool isTokenChar(char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return true;
+    switch (c)
+    {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+    case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 可见字符，以及首部字段值中允许的非ASCII字节
+bool isFieldChar(char c)
+{
+    unsigned char u = static_cast<unsigned char>(c);
+    return u > 0x20 && u != 0x7f;
+}
+
+// 逗号分隔的列表中是否有某个元素（不区分大小写），用于Connection字段
+bool listContains(const StringPiece &list, const StringPiece &item)
+{
+    std::size_t i = 0;
+    while (i < list.size())
+    {
+        while (i < list.size() && (list[i] == ' ' || list[i] == '\t' || list[i] == ','))
+            ++i;
+        std::size_t begin = i;
+        while (i < list.size() && list[i] != ',')
+            ++i;
+        std::size_t end = i;
+        while (end > begin && (list[end-1] == ' ' || list[end-1] == '\t'))
+            --end;
+        if (StringPiece(list.data() + begin, end - begin).equalsIgnoreCase(item))
+            return true;
+    }
+    return false;
+}
+
+}
+
+void HttpParser::reset()
+{
+    state_ = S_START;
+    pos_ = 0;
+    token_.offset = token_.len = 0;
+    header_.name.offset = header_.name.len = 0;
+    header_.value.offset = header_.value.len = 0;
+    value_end_ = 0;
+    uri_.offset = uri_.len = 0;
+    headers_.clear();
+    method_ = METHOD_UNKNOWN;
+    version_ = HTTP1_1;
+    connection_ = CONNECTION_DEFAULT;
+    content_length_ = -1;
+}
+
+int HttpParser::parse(const char *data, std::size_t len)
+{
+    if (state_ == S_DONE)
+        return PARSE_FINISH;
+    if (state_ == S_ERROR)
+        return PARSE_ERROR;
+
+    std::size_t limit = len < MAX_HEADER_BYTES ? len : MAX_HEADER_BYTES;
+    while (pos_ < limit)
+    {
+        char c = data[pos_];
+        switch (state_)
+        {
+        case S_START:
+            if (c == '\r' || c == '\n')
+                break;
+            if (!isTokenChar(c))
+                return fail();
+            token_.offset = pos_;
+            state_ = S_METHOD;
+            break;
+
+        case S_METHOD:
+            if (c == ' ')
+            {
+                token_.len = pos_ - token_.offset;
+                if (!finishMethod(data))
+                    return fail();
+                state_ = S_URI_START;
+            }
+            else if (!isTokenChar(c))
+                return fail();
+            break;
+
+        // 只支持origin-form，即以'/'开头的路径
+        case S_URI_START:
+            if (c != '/')
+                return fail();
+            uri_.offset = pos_;
+            state_ = S_URI;
+            break;
+
+        case S_URI:
+            if (c == ' ')
+            {
+                uri_.len = pos_ - uri_.offset;
+                token_.offset = pos_ + 1;
+                state_ = S_VERSION;
+            }
+            else if (!isFieldChar(c))
+                return fail();
+            break;
+
+        case S_VERSION:
+            if (c == '\r' || c == '\n')
+            {
+                token_.len = pos_ - token_.offset;
+                if (!finishVersion(data))
+                    return fail();
+                state_ = c == '\r' ? S_REQUEST_LINE_LF : S_HEADER_START;
+            }
+            else if (pos_ - token_.offset >= 8)     // 比"HTTP/1.1"长
+                return fail();
+            break;
+
+        case S_REQUEST_LINE_LF:
+            if (c != '\n')
+                return fail();
+            state_ = S_HEADER_START;
+            break;
+
+        case S_HEADER_START:
+            if (c == '\r')
+                state_ = S_HEADERS_END_LF;
+            else if (c == '\n')
+            {
+                ++pos_;
+                state_ = S_DONE;
+                return PARSE_FINISH;
+            }
+            else if (isTokenChar(c))
+            {
+                header_.name.offset = pos_;
+                state_ = S_HEADER_NAME;
+            }
+            else
+                return fail();      // 包括已废弃的折行
+            break;
+
+        case S_HEADER_NAME:
+            if (c == ':')
+            {
+                header_.name.len = pos_ - header_.name.offset;
+                state_ = S_HEADER_VALUE_START;
+            }
+            else if (!isTokenChar(c))
+                return fail();      // 字段名和冒号之间不允许有空白
+            break;
+
+        // 跳过值前面的空白
+        case S_HEADER_VALUE_START:
+            if (c == ' ' || c == '\t')
+                break;
+            header_.value.offset = value_end_ = pos_;
+            if (c == '\r' || c == '\n')
+            {
+                if (!finishHeader(data))
+                    return fail();
+                state_ = c == '\r' ? S_HEADER_LF : S_HEADER_START;
+                break;
+            }
+            if (!isFieldChar(c))
+                return fail();
+            value_end_ = pos_ + 1;
+            state_ = S_HEADER_VALUE;
+            break;
+
+        // 值后面的空白不算在值里
+        case S_HEADER_VALUE:
+            if (c == '\r' || c == '\n')
+            {
+                if (!finishHeader(data))
+                    return fail();
+                state_ = c == '\r' ? S_HEADER_LF : S_HEADER_START;
+            }
+            else if (isFieldChar(c))
+                value_end_ = pos_ + 1;
+            else if (c != ' ' && c != '\t')
+                return fail();
+            break;
+
+        case S_HEADER_LF:
+            if (c != '\n')
+                return fail();
+            state_ = S_HEADER_START;
+            break;
+
+        case S_HEADERS_END_LF:
+            if (c != '\n')
+                return fail();
+            ++pos_;
+            state_ = S_DONE;
+            return PARSE_FINISH;
+
+        default:
+            return fail();
+        }
+        ++pos_;
+    }
+
+    // 首部太长
+    if (pos_ >= MAX_HEADER_BYTES)
+        return fail();
+    return PARSE_AGAIN;
+}
+
+bool HttpParser::finishMethod(const char *data)
+{
+    StringPiece method(data + token_.offset, token_.len);
+    if (method == "GET")
+        method_ = METHOD_GET;
+    else if (method == "POST")
+        method_ = METHOD_POST;
+    else
+        method_ = METHOD_UNKNOWN;   // 语法正确，由调用者决定如何响应
+    return true;
+}
+
+bool HttpParser::finishVersion(const char *data)
+{
+    StringPiece version(data + token_.offset, token_.len);
+    if (version == "HTTP/1.1")
+        version_ = HTTP1_1;
+    else if (version == "HTTP/1.0")
+        version_ = HTTP1_0;
+    else
+        return false;
+    return true;
+}
+
+bool HttpParser::finishHeader(const char *data)
+{
+    if (headers_.size() >= MAX_HEADERS)
+        return false;
+    header_.value.len = value_end_ - header_.value.offset;
+    headers_.push_back(header_);
+
+    // 顺便解析连接管理需要的两个字段，之后不用再查找
+    StringPiece name(data + header_.name.offset, header_.name.len);
+    StringPiece value(data + header_.value.offset, header_.value.len);
+    if (name.equalsIgnoreCase("Content-Length"))
+    {
+        if (value.empty() || value.size() > 18)
+            return false;
+        long long length = 0;
+        for (std::size_t i = 0; i < value.size(); ++i)
+        {
+            if (value[i] < '0' || value[i] > '9')
+                return false;
+            length = length * 10 + (value[i] - '0');
+        }
+        // 多个不一致的Content-Length是请求走私的常见手段
+        if (content_length_ >= 0 && content_length_ != length)
+            return false;
+        content_length_ = length;
+    }
+    else if (name.equalsIgnoreCase("Connection"))
+    {
+        if (listContains(value, "close"))
+            connection_ = CONNECTION_CLOSE;
+        else if (listContains(value, "keep-alive"))
+            connection_ = CONNECTION_KEEP_ALIVE;
+    }
+    return true;
+}
+
+StringPiece HttpParser::header(const char *base, const StringPiece &name) const
+{
+    for (std::size_t i = 0; i < headers_.size(); ++i)
+    {
+        if (headerName(base, i).equalsIgnoreCase(name))
+            return headerValue(base, i);
+    }
+    return StringPiece();
+}
@@ -1,23 +1,27 @@
 #include "HttpTask.h"
+#include "EncodingCache.h"
+#include "HttpHeaders.h"
 #include "Utils.h"
 #include "Logging.h"
+#include "Metrics.h"
 #include <errno.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 
 
-// 持续连接的定时器是30s，非持续连接是2s
-const int LONG_TIMEOUT = 5 * 1000;
+// 持续连接的定时器和Keep-Alive字段一致，非持续连接是2s
+const int LONG_TIMEOUT = HttpHeaders::KEEP_ALIVE_TIMEOUT;
 const int SHORT_TIMEOUT = 2 * 1000;
 
-const int PARSE_REQUESTLINE_FINISH = 0;
-const int PARSE_REQUESTLINE_AGAIN = -1;
-const int PARSE_REQUESTLINE_ERROR = -2;
-
-const int PARSE_HEADER_FINISH = 0;
-const int PARSE_HEADER_AGAIN = -1;
-const int PARSE_HEADER_ERROR = -2;
+const int PARSE_REQUEST_FINISH = 0;
+const int PARSE_REQUEST_AGAIN = -1;
+const int PARSE_REQUEST_ERROR = -2;
 
 const int RECV_BODY_FINISH = 0;
 const int RECV_BODY_AGAIN = -1;
@@ -26,45 +30,107 @@ const int RECV_BODY_ERROR = -2;
 const int ANALYSIS_FINISH = 0;
 const int ANALYSIS_NOT_FOUND = -1;
 const int ANALYSIS_BAD_REQUEST = -2;
+const int ANALYSIS_RANGE_NOT_SATISFIABLE = -3;
+
+const int RANGE_NONE = 0;              // 没有Range或者忽略Range，发送整个文件
+const int RANGE_SATISFIABLE = 1;
+const int RANGE_NOT_SATISFIABLE = 2;
 
 const int WRITE_FINISH = 0;
 const int WRITE_AGAIN = -1;
 const int WRITE_ERROR = -2;
 
+const std::size_t HttpTask::MAX_PIPELINE_DEPTH;
+const int HttpTask::MAX_WRITE_IOV;
+const std::size_t HttpTask::MAX_RANGES;
+
+namespace {
+
+// 从value[i]开始读取一个十进制数，最多18位
+bool parseNumber(const StringPiece &value, std::size_t &i, unsigned long long &n)
+{
+    std::size_t begin = i;
+    n = 0;
+    while (i < value.size() && value[i] >= '0' && value[i] <= '9' && i - begin < 18)
+        n = n * 10 + (value[i++] - '0');
+    return i > begin && (i == value.size() || value[i] < '0' || value[i] > '9');
+}
+
+// 去掉实体标签的W/前缀和引号
+StringPiece opaqueTag(const StringPiece &tag)
+{
+    std::size_t begin = (tag.size() >= 2 && tag[0] == 'W' && tag[1] == '/') ? 2 : 0;
+    if (tag.size() < begin + 2 || tag[begin] != '"' || tag[tag.size() - 1] != '"')
+        return StringPiece();
+    return StringPiece(tag.data() + begin + 1, tag.size() - begin - 2);
+}
+
+// 弱比较，并且文件的各种编码的标签（后面加上"-编码"）都算同一个文件
+bool sameFileTag(const StringPiece &tag, const StringPiece &file_tag)
+{
+    if (tag.empty() || tag.size() < file_tag.size() || memcmp(tag.data(), file_tag.data(), file_tag.size()) != 0)
+        return false;
+    return tag.size() == file_tag.size() || tag[file_tag.size()] == '-';
+}
+
+// multipart/byteranges的分隔符，不会出现在文件内容的同一位置就行
+string makeBoundary()
+{
+    static std::atomic<unsigned long> seq(0);
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%08lx%08lx", static_cast<unsigned long>(time(NULL)), ++seq);
+    return string(buf);
+}
+
+}
+
 pthread_once_t MimeType::once_control_ = PTHREAD_ONCE_INIT;
 unordered_map<string,string> MimeType::mime;
+unordered_map<string,string> MimeType::content_type;
 void MimeType::_init()
 {
     mime[".html"]   = "text/html";
     mime[".avi"]    = "video/x-msvideo";
     mime[".bmp"]    = "image/bmp";
     mime[".c"]      = "text/plain";
+    mime[".css"]    = "text/css";
     mime[".doc"]    = "application/msword";
     mime[".gif"]    = "image/gif";
     mime[".gz"]     = "application/x-gzip";
     mime[".htm"]    = "text/html";
     mime[".ico"]    = "application/x-ico";
     mime[".jpg"]    = "image/jpeg";
+    mime[".js"]     = "application/javascript";
+    mime[".json"]   = "application/json";
     mime[".png"]    = "image/png";
+    mime[".svg"]    = "image/svg+xml";
     mime[".txt"]    = "text/plain";
     mime[".mp3"]    = "audio/mp3";
+    mime[".xml"]    = "application/xml";
     mime["default"] = "text/html";
+    for (const auto &item : mime)
+        content_type[item.first] = item.second + "; charset=utf-8";
 }
 
-string MimeType::getMime(const string &suffix)
+const string &MimeType::getMime(const string &suffix)
 {
     pthread_once(&once_control_, _init);
-    if (mime.find(suffix) != mime.end())
-        return mime[suffix];
-    else
-        return mime["default"];
+    auto it = mime.find(suffix);
+    return it != mime.end() ? it->second : mime["default"];
 }
 
-shared_ptr<TimerManager<HttpTask>> HttpTask::timer_manager_(nullptr);
-shared_ptr<Epoll<HttpTask>> HttpTask::epoll_(nullptr);
+const string &MimeType::getContentType(const string &suffix)
+{
+    pthread_once(&once_control_, _init);
+    auto it = content_type.find(suffix);
+    return it != content_type.end() ? it->second : content_type["default"];
+}
 
 HttpTask::~HttpTask()
 {
+    if (timer_manager_)
+        timer_manager_->delTimer(this);
+    _clearResponses();
     LOG_WARN << "disconnect with " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) << ", close the socket " << sock_;
 }
 
@@ -74,168 +140,212 @@ void HttpTask::Init(SP_TimerManager tm, SP_Epoll ep)
     epoll_ = ep;
 }
 
-void HttpTask::linkTimer(SP_Timer timer)
-{
-    timer_ = timer;
-}
-
-void HttpTask::separateTimer()
-{
-    if (timer_)
-    {
-        timer_->setDeleted();
-        timer_.reset();
-    }
-}
-
-void HttpTask::bilateralSeparateTimer()
-{
-    if (timer_)
-    {
-        timer_->separate();
-        timer_.reset();
-    }
-}
 
 
 /*
 任务处理逻辑：
-    先判断是否可以发送数据，可以的话直接发送；否则先接收数据
-    然后根据主状态机，执行相应函数
+    有待发送的响应时先发送；否则先接收数据
+    然后依次处理接收缓存中所有完整的请求（流水线），响应按请求的顺序排队，队列满了就先发送
+    发送完后继续处理缓存中剩下的请求，直到需要等待更多数据或者套接字不可写
 */
 void HttpTask::process()
 {
     // 可以直接发送数据
     if (main_status_ == STATE_READY_TO_WRITE)
+        _sendResponses();
+
+    // 否则要和定时器解耦并接受数据
+    else
     {
-        int ret = _write();
-        if (ret == WRITE_FINISH)
+        // 处理期间不会超时
+        timer_manager_->delTimer(this);
+
+        // 读取套接字
+        int read_len = _read();
+        if (read_len < 0)
         {
-            main_status_ = STATE_FINISH;
-            LOG_INFO << "Send message to " << dotted_decimal_notation(addr_) << ":" << src_port(addr_)  << " successful, socket = " << sock_;
+            LOG_ERROR << "Bad Request from " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) ;
+            keep_alive_ = false;
+            _handleError(400, "Bad Request");
+            _sendResponses();
         }
-        else if (ret == WRITE_AGAIN)
-            main_status_ = STATE_READY_TO_WRITE;
-        else
+
+        // 有请求出现但是读不到数据，可能是Request Aborted，或者来自网络的数据没有达到等原因
+        // 最可能是对端已经关闭了，统一按照对端已经关闭处理
+        else if (read_len == 0)
         {
+            LOG_INFO << "Receive zero byte message from " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) ;
             main_status_ = STATE_ERROR;
-            LOG_ERROR << "Send message to " << dotted_decimal_notation(addr_) << ":" << src_port(addr_)  << " failed, socket = " << sock_;
+        }
+        else
+        {
+            Metrics::bytesIn(read_len);
+            _handleRequests();
+            _sendResponses();
         }
     }
 
-    // 否则要和定时器解耦并接受数据
-    else
-    {
-        do {
-            // 与定时器双向解耦
-            bilateralSeparateTimer();
+    _handleConnection();
+}
 
-            // 读取套接字
-            int read_len = _read();
-            if (read_len < 0)
-            {
-                LOG_ERROR << "Bad Request from " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) ;
-                _handleError(400, "Bad Request");
+// 依次处理接收缓存中完整的请求，直到请求不完整、响应队列满了或者连接将要关闭
+void HttpTask::_handleRequests()
+{
+    // 上一个请求处理完的时间就是下一个请求开始解析的时间，每个请求只多读一次时钟
+    int64_t start = Metrics::now();
+    while (responses_.size() < MAX_PIPELINE_DEPTH && (keep_alive_ || responses_.empty()))
+    {
+        int ret = _parse_request();
+        if (ret == PARSE_REQUEST_AGAIN)
+            break;
+        // 请求的边界已经无法确定，回复错误后关闭连接
+        if (ret == PARSE_REQUEST_ERROR ||
+            (parser_.method() != HttpParser::METHOD_GET && parser_.method() != HttpParser::METHOD_POST))
+        {
+            keep_alive_ = false;
+            _handleError(400, "Bad Request");
+            break;
+        }
+        // 带Content-Length的GET也要等实体主体收全再一起取出，否则主体会被当成下一个请求解析（请求走私）
+        if (parser_.method() == HttpParser::METHOD_POST || parser_.hasContentLength())
+        {
+            ret = _recv_body();
+            if (ret == RECV_BODY_AGAIN)
                 break;
-            }
-
-            // 有请求出现但是读不到数据，可能是Request Aborted，或者来自网络的数据没有达到等原因
-            // 最可能是对端已经关闭了，统一按照对端已经关闭处理
-            else if (read_len == 0)
+            else if (ret == RECV_BODY_ERROR)
             {
-                LOG_INFO << "Receive zero byte message from " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) ;
-                main_status_ = STATE_ERROR;
+                keep_alive_ = false;
+                _handleError(400, "Bad Request");
                 break;
             }
+        }
 
-            // 根据主状态机进行处理
-            if (main_status_ == STATE_PARSE_REQUESTLINE)
-            {
-                int ret = _parse_requestline();
-                if (ret == PARSE_REQUESTLINE_FINISH)
-                    main_status_ = STATE_PARSE_HEADERS;
-                else if (ret == PARSE_REQUESTLINE_AGAIN)
-                    break;
-                else
-                {
-                    _handleError(400, "Bad Request");
-                    break;
-                }
-            }
-            if (main_status_ == STATE_PARSE_HEADERS)
-            {
-                int ret = _parse_headers();
-                if (ret == PARSE_HEADER_FINISH)
-                {
-                    if (method_ == METHOD_GET)
-                        main_status_ = STATE_ANALYSIS;
-                    else if (method_ == METHOD_POST)
-                        main_status_ = STATE_RECV_BODY;
-                    else
-                    {
-                        _handleError(400, "Bad Request");
-                        break;
-                    }
-                }
-                else if (ret == PARSE_HEADER_AGAIN)
-                    break;
-                else
-                {
-                    _handleError(400, "Bad Request");
-                    break;
-                }
-            }
-            if (main_status_ == STATE_RECV_BODY)
+        int64_t parsed = Metrics::now();
+        Metrics::record(Metrics::STAGE_PARSE, start, parsed);
+        ret = _analysis_request();
+        start = Metrics::now();
+        Metrics::record(Metrics::STAGE_HANDLER, parsed, start);
+        if (ret == ANALYSIS_FINISH)
+        {
+            if (parser_.method() == HttpParser::METHOD_GET)
             {
-                int ret = _recv_body();
-                if (ret == RECV_BODY_FINISH)
-                    main_status_ = STATE_ANALYSIS;
-                else if (ret == RECV_BODY_AGAIN)
-                    break;
-                else
-                    _handleError(400, "Bad Request");
-                    break;
+                LOG_INFO << "Receive GET request successful, socket = " << sock_;
             }
-            if (main_status_ == STATE_ANALYSIS)
+            else
             {
-                int ret = _analysis_request();
-                if (ret == ANALYSIS_FINISH)
-                {
-                    main_status_ = STATE_READY_TO_WRITE;
-                    if (method_ == METHOD_GET)
-                        LOG_INFO << "Receive GET request successful, socket = " << sock_;
-                    else if (method_ == METHOD_POST)
-                        LOG_INFO << "Receive POST request successful, socket = " << sock_;
-                }
-                else if (ret == ANALYSIS_NOT_FOUND)
-                {
-                    _handleError(404, "Not Found");
-                    break;
-                }
-                else
-                    _handleError(400, "Bad Request");
-                    break;
+                LOG_INFO << "Receive POST request successful, socket = " << sock_;
             }
-        } while(false);
+        }
+        else if (ret == ANALYSIS_NOT_FOUND)
+            _handleError(404, "Not Found");
+        else if (ret == ANALYSIS_RANGE_NOT_SATISFIABLE)
+        {
+            LOG_INFO << "Range not satisfiable, socket = " << sock_;   // 416响应已经排入队列
+        }
+        else
+            _handleError(400, "Bad Request");
+        _finishRequest();
     }
+    if (!responses_.empty())
+    {
+        main_status_ = STATE_READY_TO_WRITE;
+        if (send_start_ == 0)
+            send_start_ = start;
+    }
+}
 
-    _handleConnection();
+// 发送排队的响应，全部发完后继续处理缓存中剩下的请求
+void HttpTask::_sendResponses()
+{
+    while (main_status_ == STATE_READY_TO_WRITE)
+    {
+        int ret = _write();
+        if (ret == WRITE_AGAIN)
+            return;
+        else if (ret == WRITE_ERROR)
+        {
+            main_status_ = STATE_ERROR;
+            LOG_ERROR << "Send message to " << dotted_decimal_notation(addr_) << ":" << src_port(addr_)  << " failed, socket = " << sock_;
+            return;
+        }
+        _onResponsesSent();
+    }
+}
+
+// 响应全部发送完后调用：关闭连接，或者继续处理缓存中剩下的请求
+void HttpTask::_onResponsesSent()
+{
+    LOG_INFO << "Send message to " << dotted_decimal_notation(addr_) << ":" << src_port(addr_)  << " successful, socket = " << sock_;
+    Metrics::record(Metrics::STAGE_SEND, send_start_, Metrics::now());
+    send_start_ = 0;
+
+    // 处理过大请求或响应后，不让空闲的持续连接一直占着大块内存
+    outBuf_.shrinkIfIdle();
+    inBuf_.shrinkIfIdle();
+    if (!keep_alive_)
+    {
+        main_status_ = STATE_FINISH;
+        return;
+    }
+    main_status_ = STATE_PARSE_REQUEST;
+    _handleRequests();
+}
+
+// 以下是完成模式（io_uring后端）的接口
+void HttpTask::onReceive(const char *data, std::size_t len)
+{
+    if (main_status_ == STATE_FINISH || main_status_ == STATE_ERROR)
+        return;
+    Metrics::bytesIn(len);
+    inBuf_.append(data, len);
+    _handleRequests();
+}
+
+int HttpTask::prepareSend(struct iovec *iov, int max_iov)
+{
+    return _collectIov(iov, max_iov);
+}
+
+bool HttpTask::prepareSendFile(int *fd, off_t *offset, std::size_t *len)
+{
+    if (responses_.empty())
+        return false;
+    const Response &resp = responses_.front();
+    if (resp.file_fd < 0 || resp.file_offset >= resp.file_end)
+        return false;
+    *fd = resp.file_fd;
+    *offset = resp.file_offset;
+    *len = resp.file_end - resp.file_offset;
+    return true;
 }
 
+void HttpTask::onSent(std::size_t len)
+{
+    _advance(len);
+    if (responses_.empty() && main_status_ == STATE_READY_TO_WRITE)
+        _onResponsesSent();
+}
+
+void HttpTask::onFileSent(std::size_t len)
+{
+    Metrics::bytesOut(len);
+    if (!responses_.empty())
+        responses_.front().file_offset += len;
+    onSent(0);
+}
 
 int HttpTask::_read()
 {
     int read_len = 0;
-    char buf[2048];
     while (1)
     {
-        memset(buf, 0, sizeof(buf));
-        int len = recv(sock_, buf, sizeof(buf), 0);
+        int saved_errno = 0;
+        ssize_t len = inBuf_.readFd(sock_, &saved_errno);
         if (len < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK)
                 return read_len;
-            else if (errno == EINTR)
+            else if (saved_errno == EINTR)
                 continue;
             else 
                 return -1;
@@ -243,20 +353,107 @@ int HttpTask::_read()
         else if (len == 0)
             return read_len;
         else
-        {
-            inBuf_ += buf;
             read_len += len;
-        }
     }
 }
 
+/*
+    按顺序发送响应队列：
+    队列前面的响应的首部（在outBuf_中依次排列）和缓存的实体主体合并成一次writev，
+    遇到需要sendfile的响应时，先把它之前的内容发完，再用sendfile发送文件
+*/
 int HttpTask::_write()
 {
-    int write_len = 0;
-    const char *ptr = outBuf_.c_str() + bytes_have_send_;
-    while (write_len < outBuf_.size())
+    while (!responses_.empty())
+    {
+        struct iovec iov[MAX_WRITE_IOV];
+        int iovcnt = _collectIov(iov, MAX_WRITE_IOV);
+        if (iovcnt > 0)
+        {
+            ssize_t len = writev(sock_, iov, iovcnt);
+            if (len < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return WRITE_AGAIN;
+                else if (errno == EINTR)
+                    continue;
+                else
+                    return WRITE_ERROR;
+            }
+            _advance(len);
+        }
+        else
+        {
+            // 最前面的响应只剩文件没有发送
+            int ret = _sendfile(responses_.front());
+            if (ret != WRITE_FINISH)
+                return ret;
+            _advance(0);
+        }
+    }
+    return WRITE_FINISH;
+}
+
+// 收集队列前面可以直接发送的内存分段，遇到需要发送文件的响应为止
+int HttpTask::_collectIov(struct iovec *iov, int max_iov)
+{
+    int iovcnt = 0;
+    const char *head = outBuf_.peek();
+    for (const Response &resp : responses_)
     {
-        int len = send(sock_, ptr, outBuf_.size()-write_len, 0);
+        if (iovcnt + 2 > max_iov)
+            break;
+        if (resp.head_len > 0)
+        {
+            iov[iovcnt].iov_base = const_cast<char *>(head);
+            iov[iovcnt].iov_len = resp.head_len;
+            ++iovcnt;
+            head += resp.head_len;
+        }
+        if (resp.body_offset < resp.body_end)
+        {
+            iov[iovcnt].iov_base = const_cast<char *>(resp.cached_file->body.data()) + resp.body_offset;
+            iov[iovcnt].iov_len = resp.body_end - resp.body_offset;
+            ++iovcnt;
+        }
+        if (resp.file_fd >= 0)
+            break;
+    }
+    return iovcnt;
+}
+
+// 按顺序把已发送的字节记到各个响应上，已发送的首部直接从缓冲区取出，然后取出已经发送完的响应
+void HttpTask::_advance(std::size_t sent)
+{
+    Metrics::bytesOut(sent);
+    for (auto it = responses_.begin(); it != responses_.end() && sent > 0; ++it)
+    {
+        std::size_t n = std::min(sent, it->head_len);
+        outBuf_.retrieve(n);
+        it->head_len -= n;
+        sent -= n;
+        n = std::min(sent, it->body_end - it->body_offset);
+        it->body_offset += n;
+        sent -= n;
+    }
+
+    while (!responses_.empty())
+    {
+        Response &resp = responses_.front();
+        if (resp.head_len > 0 || resp.body_offset < resp.body_end ||
+            (resp.file_fd >= 0 && resp.file_offset < resp.file_end))
+            break;
+        _closeFile(resp);
+        responses_.erase(responses_.begin());
+    }
+}
+
+// 从页缓存直接把文件发送到套接字，不经过用户空间
+int HttpTask::_sendfile(Response &resp)
+{
+    while (resp.file_fd >= 0 && resp.file_offset < resp.file_end)
+    {
+        ssize_t len = sendfile(sock_, resp.file_fd, &resp.file_offset, resp.file_end - resp.file_offset);
         if (len < 0)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -266,44 +463,61 @@ int HttpTask::_write()
             else
                 return WRITE_ERROR;
         }
-        write_len += len;
-        ptr += len;
-        bytes_have_send_ += len;
+        // 文件在发送过程中被截断
+        if (len == 0)
+            return WRITE_ERROR;
+        Metrics::bytesOut(len);
     }
+    _closeFile(resp);
     return WRITE_FINISH;
 }
 
-// 请求发生错误，向输出缓存中写入错误信息，更改主状态机为可写
-void HttpTask::_handleError(int err_num, const string &msg)
+void HttpTask::_closeFile(Response &resp)
 {
-    outBuf_.clear();
-    std::string head, entity_body;
+    if (resp.file_fd >= 0)
+    {
+        if (resp.own_file)
+            close(resp.file_fd);
+        resp.file_fd = -1;
+    }
+}
 
-    entity_body += "<html><title>哎呀~出错了</title>";
-    entity_body += "<body bgcolor=\"ffffff\">";
-    entity_body += std::to_string(err_num) + " " + msg;
-    entity_body += "<hr><em> Huanggomery's Web Server</em>\n</body></html>";
+void HttpTask::_clearResponses()
+{
+    for (Response &resp : responses_)
+        _closeFile(resp);
+    responses_.clear();
+    outBuf_.retrieveAll();
+}
 
-    head += "HTTP/1.1 " + std::to_string(err_num) + " " + msg + "\r\n";
-    if (keep_alive_)
+// 请求发生错误，把错误信息作为这个请求的响应排入队列，400和404使用预先生成的响应
+void HttpTask::_handleError(int err_num, const string &msg, const string &extra_head)
+{
+    std::size_t begin = outBuf_.readableBytes();
+    if (!extra_head.empty() || !HttpHeaders::appendCanned(outBuf_, err_num, keep_alive_))
     {
-        head += "Connection: keep-alive\r\n";
-        head += "Keep-Alive: timeout=" + std::to_string(LONG_TIMEOUT/1000);
+        std::string entity_body = HttpHeaders::errorPage(err_num, msg);
+        HttpHeaders::appendStatus(outBuf_, err_num, keep_alive_);
+        outBuf_.append(extra_head);
+        HttpHeaders::appendContentLength(outBuf_, entity_body.size());
+        HttpHeaders::appendField(outBuf_, "Content-Type", MimeType::getContentType(".html"));
+        HttpHeaders::appendEnd(outBuf_);
+        outBuf_.append(entity_body);
     }
-    else
-        head += "Connection: close\r\n";
-    head += "Content-Length: " + std::to_string(entity_body.size()) + "\r\n";
-    head += "Content-Type: text/html; charset=utf-8\r\n";
-    head += "Date: " + get_gmt_time_str() + "\r\n";
-    head += "Server: Huanggomery's Web Server\r\n";
-    head += "\r\n";
-
-    outBuf_ += head + entity_body;
+
+    Response resp;
+    resp.head_len = outBuf_.readableBytes() - begin;
+    responses_.push_back(std::move(resp));
     main_status_ = STATE_READY_TO_WRITE;
 
     LOG_INFO << "HTTP error " << std::to_string(err_num) << " " << msg << " from: " << dotted_decimal_notation(addr_) << ":" << src_port(addr_) ;
 }
 
+int HttpTask::idleTimeout() const
+{
+    return keep_alive_ && !draining() ? LONG_TIMEOUT : SHORT_TIMEOUT;
+}
+
 // 根据主状态机进行最后处理，即维护定时器和epoll监听事件
 void HttpTask::_handleConnection()
 {
@@ -312,231 +526,483 @@ void HttpTask::_handleConnection()
         if (!epoll_->epoll_mod(sock_, EPOLLOUT | EPOLLET | EPOLLONESHOT, shared_from_this()))
             LOG_ERROR << "epoll_mod failed, fd = " << sock_;
     }
-    else if (main_status_ == STATE_ERROR)
+    else if (main_status_ == STATE_ERROR || main_status_ == STATE_FINISH)
         _disconnect();
-    else if (main_status_ == STATE_FINISH)
-    {
-        if (keep_alive_)
-        {
-            _reset();
-            timer_manager_->addTimer(shared_from_this(), LONG_TIMEOUT);
-            if (!epoll_->epoll_mod(sock_, EPOLLIN | EPOLLET | EPOLLONESHOT, shared_from_this()))
-                LOG_ERROR << "epoll_mod failed, fd = " << sock_;
-        }
-        else
-            _disconnect();
-    }
     else
     {
-        int timeout = keep_alive_ ? LONG_TIMEOUT : SHORT_TIMEOUT;
-        timer_manager_->addTimer(shared_from_this(), timeout);
+        // 等待下一个请求或者请求剩下的部分
+        timer_manager_->addTimer(this, idleTimeout());
         if (!epoll_->epoll_mod(sock_, EPOLLIN | EPOLLET | EPOLLONESHOT, shared_from_this()))
             LOG_ERROR << "epoll_mod failed, fd = " << sock_;
     }
 }
 
-int HttpTask::_parse_requestline()
+// 解析器从上次停下的地方继续，请求行和首部都收完后取出文件名和连接方式
+int HttpTask::_parse_request()
 {
-    // 如果还没收到完整的请求行，则继续等待
-    std::size_t end_pos = inBuf_.find("\r\n");
-    if (end_pos == std::string::npos)
-        return PARSE_REQUESTLINE_AGAIN;
-    std::string request = inBuf_.substr(0, end_pos);
-    if (inBuf_.size() > end_pos+2)
-        inBuf_ = inBuf_.substr(end_pos+2);
-    else
-        inBuf_.clear();
-
-    // 解析请求方式
-    if (request.find("GET") == 0 && request[3] == ' ')
-    {
-        method_ = METHOD_GET;
-        request = request.substr(4);
-    }
-    else if (request.find("POST") == 0 && request[4] == ' ')
-    {
-        method_ = METHOD_POST;
-        request = request.substr(5);
-    }
-    else
-        return PARSE_REQUESTLINE_ERROR;
-    
-    // 解析文件名
-    if (request[0] != '/')
-        return PARSE_REQUESTLINE_ERROR;
-    std::size_t pos = request.find(" ");
-    if (pos == std::string::npos)
-        return PARSE_REQUESTLINE_ERROR;
-    if (pos - 1 > 0)
-        file_name_ = request.substr(1, pos-1);
+    int ret = parser_.parse(inBuf_.peek(), inBuf_.readableBytes());
+    if (ret == HttpParser::PARSE_AGAIN)
+        return PARSE_REQUEST_AGAIN;
+    else if (ret == HttpParser::PARSE_ERROR)
+        return PARSE_REQUEST_ERROR;
+
+    // 解析文件名，去掉开头的'/'
+    StringPiece uri = parser_.uri(inBuf_.peek());
+    if (uri.size() > 1)
+        file_name_.assign(uri.data() + 1, uri.size() - 1);
     else
         file_name_ = "index.html";
-    request = request.substr(pos+1);
 
-    // 解析HTTP协议版本
-    if (request.find("HTTP/1.0") != std::string::npos)
-        httpVersion_ = HTTP1_0;
-    else if (request.find("HTTP/1.1") != std::string::npos)
-        httpVersion_ = HTTP1_1;
-    else
-        return PARSE_REQUESTLINE_ERROR;
-    
-    return PARSE_REQUESTLINE_FINISH;
-}
-
-int HttpTask::_parse_headers()
-{
-    std::size_t end_pos;
-    while ((end_pos = inBuf_.find("\r\n")) != 0)
-    {
-        if (end_pos == std::string::npos)
-            return PARSE_HEADER_AGAIN;
-
-        // 找到冒号
-        std::size_t pos = inBuf_.find(":");
-        if (pos == std::string::npos || pos == 0)
-            return PARSE_HEADER_ERROR;
-        
-        // 解析键值对
-        std::string key = inBuf_.substr(0,pos);
-        if (inBuf_[++pos] != ' ')
-            return PARSE_HEADER_ERROR;
-        if (inBuf_[++pos] == ' ')
-            return PARSE_HEADER_ERROR;
-        std::string value = inBuf_.substr(pos,end_pos-pos);
-        headers_[key] = value;
-
-        // 从缓存中删除该首部字段
-        if (inBuf_.size() > end_pos+2)
-            inBuf_ = inBuf_.substr(end_pos+2);
-        else
-            inBuf_.clear();
-    }
-    if (inBuf_.size() > 2)
-        inBuf_ = inBuf_.substr(2);
-    else
-        inBuf_.clear();
-    return PARSE_HEADER_FINISH;
+    if (parser_.connection() == HttpParser::CONNECTION_KEEP_ALIVE)
+        keep_alive_ = true;
+    else if (parser_.connection() == HttpParser::CONNECTION_CLOSE)
+        keep_alive_ = false;
+    // 旧进程排空时回复Connection: close，客户端重新连接到新进程
+    if (draining())
+        keep_alive_ = false;
+    return PARSE_REQUEST_FINISH;
 }
 
 int HttpTask::_recv_body()
 {
-    if (headers_.find("Content-Length") == headers_.end())
+    if (!parser_.hasContentLength())
         return RECV_BODY_ERROR;
-    int len = std::stoi(headers_["Content-Length"]);
-    if (inBuf_.size() < len)
+    std::size_t len = parser_.headerBytes() + parser_.contentLength();
+    if (inBuf_.readableBytes() < len)
         return RECV_BODY_AGAIN;
     return RECV_BODY_FINISH;
 }
 
+/*
+    响应直接写到outBuf_，排在之前的响应后面，首部中不变的部分来自HttpHeaders预先拼好的内容
+    内存中的实体主体（hello、统计信息、POST、错误页面）紧跟在首部后面，一起算在head_len里
+*/
 int HttpTask::_analysis_request()
 {
-    std::string head = "HTTP/1.1 200 OK\r\n";
-    std::string entity_body;
-    outBuf_.clear();
-    if (headers_.find("Connection") != headers_.end())
+    // GET方式，需要根据文件名打开相应的文件，如果文件名是"hello"或者统计信息"__stats"，就不需要
+    bool stats = file_name_ == "__stats" && Metrics::enabled();
+    if (parser_.method() == HttpParser::METHOD_GET && file_name_ != "hello" && file_name_ != "Hello" && !stats)
+        return _analysis_file();
+
+    std::size_t begin = outBuf_.readableBytes();
+    HttpHeaders::appendStatus(outBuf_, 200, keep_alive_);
+    if (parser_.method() == HttpParser::METHOD_GET && stats)
     {
-        if (headers_["Connection"] == "keep-alive" || headers_["Connection"] == "Keep-Alive")
-                keep_alive_ = true;
-        else if (headers_["Connection"] == "close" || headers_["Connection"] == "Close")
-            keep_alive_ = false;
+        // Prometheus文本格式，每次请求时汇总
+        string body = Metrics::render();
+        HttpHeaders::appendContentLength(outBuf_, body.size());
+        HttpHeaders::appendField(outBuf_, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+        HttpHeaders::appendField(outBuf_, "Cache-Control", "no-store");
+        HttpHeaders::appendEnd(outBuf_);
+        outBuf_.append(body);
     }
-    if (keep_alive_)
+    else if (parser_.method() == HttpParser::METHOD_GET)
     {
-        head += "Connection: keep-alive\r\n";
-        head += "Keep-Alive: timeout=" + std::to_string(LONG_TIMEOUT/1000);
+        static const string hello = "Hello, I am Huanggomery's Web Server.";
+        HttpHeaders::appendContentLength(outBuf_, hello.size());
+        HttpHeaders::appendField(outBuf_, "Content-Type", MimeType::getContentType(".txt"));
+        HttpHeaders::appendEnd(outBuf_);
+        outBuf_.append(hello);
     }
-    else
-        head += "Connection: close\r\n";
 
-    // GET方式，需要根据文件名打开相应的文件，如果文件名是"hello"，就不需要
-    if (method_ == METHOD_GET)
+    // POST方式，实现实体主体部分大小写转换就行
+    else if (parser_.method() == HttpParser::METHOD_POST)
     {
-        if (file_name_ == "hello" || file_name_ == "Hello")
+        std::size_t len = parser_.contentLength();
+        HttpHeaders::appendContentLength(outBuf_, len);
+        HttpHeaders::appendField(outBuf_, "Content-Type", MimeType::getContentType(".txt"));
+        HttpHeaders::appendEnd(outBuf_);
+
+        // 大小写转换，直接写到首部后面
+        const char *body = inBuf_.peek() + parser_.headerBytes();
+        outBuf_.ensureWritableBytes(len);
+        char *out = outBuf_.beginWrite();
+        for (std::size_t i = 0; i < len; ++i)
         {
-            entity_body = "Hello, I am Huanggomery's Web Server.";
-            head += "Content-Length: " + std::to_string(entity_body.size()) + "\r\n";
-            head += "Content-Type: " + MimeType::getMime(".txt") + "; charset=utf-8\r\n";
+            char c = body[i];
+            if (c >= 'a' && c <= 'z')
+                out[i] = c - 'a' + 'A';
+            else if (c >= 'A' && c <= 'Z')
+                out[i] = c - 'A' + 'a';
+            else
+                out[i] = c;
         }
-        else
+        outBuf_.hasWritten(len);
+    }
+
+    Response resp;
+    resp.head_len = outBuf_.readableBytes() - begin;
+    responses_.push_back(std::move(resp));
+    return ANALYSIS_FINISH;
+}
+
+/*
+    静态文件：先得到文件的验证器，条件请求满足时回复304
+    然后确定实体主体从缓存还是从文件发送，再根据Range决定发送整个文件还是其中的部分
+*/
+int HttpTask::_analysis_file()
+{
+    Response resp;
+    std::size_t file_size;
+    std::string content_type, last_modified, etag;
+    FileId file_id;
+    int max_age;
+    int filefd = -1;
+    bool conditional = !parser_.header(inBuf_.peek(), "If-None-Match").empty() ||
+                       !parser_.header(inBuf_.peek(), "If-Modified-Since").empty();
+    if (FileCache::instance() && (resp.cached_file = FileCache::instance()->get(file_name_)))
+    {
+        // 命中缓存，不需要任何文件系统调用
+        file_size = resp.cached_file->body.size();
+        content_type = resp.cached_file->content_type;
+        last_modified = resp.cached_file->last_modified;
+        etag = resp.cached_file->etag;
+        file_id = resp.cached_file->id;
+        max_age = resp.cached_file->max_age;
+    }
+    else
+    {
+        // 查看是否是普通文件，条件请求只用stat()，未修改时不需要打开文件
+        struct stat file_info;
+        if (!conditional && (filefd = open(file_name_.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+            return ANALYSIS_NOT_FOUND;
+        if ((filefd >= 0 ? fstat(filefd, &file_info) : stat(file_name_.c_str(), &file_info)) < 0 ||
+            !S_ISREG(file_info.st_mode))
         {
-            // 查看文件是否存在
-            struct stat file_info;
-            if (stat(file_name_.c_str(), &file_info) < 0)
-                return ANALYSIS_NOT_FOUND;
-            // 添加首部字段Content-Length
-            head += "Content-Length: " + std::to_string(file_info.st_size) + "\r\n";
-
-            // 获取文件格式，添加首部字段Content-Type
-            auto dot_pos = file_name_.find(".");
-            std::string content_type;
-            if (dot_pos != std::string::npos)
-                content_type = MimeType::getMime(file_name_.substr(dot_pos));
-            else
-                content_type = MimeType::getMime("default");
-            head += "Content-Type: " + content_type + "; charset=utf-8\r\n";
+            if (filefd >= 0)
+                close(filefd);
+            return ANALYSIS_NOT_FOUND;
+        }
+        file_size = file_info.st_size;
+        last_modified = get_gmt_time_str(file_info.st_mtime);
+        file_id = FileId::fromStat(file_info);
+        etag = HttpHeaders::etag(file_id);
+
+        // 获取文件格式
+        auto dot_pos = file_name_.find(".");
+        content_type = MimeType::getContentType(dot_pos != std::string::npos ? file_name_.substr(dot_pos) : "default");
+        max_age = HttpHeaders::maxAge(content_type);
+    }
 
-            // 打开文件，并用mmap映射
-            int filefd = open(file_name_.c_str(), O_RDONLY);
-            char *file_ptr = static_cast<char *>(mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, filefd, 0));
+    StringPiece matched;
+    if (conditional && _not_modified(etag, file_id.mtime_sec, matched))
+    {
+        _queueNotModified(matched, max_age);
+        return ANALYSIS_FINISH;
+    }
+
+    if (!resp.cached_file)
+    {
+        if (filefd < 0 && (filefd = open(file_name_.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+            return ANALYSIS_NOT_FOUND;
+        // 小文件读入缓存，之后的请求直接从缓存发送
+        FileCache *cache = FileCache::instance();
+        if (cache && file_size <= cache->maxFileSize() && (resp.cached_file = cache->load(file_name_, content_type)))
             close(filefd);
-            if (file_ptr == nullptr)
+        else
+        {
+            // 文件内容在首部发送完后由sendfile发送
+            resp.file_fd = filefd;
+            resp.file_offset = 0;
+            resp.file_end = file_size;
+        }
+    }
+    if (resp.cached_file)
+        resp.body_end = resp.cached_file->body.size();
+
+    // Range总是针对未编码的内容，请求整个文件时才考虑压缩
+    shared_ptr<const CachedFile> encoded;
+    EncodingCache *encodings = EncodingCache::instance();
+    bool has_range = !parser_.header(inBuf_.peek(), "Range").empty();
+    if (encodings && !has_range)
+    {
+        unsigned accepted = EncodingCache::acceptedEncodings(parser_.header(inBuf_.peek(), "Accept-Encoding"));
+        if (accepted)
+            encoded = encodings->select(accepted, file_name_, file_id, content_type, last_modified,
+                                        resp.cached_file, resp.file_fd);
+    }
+    if (encoded)
+    {
+        _closeFile(resp);
+        resp.cached_file = encoded;
+        resp.body_offset = 0;
+        resp.body_end = encoded->body.size();
+    }
+    else if (has_range)
+    {
+        std::vector<ByteRange> ranges;
+        int ret = _parse_ranges(file_size, last_modified, etag, ranges);
+        if (ret == RANGE_NOT_SATISFIABLE)
+        {
+            _closeFile(resp);
+            _handleError(416, "Range Not Satisfiable", "Content-Range: bytes */" + std::to_string(file_size) + "\r\n");
+            return ANALYSIS_RANGE_NOT_SATISFIABLE;
+        }
+        else if (ret == RANGE_SATISFIABLE)
+        {
+            _queueRanges(last_modified, etag, content_type, max_age, file_size, ranges, resp);
+            return ANALYSIS_FINISH;
+        }
+    }
+
+    // 缓存的文件（包括压缩版本）的首部字段随缓存项一起生成，直接追加
+    std::size_t begin = outBuf_.readableBytes();
+    HttpHeaders::appendStatus(outBuf_, 200, keep_alive_);
+    if (resp.cached_file)
+        outBuf_.append(resp.cached_file->head_fields);
+    else
+    {
+        HttpHeaders::appendFileMeta(outBuf_, last_modified, etag);
+        HttpHeaders::appendContentLength(outBuf_, file_size);
+        HttpHeaders::appendField(outBuf_, "Content-Type", content_type);
+    }
+    HttpHeaders::appendCachePolicy(outBuf_, max_age);
+    HttpHeaders::appendEnd(outBuf_);
+    resp.head_len = outBuf_.readableBytes() - begin;
+    responses_.push_back(std::move(resp));
+    return ANALYSIS_FINISH;
+}
+
+/*
+    If-None-Match: "a-b-c", W/"a-b-c-br", *
+    If-None-Match优先，用弱比较，文件的任何一种编码的标签都算匹配，matched是客户端发来的那个标签，304响应原样带回
+    没有If-None-Match时比较If-Modified-Since，这时matched为空
+*/
+bool HttpTask::_not_modified(const string &etag, time_t mtime, StringPiece &matched)
+{
+    StringPiece value = parser_.header(inBuf_.peek(), "If-None-Match");
+    if (!value.empty())
+    {
+        StringPiece file_tag = opaqueTag(etag);
+        std::size_t i = 0;
+        while (i < value.size())
+        {
+            if (value[i] == ' ' || value[i] == '\t' || value[i] == ',')
             {
-                munmap(file_ptr, file_info.st_size);
-                return ANALYSIS_NOT_FOUND;
+                ++i;
+                continue;
+            }
+            std::size_t begin = i;
+            while (i < value.size() && value[i] != ',' && value[i] != ' ' && value[i] != '\t')
+                ++i;
+            StringPiece tag(value.data() + begin, i - begin);
+            if (tag == "*")
+            {
+                matched = etag;
+                return true;
+            }
+            if (sameFileTag(opaqueTag(tag), file_tag))
+            {
+                matched = tag;
+                return true;
             }
-
-            entity_body = string(file_ptr, file_info.st_size);
-            munmap(file_ptr, file_info.st_size);
         }
+        return false;
     }
 
-    // POST方式，实现实体主体部分大小写转换就行
-    else if (method_ == METHOD_POST)
+    value = parser_.header(inBuf_.peek(), "If-Modified-Since");
+    time_t since;
+    if (value.empty() || !parse_gmt_time_str(value.toString(), since))
+        return false;
+    matched = StringPiece();
+    return mtime <= since;
+}
+
+// 304响应没有实体主体，带上验证器和缓存策略让客户端更新缓存的响应
+void HttpTask::_queueNotModified(const StringPiece &etag, int max_age)
+{
+    std::size_t begin = outBuf_.readableBytes();
+    HttpHeaders::appendStatus(outBuf_, 304, keep_alive_);
+    if (!etag.empty())
+        HttpHeaders::appendField(outBuf_, "ETag", etag);
+    HttpHeaders::appendField(outBuf_, "Vary", "Accept-Encoding");
+    HttpHeaders::appendCachePolicy(outBuf_, max_age);
+    HttpHeaders::appendEnd(outBuf_);
+
+    Response resp;
+    resp.head_len = outBuf_.readableBytes() - begin;
+    responses_.push_back(std::move(resp));
+}
+
+/*
+    Range: bytes=0-499, 500-, -500
+    不是bytes单位、格式错误、范围太多、If-Range和当前文件不一致时返回RANGE_NONE，按整个文件响应
+    所有范围都超出文件时返回RANGE_NOT_SATISFIABLE
+    If-Range可以是实体标签或者Last-Modified的日期，都必须和当前文件完全相同，弱标签从不匹配
+*/
+int HttpTask::_parse_ranges(std::size_t file_size, const string &last_modified, const string &etag,
+                            std::vector<ByteRange> &ranges)
+{
+    StringPiece value = parser_.header(inBuf_.peek(), "Range");
+    if (value.empty())
+        return RANGE_NONE;
+    StringPiece if_range = parser_.header(inBuf_.peek(), "If-Range");
+    if (!if_range.empty())
     {
-        // 添加首部字段Content-Length和Content-Type
-        head += "Content-Length: " + headers_["Content-Length"] + "\r\n";
-        head += "Content-Type: " + MimeType::getMime(".txt") + "; charset=utf-8\r\n";
+        bool is_tag = if_range[0] == '"' || (if_range.size() >= 2 && if_range[0] == 'W' && if_range[1] == '/');
+        if (is_tag ? (etag[0] != '"' || if_range != StringPiece(etag)) : if_range != StringPiece(last_modified))
+            return RANGE_NONE;
+    }
+    if (value.size() < 6 || !StringPiece(value.data(), 6).equalsIgnoreCase("bytes="))
+        return RANGE_NONE;
 
-        // 大小写转换，并存储到entity_body中
-        for (char c : inBuf_)
+    std::size_t specs = 0;
+    std::size_t i = 6;
+    while (i < value.size())
+    {
+        // 跳过空白和空元素
+        if (value[i] == ' ' || value[i] == '\t' || value[i] == ',')
         {
-            if (c >= 'a' && c <= 'z')
-                entity_body.push_back(c - 'a' + 'A');
-            else if (c >= 'A' && c <= 'Z')
-                entity_body.push_back(c - 'A' + 'a');
-            else
-                entity_body.push_back(c);
+            ++i;
+            continue;
         }
+        if (++specs > MAX_RANGES)
+            return RANGE_NONE;
+
+        unsigned long long first = 0, last = 0;
+        bool has_first = value[i] != '-';
+        if (has_first && !parseNumber(value, i, first))
+            return RANGE_NONE;
+        if (i == value.size() || value[i] != '-')
+            return RANGE_NONE;
+        ++i;
+        bool has_last = i < value.size() && value[i] >= '0' && value[i] <= '9';
+        if (has_last && !parseNumber(value, i, last))
+            return RANGE_NONE;
+        if (!has_first && !has_last)
+            return RANGE_NONE;
+        while (i < value.size() && (value[i] == ' ' || value[i] == '\t'))
+            ++i;
+        if (i < value.size() && value[i] != ',')
+            return RANGE_NONE;
+
+        ByteRange range;
+        if (!has_first)
+        {
+            // 最后last个字节
+            range.begin = last < file_size ? file_size - last : 0;
+            range.end = file_size;
+        }
+        else
+        {
+            if (has_last && last < first)
+                return RANGE_NONE;
+            range.begin = first;
+            range.end = (!has_last || last >= file_size) ? file_size : last + 1;
+        }
+        // 超出文件的范围不能满足，跳过
+        if (range.begin < range.end)
+            ranges.push_back(range);
     }
+    if (specs == 0)
+        return RANGE_NONE;
+    if (ranges.empty())
+        return RANGE_NOT_SATISFIABLE;
+
+    // 合并重叠和相邻的范围，避免用很多小范围重复请求同一段内容
+    std::sort(ranges.begin(), ranges.end(),
+              [](const ByteRange &a, const ByteRange &b) {return a.begin < b.begin;});
+    std::size_t n = 0;
+    for (std::size_t k = 1; k < ranges.size(); ++k)
+    {
+        if (ranges[k].begin <= ranges[n].end)
+            ranges[n].end = std::max(ranges[n].end, ranges[k].end);
+        else
+            ranges[++n] = ranges[k];
+    }
+    ranges.resize(n + 1);
+    return RANGE_SATISFIABLE;
+}
 
-    // 添加首部字段Date，使用GMT时间
-    head += "Date: " + get_gmt_time_str() + "\r\n";
-    // 添加首部字段Server
-    head += "Server: Huanggomery's Web Server\r\n";
-    // 首部字段结束，回车换行
-    head += "\r\n";
-    // 填充outBuf_
-    outBuf_ += head + entity_body;
+/*
+    resp中已经设置好实体主体的来源（缓存或者文件），每个范围都只发送对应的字节：
+    缓存的文件直接从缓存的对应位置发送，其他文件用sendfile从对应的偏移发送
+    多个范围时每个部分排成一个响应项，共用同一个文件描述符，由最后一部分负责关闭
+*/
+void HttpTask::_queueRanges(const string &last_modified, const string &etag, const string &content_type,
+                            int max_age, std::size_t file_size, const std::vector<ByteRange> &ranges, Response &resp)
+{
+    auto setRange = [](Response &part, const ByteRange &range) {
+        if (part.cached_file)
+        {
+            part.body_offset = range.begin;
+            part.body_end = range.end;
+        }
+        else
+        {
+            part.file_offset = range.begin;
+            part.file_end = range.end;
+        }
+    };
+    auto contentRange = [file_size](const ByteRange &range) {
+        return "bytes " + std::to_string(range.begin) + "-" + std::to_string(range.end - 1) +
+               "/" + std::to_string(file_size);
+    };
+    std::size_t begin = outBuf_.readableBytes();
+    HttpHeaders::appendStatus(outBuf_, 206, keep_alive_);
+    HttpHeaders::appendFileMeta(outBuf_, last_modified, etag);
+    HttpHeaders::appendCachePolicy(outBuf_, max_age);
+
+    if (ranges.size() == 1)
+    {
+        HttpHeaders::appendField(outBuf_, "Content-Range", contentRange(ranges[0]));
+        HttpHeaders::appendContentLength(outBuf_, ranges[0].end - ranges[0].begin);
+        HttpHeaders::appendField(outBuf_, "Content-Type", content_type);
+        HttpHeaders::appendEnd(outBuf_);
+        setRange(resp, ranges[0]);
+        resp.head_len = outBuf_.readableBytes() - begin;
+        responses_.push_back(std::move(resp));
+        return;
+    }
 
-    return ANALYSIS_FINISH;
+    // multipart/byteranges：每个部分前面是分隔符和这一部分的首部，最后是结束分隔符
+    std::string boundary = makeBoundary();
+    std::vector<std::string> part_heads;
+    std::size_t content_length = 0;
+    for (const ByteRange &range : ranges)
+    {
+        part_heads.push_back("\r\n--" + boundary + "\r\nContent-Type: " + content_type + "\r\n" +
+                             "Content-Range: " + contentRange(range) + "\r\n\r\n");
+        content_length += part_heads.back().size() + (range.end - range.begin);
+    }
+    std::string closing = "\r\n--" + boundary + "--\r\n";
+    content_length += closing.size();
+
+    HttpHeaders::appendContentLength(outBuf_, content_length);
+    HttpHeaders::appendField(outBuf_, "Content-Type", "multipart/byteranges; boundary=" + boundary);
+    HttpHeaders::appendEnd(outBuf_);
+    std::size_t response_head_len = outBuf_.readableBytes() - begin;
+    for (std::size_t k = 0; k < ranges.size(); ++k)
+    {
+        Response part(resp);
+        part.own_file = k + 1 == ranges.size();
+        setRange(part, ranges[k]);
+        part.head_len = (k == 0 ? response_head_len : 0) + part_heads[k].size();
+        outBuf_.append(part_heads[k]);
+        responses_.push_back(std::move(part));
+    }
+    Response end;
+    end.head_len = closing.size();
+    outBuf_.append(closing);
+    responses_.push_back(std::move(end));
 }
 
-void HttpTask::_reset()
+// 请求已经处理完，从接收缓存中取出，解析结果随之失效
+void HttpTask::_finishRequest()
 {
-    inBuf_.clear();
-    outBuf_.clear();
-    main_status_ = STATE_PARSE_REQUESTLINE;
-    bytes_have_send_ = 0;
+    std::size_t request_len = parser_.headerBytes();
+    if (parser_.hasContentLength())
+        request_len += parser_.contentLength();
+    inBuf_.retrieve(request_len);
+    parser_.reset();
     file_name_.clear();
-    headers_.clear();
 }
 
 void HttpTask::_disconnect()
 {
-    bilateralSeparateTimer();
+    timer_manager_->delTimer(this);
     epoll_->epoll_del(sock_);
-    // 此时计时器对象和fd2task中的指针都被清空了，
+    // 此时定时器已删除，fd2task中的指针被清空了，
     // 但是还有工作线程的run()函数中还有最后一个指针，所以对象暂时还不会被析构
     // 一旦process()执行完，run()中最后一个指针析构，该对象也随之析构
-}
\ No newline at end of file
+}
@@ -0,0 +1,259 @@
+#include "IoUring.h"
+#include "Logging.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, std::size_t argsz)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// 多次触发的recv从6.0开始支持，没有办法探测，只能看内核版本
+bool kernelAtLeast(int major, int minor)
+{
+    utsname u;
+    int ma = 0, mi = 0;
+    if (uname(&u) != 0 || sscanf(u.release, "%d.%d", &ma, &mi) != 2)
+        return false;
+    return ma > major || (ma == major && mi >= minor);
+}
+
+}
+
+IoUring::IoUring():
+    ring_fd_(-1), sq_ptr_(MAP_FAILED), sq_size_(0), cq_ptr_(MAP_FAILED), cq_size_(0),
+    sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)), sqes_size_(0),
+    sq_head_(nullptr), sq_tail_(nullptr), sq_mask_(nullptr), sq_array_(nullptr), sq_entries_(0), sqe_tail_(0),
+    cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(nullptr), cqes_(nullptr),
+    buf_ring_(static_cast<io_uring_buf_ring *>(MAP_FAILED)), buf_ring_size_(0), buf_base_(nullptr),
+    buf_num_(0), buf_size_(0), buf_group_(0), buf_tail_(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (buf_ring_ != MAP_FAILED)
+        munmap(buf_ring_, buf_ring_size_);
+    delete [] buf_base_;
+    if (sqes_ != MAP_FAILED)
+        munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+        munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_ != MAP_FAILED)
+        munmap(sq_ptr_, sq_size_);
+    if (ring_fd_ >= 0)
+        close(ring_fd_);
+}
+
+shared_ptr<IoUring> IoUring::CreateIoUring(unsigned entries)
+{
+    if (!kernelAtLeast(6, 0))
+        return nullptr;
+    shared_ptr<IoUring> sp(nullptr);
+    try
+    {
+        sp.reset(new IoUring());
+    }
+    catch (const std::bad_alloc &e)
+    {
+        std::cerr << "malloc error: " << e.what() << std::endl;
+        return nullptr;
+    }
+    if (!sp->init(entries))
+        return nullptr;
+    return sp;
+}
+
+bool IoUring::init(unsigned entries)
+{
+    // 完成队列开大一些，多次触发的accept和recv一次提交会产生很多完成项
+    // SINGLE_ISSUER要求只有一个线程提交，而创建和运行在不同线程，所以先禁用，由运行的线程调用enable()
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+              IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+    p.cq_entries = entries * 4;
+    ring_fd_ = io_uring_setup(entries, &p);
+    if (ring_fd_ < 0 && errno == EINVAL)
+    {
+        // 6.1之前不支持DEFER_TASKRUN
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_R_DISABLED;
+        p.cq_entries = entries * 4;
+        ring_fd_ = io_uring_setup(entries, &p);
+    }
+    if (ring_fd_ < 0)
+    {
+        LOG_WARN << "io_uring_setup failed, errno=" << errno;
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG))
+    {
+        LOG_WARN << "io_uring lacks required features: " << p.features;
+        return false;
+    }
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (cq_size_ > sq_size_)
+        sq_size_ = cq_size_;
+    cq_size_ = sq_size_;
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED)
+        return false;
+    cq_ptr_ = sq_ptr_;
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED)
+        return false;
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    sq_entries_ = p.sq_entries;
+    sqe_tail_ = *sq_tail_;
+
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::enable()
+{
+    if (io_uring_register(ring_fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) != 0)
+    {
+        LOG_ERROR << "enable io_uring failed, errno=" << errno;
+        return false;
+    }
+    return true;
+}
+
+io_uring_sqe *IoUring::getSqe()
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_)
+    {
+        if (submitAndWait(0, 0) < 0)
+            return nullptr;
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_)
+            return nullptr;
+    }
+    unsigned index = sqe_tail_ & *sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sqe_tail_;
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned wait_nr, int timeout_ms)
+{
+    unsigned to_submit = sqe_tail_ - *sq_tail_;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+    unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout_ms >= 0 && wait_nr > 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    int ret = io_uring_enter(ring_fd_, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+    {
+        LOG_ERROR << "io_uring_enter failed, errno=" << errno;
+        return -1;
+    }
+    return ret < 0 ? 0 : ret;
+}
+
+io_uring_cqe *IoUring::peekCqe()
+{
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &cqes_[head & *cq_mask_];
+}
+
+void IoUring::advanceCq(unsigned n)
+{
+    __atomic_store_n(cq_head_, *cq_head_ + n, __ATOMIC_RELEASE);
+}
+
+bool IoUring::setupBufferRing(uint16_t group, unsigned buffer_num, unsigned buffer_size)
+{
+    if (buffer_num == 0 || (buffer_num & (buffer_num - 1)) != 0 || buffer_num > 32768)
+        return false;
+    buf_ring_size_ = buffer_num * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = buffer_num;
+    reg.bgid = group;
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        LOG_WARN << "register buffer ring failed, errno=" << errno;
+        return false;
+    }
+
+    // 缓冲区的内存在第一次接收数据时才真正分配物理页
+    buf_base_ = new char[static_cast<std::size_t>(buffer_num) * buffer_size];
+    buf_num_ = buffer_num;
+    buf_size_ = buffer_size;
+    buf_group_ = group;
+    buf_tail_ = 0;
+    for (unsigned i = 0; i < buffer_num; ++i)
+        recycleBuffer(static_cast<uint16_t>(i));
+    commitBuffers();
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t bid)
+{
+    // 不能用buf_ring_->bufs：头文件中包装柔性数组的空结构体在C++中占一个字节，bufs的偏移变成了8
+    io_uring_buf *buf = reinterpret_cast<io_uring_buf *>(buf_ring_) + (buf_tail_ & (buf_num_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+    buf->len = buf_size_;
+    buf->bid = bid;
+    ++buf_tail_;
+}
+
+void IoUring::commitBuffers()
+{
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
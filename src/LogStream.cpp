@@ -40,37 +40,55 @@ LogStream &LogStream::operator<<(unsigned short v)
 
 LogStream &LogStream::operator<<(int v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<int32_t>(ARG_INT32, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
 LogStream &LogStream::operator<<(unsigned int v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<uint32_t>(ARG_UINT32, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
 LogStream &LogStream::operator<<(long v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<int64_t>(ARG_INT64, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
 LogStream &LogStream::operator<<(unsigned long v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<uint64_t>(ARG_UINT64, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
 LogStream &LogStream::operator<<(long long v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<int64_t>(ARG_INT64, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
 LogStream &LogStream::operator<<(unsigned long long v)
 {
-    formatInteger(buffer_, v);
+    if (binary_)
+        appendInteger<uint64_t>(ARG_UINT64, v);
+    else
+        formatInteger(buffer_, v);
     return *this;
 }
 
@@ -82,7 +100,9 @@ LogStream &LogStream::operator<<(float v)
 
 LogStream &LogStream::operator<<(double v)
 {
-    if (buffer_.avail() > MaxNumericSize)
+    if (binary_)
+        appendArg(ARG_DOUBLE, &v, sizeof(v));
+    else if (buffer_.avail() > MaxNumericSize)
     {
         char buf[MaxNumericSize] = {0};
         snprintf(buf, MaxNumericSize, "%.12g", v);
@@ -1,14 +1,21 @@
 #include "Logging.h"
 #include "Utils.h"
 #include <pthread.h>
+#include <sys/time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <string>
 #include <memory>
 
 // 全局的日志级别
 Logger::LogLevel Logger::g_level_(INFO);
+bool Logger::g_binary_(false);
+AsyncLogging::Options Logger::g_options_;
 
-std::string LevelStr[] = {
+const char *const LevelStr[] = {
     "TRACE",
     "DEBUG",
     "INFO",
@@ -20,24 +27,68 @@ std::string LevelStr[] = {
 namespace {
     pthread_once_t once = PTHREAD_ONCE_INIT;
     std::shared_ptr<AsyncLogging> AsyncLogger_(nullptr);
+
+    // 每个线程缓存自己的线程号和精确到秒的时间字符串，同一秒内的日志只需要格式化微秒
+    thread_local pid_t t_tid = 0;
+    thread_local time_t t_lastSecond = -1;
+    thread_local char t_time[32];
 } // namespace
 
 
 void init_function()
 {
-    AsyncLogger_.reset(new AsyncLogging(get_logfile_name()));
+    AsyncLogger_.reset(new AsyncLogging("WebServer", 3, Logger::options()));
     AsyncLogger_->start();
 }
 
 // 往异步日志的前端写
-void output(const char *logline, int len)
+void output(const char *logline, int len, int64_t timestamp)
+{
+    pthread_once(&once, init_function);
+    AsyncLogger_->append(logline, len, timestamp);
+}
+
+// 调用点的定义还要写在之后每个滚动文件的开头
+void output_header(const char *record, int len, int64_t timestamp)
 {
     pthread_once(&once, init_function);
-    AsyncLogger_->append(logline, len);
+    AsyncLogger_->appendHeader(record, len, timestamp);
+}
+
+void Logger::setOptions(const AsyncLogging::Options &options)
+{
+    g_options_ = options;
+    g_binary_ = options.binary;
 }
 
-Logger::Logger(const std::string &basename, int line, LogLevel level):
-    impl_(basename, line, level)
+AsyncLogging *Logger::backend()
+{
+    return AsyncLogger_.get();
+}
+
+// 给调用点分配编号并写入它的定义，多个线程同时第一次使用时只有一个成功，其他线程使用它分配的编号
+uint32_t register_site(Logger::Site &site, int64_t timestamp)
+{
+    static std::atomic<uint32_t> next_id(0);
+    uint32_t expected = 0;
+    uint32_t id = ++next_id;
+    if (!site.id.compare_exchange_strong(expected, id))
+        return expected;
+
+    char record[SmallBufferSize];
+    uint32_t line = site.line;
+    record[0] = RECORD_SITE;
+    memcpy(record + 1, &id, 4);
+    memcpy(record + 5, &line, 4);
+    record[9] = static_cast<char>(site.level);
+    std::size_t len = std::min(strlen(site.file), sizeof(record) - BINLOG_SITE_HEAD);
+    memcpy(record + BINLOG_SITE_HEAD, site.file, len);
+    output_header(record, BINLOG_SITE_HEAD + len, timestamp);
+    return id;
+}
+
+Logger::Logger(Site &site):
+    impl_(site)
 {
 
 }
@@ -47,14 +98,45 @@ Logger::~Logger()
 
 }
 
-Logger::Impl::Impl(const std::string &basename, int line, LogLevel level):
-    stream_(), basename_(basename), line_(line), level_(level)
+// 时间格式和get_time_str()相同，例如20230706 21:05:57.229383
+// 二进制模式下时间戳在后端写的帧首部中，这里只写记录类型、调用点编号和线程号
+Logger::Impl::Impl(Site &site):
+    stream_(g_binary_), site_(site)
 {
-    stream_ << get_time_str() <<  " " << gettid() << " " << LevelStr[level] << " ";
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    timestamp_ = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    if (t_tid == 0)
+        t_tid = gettid();
+    if (g_binary_)
+    {
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if (id == 0)
+            id = register_site(site, timestamp_);
+        uint32_t tid = t_tid;
+        char head[BINLOG_LINE_HEAD];
+        head[0] = RECORD_LINE;
+        memcpy(head + 1, &id, 4);
+        memcpy(head + 5, &tid, 4);
+        stream_.append(head, sizeof(head));
+        return;
+    }
+    if (tv.tv_sec != t_lastSecond)
+    {
+        struct tm tm_time;
+        time_t sec = tv.tv_sec;
+        localtime_r(&sec, &tm_time);
+        strftime(t_time, sizeof(t_time), "%Y%m%d %H:%M:%S", &tm_time);
+        t_lastSecond = tv.tv_sec;
+    }
+    char usec[8];
+    snprintf(usec, sizeof(usec), ".%06ld", static_cast<long>(tv.tv_usec));
+    stream_ << t_time << usec << " " << t_tid << " " << LevelStr[site.level] << " ";
 }
 
 Logger::Impl::~Impl()
 {
-    stream_ << " - " << basename_ << ":" << line_ << '\n';
-    output(stream_.buffer().getData(), stream_.buffer().size());
-}
\ No newline at end of file
+    if (!g_binary_)
+        stream_ << " - " << site_.file << ":" << site_.line << '\n';
+    output(stream_.buffer().getData(), stream_.buffer().size(), timestamp_);
+}
@@ -0,0 +1,227 @@
+#include "Metrics.h"
+#include <cstdarg>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "Sync.h"
+
+bool Metrics::enabled_ = true;
+
+namespace {
+
+const char *const STAGE_NAMES[Metrics::STAGE_NUM] = {"queue", "parse", "handler", "send"};
+// 和Metrics::codeIndex()的顺序一致
+const char *const CODE_NAMES[Metrics::CODE_NUM] = {"200", "206", "304", "400", "404", "416", "other"};
+const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+// Prometheus直方图的边界：2^10纳秒（约1微秒）到2^35纳秒（约34秒），每个2的幂一个
+const int HIST_MIN_SHIFT = 10;
+const int HIST_MAX_SHIFT = 35;
+
+struct Gauge
+{
+    std::string name;
+    std::string help;
+    const char *type;     // "gauge"或"counter"
+    std::function<double()> fn;
+};
+
+// 和BlockPoolBase的登记表一样故意泄漏，线程局部变量中的指针在进程退出时仍然有效
+Locker &registryLocker()
+{
+    static Locker *locker = new Locker();
+    return *locker;
+}
+
+std::vector<Metrics::ThreadMetrics *> &threads()
+{
+    static std::vector<Metrics::ThreadMetrics *> *v = new std::vector<Metrics::ThreadMetrics *>();
+    return *v;
+}
+
+std::vector<Gauge> &gauges()
+{
+    static std::vector<Gauge> *v = new std::vector<Gauge>();
+    return *v;
+}
+
+void appendf(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void appendf(std::string &out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        out.append(buf, std::min(static_cast<std::size_t>(n), sizeof(buf) - 1));
+}
+
+void appendHead(std::string &out, const char *name, const char *type, const char *help)
+{
+    appendf(out, "# HELP httpserver_%s %s\n# TYPE httpserver_%s %s\n", name, help, name, type);
+}
+
+} // namespace
+
+Metrics::ThreadMetrics *Metrics::registerThread()
+{
+    ThreadMetrics *m = new ThreadMetrics();
+    registryLocker().lock();
+    threads().push_back(m);
+    registryLocker().unlock();
+    return m;
+}
+
+uint64_t Metrics::bucketUpper(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket + 1;
+    int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    int sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return static_cast<uint64_t>(SUB_BUCKETS + sub + 1) << shift;
+}
+
+void Metrics::addGauge(const std::string &name, const std::string &help, std::function<double()> fn)
+{
+    registryLocker().lock();
+    gauges().push_back(Gauge{name, help, "gauge", std::move(fn)});
+    registryLocker().unlock();
+}
+
+void Metrics::addCounter(const std::string &name, const std::string &help, std::function<double()> fn)
+{
+    registryLocker().lock();
+    gauges().push_back(Gauge{name, help, "counter", std::move(fn)});
+    registryLocker().unlock();
+}
+
+// 连接数不受enabled_影响，任务对象的构造和析构总是计数
+// 连接可能在一个线程打开、在另一个线程关闭，先读完所有线程的关闭次数再读打开次数，结果不会比真实值小
+int64_t Metrics::activeConnections()
+{
+    uint64_t accepts = 0, closes = 0;
+    registryLocker().lock();
+    for (ThreadMetrics *m : threads())
+        closes += m->closes.get();
+    for (ThreadMetrics *m : threads())
+        accepts += m->accepts.get();
+    registryLocker().unlock();
+    return static_cast<int64_t>(accepts - closes);
+}
+
+std::string Metrics::render()
+{
+    // 先把所有线程的计数加起来，读到的是各个计数器在不同时刻的值，但每个都不会比真实值大
+    uint64_t accepts = 0, closes = 0, bytes_in = 0, bytes_out = 0;
+    uint64_t responses[CODE_NUM] = {0};
+    std::vector<uint64_t> latency(STAGE_NUM * BUCKETS, 0);
+    uint64_t latency_sum[STAGE_NUM] = {0};
+    struct GaugeValue
+    {
+        std::string help;
+        const char *type;
+        double value;
+    };
+    std::map<std::string, GaugeValue> gauge_values;
+    registryLocker().lock();
+    for (ThreadMetrics *m : threads())
+    {
+        accepts += m->accepts.get();
+        closes += m->closes.get();
+        bytes_in += m->bytes_in.get();
+        bytes_out += m->bytes_out.get();
+        for (int i = 0; i < CODE_NUM; ++i)
+            responses[i] += m->responses[i].get();
+        for (int s = 0; s < STAGE_NUM; ++s)
+        {
+            for (int b = 0; b < BUCKETS; ++b)
+                latency[s * BUCKETS + b] += m->latency[s][b].get();
+            latency_sum[s] += m->latency_sum[s].get();
+        }
+    }
+    for (const Gauge &g : gauges())
+    {
+        auto it = gauge_values.insert(std::make_pair(g.name, GaugeValue{g.help, g.type, 0})).first;
+        it->second.value += g.fn();
+    }
+    registryLocker().unlock();
+
+    std::string out;
+    out.reserve(16 << 10);
+    appendHead(out, "accepts_total", "counter", "Connections accepted.");
+    appendf(out, "httpserver_accepts_total %llu\n", static_cast<unsigned long long>(accepts));
+    appendHead(out, "connections_active", "gauge", "Connections currently open.");
+    appendf(out, "httpserver_connections_active %lld\n", static_cast<long long>(accepts - closes));
+    appendHead(out, "responses_total", "counter", "Responses queued, by status code.");
+    for (int i = 0; i < CODE_NUM; ++i)
+        appendf(out, "httpserver_responses_total{code=\"%s\"} %llu\n", CODE_NAMES[i],
+                static_cast<unsigned long long>(responses[i]));
+    appendHead(out, "bytes_received_total", "counter", "Bytes read from client sockets.");
+    appendf(out, "httpserver_bytes_received_total %llu\n", static_cast<unsigned long long>(bytes_in));
+    appendHead(out, "bytes_sent_total", "counter", "Bytes written to client sockets.");
+    appendf(out, "httpserver_bytes_sent_total %llu\n", static_cast<unsigned long long>(bytes_out));
+    for (const auto &item : gauge_values)
+    {
+        appendHead(out, item.first.c_str(), item.second.type, item.second.help.c_str());
+        appendf(out, "httpserver_%s %.17g\n", item.first.c_str(), item.second.value);
+    }
+
+    // 细分的桶按2的幂合并，le是区间的上界（秒）
+    appendHead(out, "request_stage_seconds", "histogram", "Time spent in each request stage.");
+    for (int s = 0; s < STAGE_NUM; ++s)
+    {
+        const uint64_t *hist = &latency[s * BUCKETS];
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (int shift = HIST_MIN_SHIFT; shift <= HIST_MAX_SHIFT; ++shift)
+        {
+            uint64_t bound = static_cast<uint64_t>(1) << shift;
+            for (; b < BUCKETS && bucketUpper(b) <= bound; ++b)
+                cumulative += hist[b];
+            appendf(out, "httpserver_request_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                    STAGE_NAMES[s], bound / 1e9, static_cast<unsigned long long>(cumulative));
+        }
+        for (; b < BUCKETS; ++b)
+            cumulative += hist[b];
+        appendf(out, "httpserver_request_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+                STAGE_NAMES[s], static_cast<unsigned long long>(cumulative));
+        appendf(out, "httpserver_request_stage_seconds_sum{stage=\"%s\"} %.9g\n", STAGE_NAMES[s], latency_sum[s] / 1e9);
+        appendf(out, "httpserver_request_stage_seconds_count{stage=\"%s\"} %llu\n",
+                STAGE_NAMES[s], static_cast<unsigned long long>(cumulative));
+    }
+
+    // 分位数取所在细分桶的上界，偏大不超过12.5%
+    appendHead(out, "request_stage_quantile_seconds", "gauge",
+               "Latency quantiles of each request stage since start, from the fine-grained histogram.");
+    for (int s = 0; s < STAGE_NUM; ++s)
+    {
+        const uint64_t *hist = &latency[s * BUCKETS];
+        uint64_t total = 0;
+        for (int b = 0; b < BUCKETS; ++b)
+            total += hist[b];
+        for (double q : QUANTILES)
+        {
+            double value = 0;
+            if (total > 0)
+            {
+                uint64_t rank = static_cast<uint64_t>(q * total);
+                if (rank >= total)
+                    rank = total - 1;
+                uint64_t seen = 0;
+                for (int b = 0; b < BUCKETS; ++b)
+                {
+                    seen += hist[b];
+                    if (seen > rank)
+                    {
+                        value = bucketUpper(b) / 1e9;
+                        break;
+                    }
+                }
+            }
+            appendf(out, "httpserver_request_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9g\n",
+                    STAGE_NAMES[s], q, value);
+        }
+    }
+    return out;
+}
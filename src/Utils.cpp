@@ -10,10 +10,13 @@
 #include <signal.h>
 #include <sys/epoll.h>
 #include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <sys/resource.h>
+#include <sys/un.h>
 
 
 // 创建服务器套接字,如果失败，返回-1
-int Create_And_Listen(int port)
+int Create_And_Listen(int port, bool reuseport)
 {
     struct sockaddr_in address;
     memset(&address, 0, sizeof(address));
@@ -28,6 +31,11 @@ int Create_And_Listen(int port)
     // 使用的时候注释掉
     int reuse = 1;
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1)
+    {
+        close(listenfd);
+        return -1;
+    }
 
     // 禁用Nagle算法
     int flag = 1;
@@ -53,6 +61,152 @@ int Create_And_Listen(int port)
     return listenfd;
 }
 
+// 给SO_REUSEPORT组挂载CBPF程序，按照处理SYN的CPU编号选择组内的套接字
+// 返回值超出组的大小时内核会退回到默认的哈希分配
+bool Attach_Reuseport_CPU_Steering(int listenfd, int group_size)
+{
+    if (group_size <= 0)
+        return false;
+    struct sock_filter code[] = {
+        // A = 当前CPU编号
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU) },
+        // A = A % group_size
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<__u32>(group_size) },
+        // return A
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
+    {
+        LOG_ERROR << "Attach reuseport CBPF failed, errno=" << errno;
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+const uint32_t FDS_MAGIC = 0x48534644;   // "HSFD"
+const int MAX_PASSED_FDS = 64;
+
+struct FdsHeader
+{
+    uint32_t magic;
+    uint32_t count;
+};
+
+bool Fill_Unix_Addr(const std::string &path, sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+} // namespace
+
+int Create_Unix_Listen(const std::string &path)
+{
+    sockaddr_un addr;
+    if (!Fill_Unix_Addr(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int Connect_Unix(const std::string &path)
+{
+    sockaddr_un addr;
+    if (!Fill_Unix_Addr(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 首部和描述符在同一个sendmsg中发出，接收方一次recvmsg就能拿到全部描述符
+bool Send_Fds(int sock, const std::vector<int> &fds)
+{
+    if (fds.empty() || fds.size() > static_cast<std::size_t>(MAX_PASSED_FDS))
+        return false;
+    FdsHeader header = {FDS_MAGIC, static_cast<uint32_t>(fds.size())};
+    iovec iov = {&header, sizeof(header)};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {}
+    return n == static_cast<ssize_t>(sizeof(header));
+}
+
+bool Recv_Fds(int sock, std::vector<int> &fds)
+{
+    FdsHeader header;
+    iovec iov = {&header, sizeof(header)};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS), 0);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR) {}
+
+    fds.clear();
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const unsigned char *data = CMSG_DATA(cmsg);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int fd;
+            memcpy(&fd, data + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    // 收到的描述符已经属于本进程，出错时也要关闭
+    if (n != static_cast<ssize_t>(sizeof(header)) || (msg.msg_flags & MSG_CTRUNC) ||
+        header.magic != FDS_MAGIC || header.count != fds.size())
+    {
+        for (int fd : fds)
+            close(fd);
+        fds.clear();
+        return false;
+    }
+    return true;
+}
+
+
 // 设置为非阻塞模式
 bool SetSocketNoBlocking(int fd)
 {
@@ -63,6 +217,26 @@ bool SetSocketNoBlocking(int fd)
 }
 
 
+// 把RLIMIT_NOFILE的软限制提高到want（want <= 0 时提高到硬限制），返回调整后的软限制
+int Raise_Fd_Limit(int want)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return -1;
+    rlim_t target = rl.rlim_max;
+    if (want > 0 && (rl.rlim_max == RLIM_INFINITY || static_cast<rlim_t>(want) < rl.rlim_max))
+        target = want;
+    // 硬限制为无穷时也要给一个具体的值
+    if (target == RLIM_INFINITY)
+        target = 1 << 20;
+    rl.rlim_cur = target;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+        LOG_WARN << "setrlimit(RLIMIT_NOFILE, " << static_cast<unsigned long>(target) << ") failed, errno=" << errno;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return -1;
+    return rl.rlim_cur == RLIM_INFINITY ? (1 << 20) : static_cast<int>(rl.rlim_cur);
+}
+
 
 int pipefd[2];   // 用于处理信号的管道
 // 信号处理函数，使用pipe告知epoll
@@ -107,29 +281,42 @@ std::string get_time_str()
 // 返回当前GMT时间字符串，格式类似于： Tue, 11 Jul 2023 07:22:04 GMT
 std::string get_gmt_time_str()
 {
-    time_t currentTime = time(NULL);
-    struct tm *gmTime = gmtime(&currentTime);
+    return get_gmt_time_str(time(NULL));
+}
+
+std::string get_gmt_time_str(time_t t)
+{
+    struct tm gmTime;
+    gmtime_r(&t, &gmTime);
     char timeString[50];
 
-    strftime(timeString, sizeof(timeString), "%a, %d %b %Y %H:%M:%S GMT", gmTime);
+    strftime(timeString, sizeof(timeString), "%a, %d %b %Y %H:%M:%S GMT", &gmTime);
     return std::string(timeString);
 }
 
+bool parse_gmt_time_str(const std::string &str, time_t &t)
+{
+    struct tm gmTime;
+    memset(&gmTime, 0, sizeof(gmTime));
+    const char *end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &gmTime);
+    if (end == NULL || *end != '\0')
+        return false;
+    t = timegm(&gmTime);
+    return true;
+}
+
 // 生成日志文件名
-std::string get_logfile_name()
+std::string get_logfile_name(const std::string &basename, const std::string &suffix)
 {
-    char ret[28] = "WebServer";
     char str_t[25] = {0};
     struct timeval tv;
     gettimeofday(&tv, NULL);
     time_t sec = tv.tv_sec;
-    struct tm *ptime = localtime(&sec);
-    strftime(str_t, 26, "%Y%m%d%H%M%S", ptime);
-
-    strcat(ret, str_t);
-    strcat(ret, ".log");
+    struct tm tm_time;
+    localtime_r(&sec, &tm_time);
+    strftime(str_t, sizeof(str_t), "%Y%m%d%H%M%S", &tm_time);
 
-    return std::string(ret);
+    return basename + str_t + suffix;
 }
 
 // 根据sockaddr_in，返回IP地址的点分十进制字符串
@@ -2,34 +2,154 @@
 #include <getopt.h>
 #include "WebServer.h"
 #include "HttpTask.h"
-
-const int THREAD_NUM = 4;
-const int PORT = 80;
+#include "FileCache.h"
+#include "EncodingCache.h"
+#include "HttpHeaders.h"
+#include "ObjectPool.h"
+#include "Metrics.h"
+#include "Affinity.h"
 
 int main(int argc, char** argv)
 {
-    int thread_num = THREAD_NUM, port = PORT;
+    ServerConfig config;   // 端口号、初始超时时间、线程数、工作队列长度等，默认值见Config.h
     // 先解析参数
     int opt;
-    const char *str = "t:p:";
+    const char *str = "t:p:r:scn:b:m:lue:BL:Sq:U:D:A:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
         {
         case 't':
-            thread_num = atoi(optarg);
+            config.thread_num = atoi(optarg);
             break;
         case 'p':
-            port = atoi(optarg);
+            config.port = atoi(optarg);
+            break;
+        case 'r':
+            config.reactor_num = atoi(optarg);
+            break;
+        case 's':
+            config.reuseport = true;
+            break;
+        case 'c':
+            config.reuseport = true;
+            config.cpu_steering = true;
+            break;
+        case 'n':
+            config.max_conn = atoi(optarg);
+            break;
+        case 'b':
+            config.epoll_batch = atoi(optarg);
+            break;
+        case 'l':
+            config.lockfree_queue = true;
+            break;
+        case 'u':
+            config.io_uring = true;
+            break;
+        case 'm':
+            config.cache_bytes = static_cast<std::size_t>(atoi(optarg)) << 20;
+            break;
+        case 'e':
+            config.cache_control = optarg;
+            break;
+        case 'B':
+            config.binary_log = true;
+            break;
+        case 'L':
+            config.log_options = optarg;
+            break;
+        case 'S':
+            config.stats = false;
+            break;
+        case 'q':
+            config.max_queue = atoi(optarg);
+            break;
+        case 'U':
+            config.upgrade_path = optarg;
+            break;
+        case 'D':
+            config.drain_timeout = atoi(optarg);
+            break;
+        case 'A':
+            config.cpu_affinity = optarg;
             break;
         default:
             break;
         }
     }
 
-    auto server = WebServer<HttpTask>::CreateWebServer(port, 0.5*1000, thread_num, 10000);  // 端口号、初始超时时间、线程数、工作队列长度
+    AsyncLogging::Options log_options;
+    if (!AsyncLogging::ParseOptions(config.log_options, log_options))
+    {
+        std::cerr << "invalid log options: " << config.log_options << std::endl;
+        return 1;
+    }
+    log_options.binary = config.binary_log;
+    Logger::setOptions(log_options);
+    if (!HttpHeaders::InitCachePolicy(config.cache_control))
+    {
+        std::cerr << "invalid cache policy: " << config.cache_control << std::endl;
+        return 1;
+    }
+    FileCache::Init(config.cache_bytes, config.cache_file_max);
+    EncodingCache::Init(config.encoding_cache_bytes, config.cache_file_max);
+    Metrics::setEnabled(config.stats);
+    if (FileCache::instance())
+    {
+        Metrics::addCounter("file_cache_hits_total", "Static file cache hits.",
+                            []() {return static_cast<double>(FileCache::instance()->stats().hits);});
+        Metrics::addCounter("file_cache_misses_total", "Static file cache misses.",
+                            []() {return static_cast<double>(FileCache::instance()->stats().misses);});
+    }
+    if (EncodingCache::instance())
+    {
+        Metrics::addCounter("encoding_cache_hits_total", "Compressed file cache hits.",
+                            []() {return static_cast<double>(EncodingCache::instance()->stats().hits);});
+        Metrics::addCounter("encoding_cache_misses_total", "Compressed file cache misses.",
+                            []() {return static_cast<double>(EncodingCache::instance()->stats().misses);});
+    }
+    Metrics::addCounter("log_dropped_total", "Log records dropped because a log ring was full.", []() {
+        AsyncLogging *backend = Logger::backend();
+        return backend ? static_cast<double>(backend->dropped()) : 0.0;
+    });
+    Metrics::addCounter("log_stalls_total", "Times a thread waited for the log backend in lossless mode.", []() {
+        AsyncLogging *backend = Logger::backend();
+        return backend ? static_cast<double>(backend->stalls()) : 0.0;
+    });
+    // 全系统的计数，比较绑定CPU前后的增长速度
+    Metrics::addGauge("numa_local_node_pages", "Pages allocated on the node the allocating task ran on (all processes).",
+                      []() {return static_cast<double>(Affinity::numaStats().local_node);});
+    Metrics::addGauge("numa_other_node_pages", "Pages allocated on a node by tasks running on another node (all processes).",
+                      []() {return static_cast<double>(Affinity::numaStats().other_node);});
+    Metrics::addGauge("numa_miss_pages", "Pages allocated on a node other than the preferred one (all processes).",
+                      []() {return static_cast<double>(Affinity::numaStats().miss);});
+    auto server = WebServer<HttpTask>::CreateWebServer(config);
     if (server)
         server->work();
+
+    if (FileCache::instance())
+    {
+        FileCache::Stats st = FileCache::instance()->stats();
+        LOG_INFO << "file cache: hits=" << st.hits << " misses=" << st.misses << " evictions=" << st.evictions
+                 << " invalidations=" << st.invalidations << " entries=" << st.entries << " bytes=" << st.bytes;
+    }
+    if (EncodingCache::instance())
+    {
+        EncodingCache::Stats st = EncodingCache::instance()->stats();
+        LOG_INFO << "encoding cache: hits=" << st.hits << " misses=" << st.misses << " compressed=" << st.compressed
+                 << " sidecars=" << st.sidecars << " entries=" << st.entries << " bytes=" << st.bytes;
+    }
+    for (const BlockPoolStats &st : BlockPoolBase::allStats())
+    {
+        LOG_INFO << "block pool " << st.block_size << "B: allocations=" << st.allocations << " in_use=" << st.in_use
+                 << " slabs=" << st.slabs << " refills=" << st.refills << " flushes=" << st.flushes;
+    }
+    if (AsyncLogging *backend = Logger::backend())
+    {
+        LOG_INFO << "log: dropped=" << backend->dropped() << " stalls=" << backend->stalls()
+                 << " rolls=" << backend->rolls();
+    }
     
     return 0;
 }
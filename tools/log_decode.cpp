@@ -0,0 +1,262 @@
+// 把二进制日志（服务器的-B选项，文件格式见BinaryLog.h）转换成和文本模式相同的格式
+// 例如：20230706 21:05:57.229383 12345 INFO Receive GET request successful, socket = 123 - /src/HttpTask.cpp:195
+//
+// 用法：log_decode file.blog [file.blog.gz ...]，按顺序解码多个（滚动的）文件，结果输出到标准输出
+#include <stdint.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include "BinaryLog.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+const char *const LEVEL_STR[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+const int LEVEL_NUM = sizeof(LEVEL_STR) / sizeof(LEVEL_STR[0]);
+
+struct Site
+{
+    std::string file;
+    uint32_t line;
+    int level;
+};
+
+template <typename T>
+T load(const char *p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 读入整个文件，有zlib时gzread()也能读没有压缩的文件
+bool readFile(const char *filename, std::string &data)
+{
+    char buf[1 << 16];
+#ifdef HAVE_ZLIB
+    gzFile file = gzopen(filename, "rb");
+    if (!file)
+        return false;
+    int len;
+    while ((len = gzread(file, buf, sizeof(buf))) > 0)
+        data.append(buf, len);
+    // 压缩的文件最后一块不完整时（进程崩溃），保留已经解压的部分
+    gzclose(file);
+#else
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return false;
+    std::size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+        data.append(buf, len);
+    fclose(file);
+#endif
+    return true;
+}
+
+// 按帧遍历，文件截断（进程崩溃时可能出现）时停在最后一个完整的帧
+class FrameReader
+{
+public:
+    explicit FrameReader(const std::string &data): data_(data), pos_(sizeof(BINLOG_MAGIC)) {}
+    bool next(BinLogFrame &frame, const char *&payload)
+    {
+        if (pos_ + sizeof(frame) > data_.size())
+            return false;
+        memcpy(&frame, data_.data() + pos_, sizeof(frame));
+        if (frame.len == 0 || pos_ + sizeof(frame) + frame.len > data_.size())
+            return false;
+        payload = data_.data() + pos_ + sizeof(frame);
+        pos_ += sizeof(frame) + frame.len;
+        return true;
+    }
+    bool truncated() const {return pos_ != data_.size();}
+
+private:
+    const std::string &data_;
+    std::size_t pos_;
+};
+
+// 和Logger::Impl一样，同一秒内只格式化微秒
+void appendTime(std::string &out, int64_t timestamp)
+{
+    static time_t last_second = -1;
+    static char time_str[32];
+    time_t sec = timestamp / 1000000;
+    if (sec != last_second)
+    {
+        struct tm tm_time;
+        localtime_r(&sec, &tm_time);
+        strftime(time_str, sizeof(time_str), "%Y%m%d %H:%M:%S", &tm_time);
+        last_second = sec;
+    }
+    char usec[8];
+    snprintf(usec, sizeof(usec), ".%06u", static_cast<unsigned>(timestamp % 1000000));
+    out += time_str;
+    out += usec;
+}
+
+// 参数的格式和LogStream文本模式相同，返回false表示记录损坏
+bool appendArgs(std::string &out, const char *p, const char *end)
+{
+    char buf[64];
+    while (p < end)
+    {
+        char type = *p++;
+        std::size_t size = 0;
+        switch (type)
+        {
+        case ARG_BOOL:
+        case ARG_CHAR:
+            size = 1;
+            break;
+        case ARG_INT32:
+        case ARG_UINT32:
+            size = 4;
+            break;
+        case ARG_INT64:
+        case ARG_UINT64:
+        case ARG_DOUBLE:
+            size = 8;
+            break;
+        case ARG_STRING:
+            if (end - p < 2)
+                return false;
+            size = 2 + load<uint16_t>(p);
+            break;
+        default:
+            return false;
+        }
+        if (static_cast<std::size_t>(end - p) < size)
+            return false;
+        switch (type)
+        {
+        case ARG_BOOL:
+            out += *p ? '1' : '0';
+            break;
+        case ARG_CHAR:
+            out += *p;
+            break;
+        case ARG_INT32:
+            out += std::to_string(load<int32_t>(p));
+            break;
+        case ARG_UINT32:
+            out += std::to_string(load<uint32_t>(p));
+            break;
+        case ARG_INT64:
+            out += std::to_string(static_cast<long long>(load<int64_t>(p)));
+            break;
+        case ARG_UINT64:
+            out += std::to_string(static_cast<unsigned long long>(load<uint64_t>(p)));
+            break;
+        case ARG_DOUBLE:
+            snprintf(buf, sizeof(buf), "%.12g", load<double>(p));
+            out += buf;
+            break;
+        case ARG_STRING:
+            out.append(p + 2, size - 2);
+            break;
+        }
+        p += size;
+    }
+    return true;
+}
+
+bool decode(const char *filename)
+{
+    std::string data;
+    if (!readFile(filename, data))
+    {
+        fprintf(stderr, "%s: cannot open\n", filename);
+        return false;
+    }
+    if (data.size() < sizeof(BINLOG_MAGIC) || memcmp(data.data(), BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0)
+    {
+        fprintf(stderr, "%s: not a binary log\n", filename);
+        return false;
+    }
+
+    // 第一遍读出所有调用点的定义
+    std::unordered_map<uint32_t, Site> sites;
+    BinLogFrame frame;
+    const char *payload;
+    FrameReader defs(data);
+    while (defs.next(frame, payload))
+    {
+        if (payload[0] != RECORD_SITE || frame.len < static_cast<uint32_t>(BINLOG_SITE_HEAD))
+            continue;
+        Site site;
+        site.line = load<uint32_t>(payload + 5);
+        site.level = payload[9];
+        site.file.assign(payload + BINLOG_SITE_HEAD, frame.len - BINLOG_SITE_HEAD);
+        sites[load<uint32_t>(payload + 1)] = site;
+    }
+
+    // 第二遍输出日志
+    std::string out;
+    unsigned long corrupted = 0;
+    FrameReader lines(data);
+    while (lines.next(frame, payload))
+    {
+        if (payload[0] == RECORD_TEXT)
+        {
+            out.append(payload + 1, frame.len - 1);
+        }
+        else if (payload[0] == RECORD_LINE && frame.len >= static_cast<uint32_t>(BINLOG_LINE_HEAD))
+        {
+            std::size_t begin = out.size();
+            auto it = sites.find(load<uint32_t>(payload + 1));
+            appendTime(out, frame.timestamp);
+            out += ' ';
+            out += std::to_string(load<uint32_t>(payload + 5));
+            out += ' ';
+            if (it != sites.end() && it->second.level >= 0 && it->second.level < LEVEL_NUM)
+                out += LEVEL_STR[it->second.level];
+            else
+                out += "UNKNOWN";
+            out += ' ';
+            if (!appendArgs(out, payload + BINLOG_LINE_HEAD, payload + frame.len))
+            {
+                out.resize(begin);
+                ++corrupted;
+                continue;
+            }
+            if (it != sites.end())
+                out += " - " + it->second.file + ":" + std::to_string(it->second.line);
+            out += '\n';
+        }
+        if (out.size() > (1 << 20))
+        {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    if (lines.truncated())
+        fprintf(stderr, "%s: truncated at the end\n", filename);
+    if (corrupted > 0)
+        fprintf(stderr, "%s: %lu corrupted records skipped\n", filename, corrupted);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file.blog [file.blog.gz ...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!decode(argv[i]))
+            ret = 1;
+    }
+    return ret;
+}
@@ -1,5 +1,18 @@
 add_rules("mode.debug", "mode.release")
 
+-- 静态文件的即时压缩，和CMake一样在配置时检测，找不到库时只使用预压缩文件
+option("zlib")
+    add_links("z")
+    add_cincludes("zlib.h")
+    add_defines("HAVE_ZLIB")
+option_end()
+
+option("brotli")
+    add_links("brotlienc")
+    add_cincludes("brotli/encode.h")
+    add_defines("HAVE_BROTLI")
+option_end()
+
 target("HttpServer")
     set_kind("binary")
     add_files("src/*.cpp")
@@ -7,6 +20,52 @@ target("HttpServer")
     set_languages("c++11")
     add_syslinks("pthread")
     set_optimize("faster")
+    add_options("zlib", "brotli")
+
+target("conn_hold")
+    set_kind("binary")
+    add_files("bench/conn_hold.cpp")
+    set_languages("c++11")
+    set_optimize("faster")
+
+target("parser_bench")
+    set_kind("binary")
+    add_files("bench/parser_bench.cpp", "src/HttpParser.cpp")
+    add_includedirs("include")
+    set_languages("c++11")
+    set_optimize("faster")
+
+target("log_bench")
+    set_kind("binary")
+    add_files("bench/log_bench.cpp", "src/AsyncLogging.cpp", "src/Logging.cpp", "src/LogStream.cpp", "src/Utils.cpp", "src/Affinity.cpp")
+    add_includedirs("include")
+    set_languages("c++11")
+    add_syslinks("pthread")
+    set_optimize("faster")
+
+target("micro_bench")
+    set_kind("binary")
+    add_files("bench/micro_bench.cpp", "src/HttpParser.cpp", "src/AsyncLogging.cpp", "src/Logging.cpp", "src/LogStream.cpp", "src/Utils.cpp", "src/Metrics.cpp", "src/Affinity.cpp")
+    add_includedirs("include")
+    set_languages("c++11")
+    add_syslinks("pthread")
+    set_optimize("faster")
+
+target("http_load")
+    set_kind("binary")
+    add_files("bench/http_load.cpp")
+    set_languages("c++11")
+    add_syslinks("pthread")
+    set_optimize("faster")
+
+target("log_decode")
+    set_kind("binary")
+    add_files("tools/log_decode.cpp")
+    add_includedirs("include")
+    set_languages("c++11")
+    -- 读取压缩的日志，需要zlib
+    add_options("zlib")
+    set_optimize("faster")
 
 --
 -- If you want to known more usage about xmake, please see https://xmake.io